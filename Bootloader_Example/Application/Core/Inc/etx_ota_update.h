@@ -15,6 +15,7 @@
 #define ETX_OTA_EOF  0xBB    // End of Frame
 #define ETX_OTA_ACK  0x00    // ACK
 #define ETX_OTA_NACK 0x01    // NACK
+#define ETX_OTA_ALREADY 0x02 // Image is already present in a slot (no download)
 
 #define ETX_APP_FLASH_ADDR        0x08040000   //Application's Flash Address
 #define ETX_APP_SLOT0_FLASH_ADDR  0x080C0000   //App slot 0 address
@@ -22,8 +23,15 @@
 #define ETX_CONFIG_FLASH_ADDR     0x08020000   //Configuration's address
 
 #define ETX_NO_OF_SLOTS           2            //Number of slots
+#define ETX_NO_OF_SECTORS         12           //Number of flash sectors
+#define ETX_CONFIG_SECTOR_SIZE   (128 * 1024)  //Config's flash sector size (sector 4)
 #define ETX_SLOT_MAX_SIZE        (512 * 1024)  //Each slot size (512KB)
 
+#define ETX_DIGEST_SIZE           ( 32 )                  //SHA-256 digest size
+#define ETX_APP_DESC_MAGIC        ( 0x44585445 )          //"ETXD"
+#define ETX_FW_VERSION( major, minor, patch ) \
+          ( ( (major) << 16 ) | ( (minor) << 8 ) | (patch) )
+
 #define ETX_OTA_DATA_MAX_SIZE ( 1024 )  //Maximum data Size
 #define ETX_OTA_DATA_OVERHEAD (    9 )  //data overhead
 #define ETX_OTA_PACKET_MAX_SIZE ( ETX_OTA_DATA_MAX_SIZE + ETX_OTA_DATA_OVERHEAD )
@@ -35,6 +43,22 @@
 #define ETX_NORMAL_BOOT           ( 0xBEEFFEED )      //Normal Boot
 #define ETX_OTA_REQUEST           ( 0xDEADBEEF )      //OTA request by application
 #define ETX_LOAD_PREV_APP         ( 0xFACEFADE )      //App requests to load the previous version
+#define ETX_LOAD_STORE_APP( ver ) ( 0x5E000000 | ( (ver) & 0x00FFFFFF ) ) //App requests a version from the SD image store
+#define ETX_LOAD_STORE_APP_MASK   ( 0xFF000000 )
+
+/*
+ * Trial boot. A new firmware runs in the trial state until the application
+ * confirms it (etx_app_confirm). Otherwise, the bootloader reverts to the
+ * previous firmware. The watchdog is running in the trial boot, so the
+ * application has to refresh it (etx_app_wdg_refresh).
+ */
+#define ETX_SLOT_TRIAL            ( 0x7E57B007 )      //Firmware is not confirmed yet
+#define ETX_APP_CONFIRM_DELAY     ( 5000 )            //Confirm after running this long (ms)
+
+/*
+ * Bootloader update marker (handled by the bootloader)
+ */
+#define ETX_BL_UPDATE_PENDING     ( 0xB007C0DE )      //New bootloader is staged in a slot
 
 /*
  * Exception codes
@@ -66,6 +90,7 @@ typedef enum
   ETX_OTA_PACKET_TYPE_DATA      = 1,    // Data
   ETX_OTA_PACKET_TYPE_HEADER    = 2,    // Header
   ETX_OTA_PACKET_TYPE_RESPONSE  = 3,    // Response
+  ETX_OTA_PACKET_TYPE_INFO      = 4,    // Device info (response to GET_INFO)
 }ETX_OTA_PACKET_TYPE_;
 
 /*
@@ -76,8 +101,19 @@ typedef enum
   ETX_OTA_CMD_START = 0,    // OTA Start command
   ETX_OTA_CMD_END   = 1,    // OTA End command
   ETX_OTA_CMD_ABORT = 2,    // OTA Abort command
+  ETX_OTA_CMD_GET_INFO = 3, // Device info/capability query
+  ETX_OTA_CMD_READ_BACK = 4,// Read back the flash (ETX_OTA_READ_CMD_)
 }ETX_OTA_CMD_;
 
+/*
+ * Image type (meta_info.image_type)
+ */
+typedef enum
+{
+  ETX_OTA_IMAGE_APP         = 0,    // Application
+  ETX_OTA_IMAGE_BOOTLOADER  = 1,    // Bootloader
+}ETX_OTA_IMAGE_;
+
 /*
  * Slot table
  */
@@ -88,20 +124,51 @@ typedef struct
     uint8_t  should_we_run_this_fw;   //Do we have to run this slot's firmware?
     uint32_t fw_size;                 //Slot's firmware/application size
     uint32_t fw_crc;                  //Slot's firmware/application CRC
-    uint32_t reserved1;
-    uint32_t reserved2;
-    uint32_t reserved3;
+    uint32_t trial_state;             //ETX_SLOT_TRIAL if the firmware is not confirmed yet
+    uint32_t boot_attempts;           //Number of boots in the trial state
+    uint32_t fw_version;              //Slot's firmware version (ETX_FW_VERSION)
+    uint32_t build_id;                //Slot's firmware build ID (build timestamp)
+    uint8_t  digest[ETX_DIGEST_SIZE]; //Slot's firmware SHA-256
 }__attribute__((packed)) ETX_SLOT_;
 
+/*
+ * Bootloader update marker
+ */
+typedef struct
+{
+    uint32_t state;                   //ETX_BL_UPDATE_PENDING if a new bootloader is staged
+    uint32_t slot_num;                //Slot that has the new bootloader
+    uint32_t size;                    //New bootloader's size
+    uint32_t crc;                     //New bootloader's CRC
+    uint32_t boot_addr;               //BOOT_ADD0 option byte to restore after the copy
+}__attribute__((packed)) ETX_BL_UPDATE_;
+
 /*
  * General configuration
  */
 typedef struct
 {
-    uint32_t  reboot_cause;
-    ETX_SLOT_ slot_table[ETX_NO_OF_SLOTS];
+    uint32_t       reboot_cause;
+    ETX_SLOT_      slot_table[ETX_NO_OF_SLOTS];
+    ETX_BL_UPDATE_ bl_update;
+    uint32_t       erase_count[ETX_NO_OF_SECTORS];  //Number of erases of each flash sector
 }__attribute__((packed)) ETX_GNRL_CFG_;
 
+/*
+ * Configuration record. The config sector is used as a log. Every config
+ * write appends a new record and the sector is erased only when it is full.
+ * The last record that has the magic is the current configuration. The magic
+ * is written after the configuration, so a half written record is skipped.
+ */
+#define ETX_CFG_RECORD_MAGIC      ( 0xC0F1C0DE )
+#define ETX_CFG_RECORD_SIZE       ( ( sizeof(ETX_CFG_RECORD_) + 3u ) & ~3u )
+
+typedef struct
+{
+    uint32_t       magic;             //ETX_CFG_RECORD_MAGIC
+    ETX_GNRL_CFG_  cfg;
+}__attribute__((packed)) ETX_CFG_RECORD_;
+
 /*
  * OTA meta info
  */
@@ -109,10 +176,23 @@ typedef struct
 {
   uint32_t package_size;
   uint32_t package_crc;
-  uint32_t reserved1;
-  uint32_t reserved2;
+  uint32_t fw_version;                // Firmware version (ETX_FW_VERSION)
+  uint32_t build_id;                  // Build ID (build timestamp)
+  uint8_t  digest[ETX_DIGEST_SIZE];   // SHA-256 of the image (all 0 - unknown)
+  uint32_t image_type;                // ETX_OTA_IMAGE_
 }__attribute__((packed)) meta_info;
 
+/*
+ * Application image descriptor. The application embeds this in its image, so
+ * the host tool can find the version and the build time of the image.
+ */
+typedef struct
+{
+  uint32_t magic;                     // ETX_APP_DESC_MAGIC
+  uint32_t fw_version;                // Firmware version (ETX_FW_VERSION)
+  char     build_time[24];            // __DATE__ " " __TIME__
+}__attribute__((packed)) ETX_APP_DESC_;
+
 /*
  * OTA Command format
  *
@@ -139,7 +219,7 @@ typedef struct
  * |     | Packet |     | Header |     |     |
  * | SOF | Type   | Len |  Data  | CRC | EOF |
  * |_____|________|_____|________|_____|_____|
- *   1B      1B     2B     16B     4B    1B
+ *   1B      1B     2B     52B     4B    1B
  */
 typedef struct
 {
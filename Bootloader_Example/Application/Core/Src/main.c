@@ -23,6 +23,7 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "etx_ota_update.h"
 /* USER CODE END Includes */
@@ -48,7 +49,16 @@ UART_HandleTypeDef huart3;
 
 /* USER CODE BEGIN PV */
 const uint8_t APP_Version[2] = { MAJOR, MINOR };
-uint8_t rx_buf[4];
+/* Image descriptor. The host tool reads the version and build time from this. */
+const ETX_APP_DESC_ app_desc =
+{
+  .magic      = ETX_APP_DESC_MAGIC,
+  .fw_version = ETX_FW_VERSION( MAJOR, MINOR, 0 ),
+  .build_time = __DATE__ " " __TIME__,
+};
+uint8_t rx_buf[10];                 //Command (3) + version in hex (6) + '\0'
+bool    is_ver_cmd       = false;   //"ver" is received. Waiting for the version.
+bool    is_app_confirmed = false;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -58,6 +68,9 @@ static void MX_USART3_UART_Init(void);
 static void MX_USART2_UART_Init(void);
 /* USER CODE BEGIN PFP */
 static HAL_StatusTypeDef write_cfg_to_flash( ETX_GNRL_CFG_ *cfg );
+static ETX_GNRL_CFG_ *get_cfg( uint32_t *next_offset );
+static void etx_app_confirm( void );
+static void etx_app_wdg_refresh( void );
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -67,7 +80,47 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
   if (huart->Instance == USART2)
   {
-    if( !strncmp("ota", (char*)rx_buf, 3) )
+    if( is_ver_cmd )
+    {
+      char     *end;
+      uint32_t ver;
+
+      is_ver_cmd = false;
+      rx_buf[9]  = '\0';
+      ver        = strtoul( (char*)&rx_buf[3], &end, 16 );
+      if( end == (char*)&rx_buf[9] )
+      {
+        printf("Received Load Version 0x%06lX Request from Mobile Application\r\n", ver);
+
+        /* Update the reboot reason as load the version from the SD image store */
+
+        /* Read the configuration */
+        ETX_GNRL_CFG_ cfg;
+        memcpy( &cfg, get_cfg( NULL ), sizeof(ETX_GNRL_CFG_) );
+
+        //update the reboot reason
+        cfg.reboot_cause = ETX_LOAD_STORE_APP( ver );
+
+        /* write back the updated config */
+        write_cfg_to_flash( &cfg );
+
+        // Reset the controller
+        HAL_NVIC_SystemReset();
+      }
+      else
+      {
+        printf("Invalid Version\r\n");
+        HAL_UART_Receive_IT(&huart2, rx_buf, 3);
+      }
+    }
+    else if( !strncmp("ver", (char*)rx_buf, 3) )
+    {
+      //The version follows (6 hex digits. Ex: "ver010203" loads 1.2.3)
+      is_ver_cmd = true;
+      HAL_UART_Receive_IT(&huart2, &rx_buf[3], 6);
+      return;
+    }
+    else if( !strncmp("ota", (char*)rx_buf, 3) )
     {
       printf("Received OTA Request from Mobile Application\r\n");
 
@@ -75,7 +128,7 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 
       /* Read the configuration */
       ETX_GNRL_CFG_ cfg;
-      memcpy( &cfg, (ETX_GNRL_CFG_*) (ETX_CONFIG_FLASH_ADDR), sizeof(ETX_GNRL_CFG_) );
+      memcpy( &cfg, get_cfg( NULL ), sizeof(ETX_GNRL_CFG_) );
 
       //update the reboot reason
       cfg.reboot_cause = ETX_OTA_REQUEST;
@@ -86,6 +139,25 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
       // Reset the controller
       HAL_NVIC_SystemReset();
     }
+    else if( !strncmp("rbk", (char*)rx_buf, 3) )
+    {
+      printf("Received Rollback Request from Mobile Application\r\n");
+
+      /* Update the reboot reason as load previous app request */
+
+      /* Read the configuration */
+      ETX_GNRL_CFG_ cfg;
+      memcpy( &cfg, get_cfg( NULL ), sizeof(ETX_GNRL_CFG_) );
+
+      //update the reboot reason
+      cfg.reboot_cause = ETX_LOAD_PREV_APP;
+
+      /* write back the updated config */
+      write_cfg_to_flash( &cfg );
+
+      // Reset the controller
+      HAL_NVIC_SystemReset();
+    }
     else
     {
       HAL_UART_Receive_IT(&huart2, rx_buf, 3);
@@ -128,6 +200,7 @@ int main(void)
   MX_USART2_UART_Init();
   /* USER CODE BEGIN 2 */
   printf("Starting Application(%d.%d)\r\n", APP_Version[0], APP_Version[1] );
+  printf("Build : %s\r\n", app_desc.build_time );
   HAL_UART_Receive_IT(&huart2, rx_buf, 3);
   /* USER CODE END 2 */
 
@@ -138,6 +211,15 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
+    etx_app_wdg_refresh();
+
+    /* We are running fine for a while. Tell the bootloader. */
+    if( ( !is_app_confirmed ) && ( HAL_GetTick() > ETX_APP_CONFIRM_DELAY ) )
+    {
+      etx_app_confirm();
+      is_app_confirmed = true;
+    }
+
     HAL_GPIO_WritePin( GPIOB, GPIO_PIN_7, GPIO_PIN_SET );
     HAL_Delay(200);    //200ms delay
     HAL_GPIO_WritePin( GPIOB, GPIO_PIN_7, GPIO_PIN_RESET );
@@ -309,13 +391,106 @@ int fputc(int ch, FILE *f)
 }
 
 /**
-  * @brief Write the configuration to flash
+  * @brief Confirm the running firmware, so the bootloader won't revert it.
+  * @param none
+  * @retval none
+  */
+static void etx_app_confirm( void )
+{
+  bool is_updated = false;
+
+  /* Read the configuration */
+  ETX_GNRL_CFG_ cfg;
+  memcpy( &cfg, get_cfg( NULL ), sizeof(ETX_GNRL_CFG_) );
+
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    if( ( cfg.slot_table[i].is_this_slot_active == 1u ) &&
+        ( cfg.slot_table[i].trial_state == ETX_SLOT_TRIAL ) )
+    {
+      cfg.slot_table[i].trial_state   = 0u;
+      cfg.slot_table[i].boot_attempts = 0u;
+      is_updated = true;
+    }
+  }
+
+  //Write only if we have to. Don't wear the flash on every boot.
+  if( is_updated )
+  {
+    printf("Firmware confirmed\r\n");
+    write_cfg_to_flash( &cfg );
+  }
+}
+
+/**
+  * @brief Refresh the watchdog. The bootloader starts it in the trial boot.
+  *        Refreshing is harmless if the watchdog is not running.
+  * @param none
+  * @retval none
+  */
+static void etx_app_wdg_refresh( void )
+{
+  IWDG->KR = 0xAAAA;
+}
+
+/**
+  * @brief Find the latest configuration record (see ETX_CFG_RECORD_).
+  * @param next_offset offset of the next free record (can be NULL)
+  * @retval configuration
+  */
+static ETX_GNRL_CFG_ *get_cfg( uint32_t *next_offset )
+{
+  //Erased sector or the old layout (config at the start of the sector)
+  ETX_GNRL_CFG_ *cfg  = (ETX_GNRL_CFG_*) (ETX_CONFIG_FLASH_ADDR);
+  uint32_t       next = ETX_CONFIG_SECTOR_SIZE;
+
+  for( uint32_t offset = 0u;
+       ( offset + ETX_CFG_RECORD_SIZE ) <= ETX_CONFIG_SECTOR_SIZE;
+       offset += ETX_CFG_RECORD_SIZE )
+  {
+    ETX_CFG_RECORD_ *rec = (ETX_CFG_RECORD_ *)( ETX_CONFIG_FLASH_ADDR + offset );
+
+    if( rec->magic == ETX_CFG_RECORD_MAGIC )
+    {
+      cfg = &rec->cfg;
+      continue;
+    }
+
+    //Records are only appended. So, rest of the sector is free after an erased one.
+    bool is_erased = true;
+    for( uint32_t i = 0u; i < ETX_CFG_RECORD_SIZE; i += 4u )
+    {
+      if( *(volatile uint32_t *)( (uint32_t)rec + i ) != 0xFFFFFFFF )
+      {
+        is_erased = false;
+        break;
+      }
+    }
+
+    if( is_erased )
+    {
+      next = offset;
+      break;
+    }
+  }
+
+  if( next_offset != NULL )
+  {
+    *next_offset = next;
+  }
+  return cfg;
+}
+
+/**
+  * @brief Write the configuration to flash. The config is appended to the
+  *        config sector. The sector is erased only when it is full.
   * @param cfg config structure
   * @retval none
   */
 static HAL_StatusTypeDef write_cfg_to_flash( ETX_GNRL_CFG_ *cfg )
 {
   HAL_StatusTypeDef ret;
+  uint32_t          offset;
 
   do
   {
@@ -325,6 +500,8 @@ static HAL_StatusTypeDef write_cfg_to_flash( ETX_GNRL_CFG_ *cfg )
       break;
     }
 
+    get_cfg( &offset );
+
     ret = HAL_FLASH_Unlock();
     if( ret != HAL_OK )
     {
@@ -334,31 +511,45 @@ static HAL_StatusTypeDef write_cfg_to_flash( ETX_GNRL_CFG_ *cfg )
     //Check if the FLASH_FLAG_BSY.
     FLASH_WaitForLastOperation( HAL_MAX_DELAY );
 
-    //Erase the Flash
-    FLASH_EraseInitTypeDef EraseInitStruct;
-    uint32_t SectorError;
-
-    EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
-    EraseInitStruct.Sector        = FLASH_SECTOR_4;
-    EraseInitStruct.NbSectors     = 1;                    //erase only sector 4
-    EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
-
     // clear all flags before you write it to flash
     __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR |
                 FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR);
 
-    ret = HAL_FLASHEx_Erase( &EraseInitStruct, &SectorError );
-    if( ret != HAL_OK )
+    if( ( offset + ETX_CFG_RECORD_SIZE ) > ETX_CONFIG_SECTOR_SIZE )
     {
-      break;
+      //Config sector is full. Erase it and start over.
+      FLASH_EraseInitTypeDef EraseInitStruct;
+      uint32_t SectorError;
+
+      EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
+      EraseInitStruct.Sector        = FLASH_SECTOR_4;
+      EraseInitStruct.NbSectors     = 1;                    //erase only sector 4
+      EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
+
+      ret = HAL_FLASHEx_Erase( &EraseInitStruct, &SectorError );
+      if( ret != HAL_OK )
+      {
+        break;
+      }
+
+      //Count the erase (the bootloader keeps the counters)
+      if( cfg->erase_count[FLASH_SECTOR_4] == 0xFFFFFFFF )
+      {
+        cfg->erase_count[FLASH_SECTOR_4] = 0u;
+      }
+      cfg->erase_count[FLASH_SECTOR_4]++;
+
+      offset = 0u;
     }
 
+    uint32_t rec_addr = ETX_CONFIG_FLASH_ADDR + offset;
+
     //write the configuration
     uint8_t *data = (uint8_t *) cfg;
     for( uint32_t i = 0u; i < sizeof(ETX_GNRL_CFG_); i++ )
     {
       ret = HAL_FLASH_Program( FLASH_TYPEPROGRAM_BYTE,
-                               ETX_CONFIG_FLASH_ADDR + i,
+                               rec_addr + sizeof(uint32_t) + i,
                                data[i]
                              );
       if( ret != HAL_OK )
@@ -368,6 +559,12 @@ static HAL_StatusTypeDef write_cfg_to_flash( ETX_GNRL_CFG_ *cfg )
       }
     }
 
+    //write the magic at the end. Now the record is valid.
+    if( ret == HAL_OK )
+    {
+      ret = HAL_FLASH_Program( FLASH_TYPEPROGRAM_WORD, rec_addr, ETX_CFG_RECORD_MAGIC );
+    }
+
     //Check if the FLASH_FLAG_BSY.
     FLASH_WaitForLastOperation( HAL_MAX_DELAY );
 
@@ -0,0 +1,132 @@
+/*
+ * etx_journal.h
+ *
+ *  Created on: 18-Oct-2026
+ *      Author: EmbeTronicX
+ */
+
+#ifndef INC_ETX_JOURNAL_H_
+#define INC_ETX_JOURNAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+
+/*
+ * Boot and update telemetry journal. The bootloader collects compact binary
+ * records in the RAM while it boots. Before it leaves, it appends them to
+ * ETX_JOURNAL_PATH as one batch, if the SD card was found in this boot.
+ *
+ * A batch is a whole number of sectors and the file always ends at a sector
+ * boundary. So, FatFs hands the batch to the disk driver in one multi sector
+ * write (CMD25) and never has to read a sector back.
+ */
+#define ETX_JOURNAL_PATH          "ETX_FW/journal.bin"    // Journal file in SD card
+#define ETX_JOURNAL_OLD_PATH      "ETX_FW/journal.old"    // Previous journal file
+#define ETX_JOURNAL_DIR           "ETX_FW"
+#define ETX_JOURNAL_MAX_SIZE      ( 1024 * 1024 )         // Journal is rotated at this size
+#define ETX_JOURNAL_SECTOR_SIZE   ( 512 )
+#define ETX_JOURNAL_MAX_SECTORS   ( 2 )                   // Max batch size (sectors)
+#define ETX_JOURNAL_MAGIC         ( 0x4C4E524A )          // "JRNL"
+
+/*
+ * Batch format (little endian)
+ *
+ * ____________________________________________________________________
+ * |          |         |         |    |         |      |     |       |
+ * | Header   | Record0 | Record1 | .. | RecordN | 0xFF padding to    |
+ * | (24B)    |         |         |    |         | the sector boundary |
+ * |__________|_________|_________|____|_________|_____________________|
+ *
+ * Every record starts with its type (1B) and the length of its data (1B).
+ * CRC in the header covers all the records (same CRC32 as the OTA frames).
+ */
+typedef struct
+{
+  uint32_t magic;                   // ETX_JOURNAL_MAGIC
+  uint16_t sectors;                 // Batch size in sectors
+  uint16_t rec_len;                 // Length of all the records
+  uint8_t  bl_version[2];           // Bootloader version (major, minor)
+  uint8_t  dropped;                 // Records that didn't fit in the batch
+  uint8_t  reserved;
+  uint32_t reboot_cause;            // Reboot cause at the start of the boot
+  uint32_t tick;                    // Time since the reset when the batch is written (ms)
+  uint32_t crc;                     // CRC32 of the records
+}__attribute__((packed)) ETX_JOURNAL_HDR_;
+
+/*
+ * Record types
+ */
+typedef enum
+{
+  ETX_JOURNAL_REC_STAGE     = 1,    // ETX_JOURNAL_STAGE_REC_
+  ETX_JOURNAL_REC_UPDATE    = 2,    // ETX_JOURNAL_UPDATE_REC_
+  ETX_JOURNAL_REC_COUNTERS  = 3,    // ETX_JOURNAL_CNT_MAX x uint16_t
+}ETX_JOURNAL_REC_;
+
+/*
+ * Boot stages
+ */
+typedef enum
+{
+  ETX_JOURNAL_STAGE_BL_UPDATE = 0,  // Bootloader update (update_bootloader())
+  ETX_JOURNAL_STAGE_SD        = 1,  // SD card update
+  ETX_JOURNAL_STAGE_OTA       = 2,  // UART OTA update
+  ETX_JOURNAL_STAGE_APP_LOAD  = 3,  // Loading and verifying the application
+}ETX_JOURNAL_STAGE_;
+
+/*
+ * Update sources
+ */
+typedef enum
+{
+  ETX_JOURNAL_SRC_UART      = 0,
+  ETX_JOURNAL_SRC_SD        = 1,
+}ETX_JOURNAL_SRC_;
+
+/*
+ * Error counters
+ */
+typedef enum
+{
+  ETX_JOURNAL_CNT_FRAME_ERR   = 0,  // Bad OTA frames (CRC, SOF, EOF or length)
+  ETX_JOURNAL_CNT_NACK        = 1,  // NACKs sent to the host
+  ETX_JOURNAL_CNT_APP_CRC_ERR = 2,  // Application failed the CRC check at boot
+  ETX_JOURNAL_CNT_DIGEST_ERR  = 3,  // Image didn't match its digest
+  ETX_JOURNAL_CNT_FLASH_ERR   = 4,  // Flash erase or program errors
+  ETX_JOURNAL_CNT_SD_ERR      = 5,  // SD card read errors
+  ETX_JOURNAL_CNT_REVERT      = 6,  // Applications reverted
+  ETX_JOURNAL_CNT_MAX,
+}ETX_JOURNAL_CNT_;
+
+/*
+ * Stage record
+ */
+typedef struct
+{
+  uint8_t  stage;                   // ETX_JOURNAL_STAGE_
+  uint8_t  result;                  // Stage's return code (ETX_OTA_EX_, ETX_SD_EX_)
+  uint32_t start;                   // Time since the reset (ms)
+  uint32_t duration;                // ms
+}__attribute__((packed)) ETX_JOURNAL_STAGE_REC_;
+
+/*
+ * Update record
+ */
+typedef struct
+{
+  uint8_t  source;                  // ETX_JOURNAL_SRC_
+  uint8_t  image_type;              // ETX_OTA_IMAGE_
+  uint8_t  result;                  // 0 - OK
+  uint32_t size;                    // Image size
+  uint32_t duration;                // ms
+  uint32_t throughput;              // Bytes per second
+}__attribute__((packed)) ETX_JOURNAL_UPDATE_REC_;
+
+void etx_journal_init( uint32_t reboot_cause );
+void etx_journal_stage( uint8_t stage, uint32_t start_tick, uint8_t result );
+void etx_journal_update( uint8_t source, uint8_t image_type, uint32_t size,
+                         uint32_t start_tick, uint8_t result );
+void etx_journal_count( uint8_t counter );
+void etx_journal_flush( void );
+#endif /* INC_ETX_JOURNAL_H_ */
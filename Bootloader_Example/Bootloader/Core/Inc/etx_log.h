@@ -0,0 +1,124 @@
+/*
+ * etx_log.h
+ *
+ *  Created on: 18-Oct-2026
+ *      Author: EmbeTronicX
+ */
+
+#ifndef INC_ETX_LOG_H_
+#define INC_ETX_LOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+
+/*
+ * Log levels
+ */
+#define ETX_LOG_LEVEL_NONE    0     // No logs at all
+#define ETX_LOG_LEVEL_ERROR   1     // Errors only
+#define ETX_LOG_LEVEL_WARN    2     // Errors and warnings
+#define ETX_LOG_LEVEL_INFO    3     // Normal boot/update messages
+#define ETX_LOG_LEVEL_DEBUG   4     // Chatty logs (per chunk progress, etc)
+
+/*
+ * Compile time log level. Everything above this level is removed from the
+ * build. Debug builds keep everything, release builds drop the debug logs.
+ */
+#ifndef ETX_LOG_LEVEL
+#ifdef DEBUG
+#define ETX_LOG_LEVEL         ETX_LOG_LEVEL_DEBUG
+#else
+#define ETX_LOG_LEVEL         ETX_LOG_LEVEL_INFO
+#endif
+#endif
+
+/*
+ * Tokenised (deferred format) logging. When enabled, the call sites don't
+ * format anything. They emit a compact binary record instead and the host
+ * tool (HostApp/LogDecoder) rebuilds the text using the format strings
+ * extracted from the build (.etx_log_fmt section -> <project>.logfmt).
+ *
+ * Only integer arguments (%d, %i, %u, %x, %X, %c, ...) are supported here.
+ */
+#ifndef ETX_LOG_TOKENISED
+#ifdef DEBUG
+#define ETX_LOG_TOKENISED     0
+#else
+#define ETX_LOG_TOKENISED     1
+#endif
+#endif
+
+#define ETX_LOG_RING_SIZE     ( 2048 )  //Ring buffer size (must be power of 2)
+#define ETX_LOG_FLUSH_TIMEOUT ( 500 )   //Max time to wait for the flush (ms)
+
+/*
+ * Tokenised log record format
+ *
+ * ______________________________________________________________
+ * |     |        | Level |   Tick   |   Arg 0  |     |   Arg n  |
+ * | SOF | Fmt ID | NArgs |  varint  |  varint  | ... |  varint  |
+ * |_____|________|_______|__________|__________|_____|__________|
+ *   1B      2B      1B     1B - 5B    1B - 5B         1B - 5B
+ *
+ * Fmt ID is the offset of the format string in the .etx_log_fmt section.
+ * Level is in the upper nibble and the number of arguments in the lower one.
+ * Varints are LEB128 encoded (7 bits per byte, LSB first).
+ */
+#define ETX_LOG_TOKEN_SOF       0xA5    // Start of record
+#define ETX_LOG_TOKEN_MAX_ARGS  ( 8 )   // Maximum arguments per record
+#define ETX_LOG_TOKEN_MAX_LEN   ( 4 + ( ( ETX_LOG_TOKEN_MAX_ARGS + 1 ) * 5 ) )
+
+/* Number of arguments passed to the log macro */
+#define ETX_LOG_NARGS(...)    ( sizeof( (uint32_t[]){ 0, ##__VA_ARGS__ } ) / sizeof(uint32_t) - 1u )
+
+#define ETX_LOG_TOKEN( level, fmt, ... )                                      \
+  do                                                                          \
+  {                                                                           \
+    static const char etx_log_fmt_[]                                          \
+                  __attribute__((section(".etx_log_fmt"), used)) = fmt;       \
+    _Static_assert( ETX_LOG_NARGS(__VA_ARGS__) <= ETX_LOG_TOKEN_MAX_ARGS,     \
+                    "Too many log arguments" );                               \
+    etx_log_token( (level), (uint32_t)etx_log_fmt_,                           \
+                   ETX_LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__ );               \
+  }while(0)
+
+#if ( ETX_LOG_TOKENISED )
+#define ETX_LOG_PRINT( level, fmt, ... )  ETX_LOG_TOKEN( level, fmt, ##__VA_ARGS__ )
+#else
+#define ETX_LOG_PRINT( level, fmt, ... )  printf( fmt, ##__VA_ARGS__ )
+#endif
+
+#if ( ETX_LOG_LEVEL >= ETX_LOG_LEVEL_ERROR )
+#define ETX_LOG_ERR( fmt, ... ) ETX_LOG_PRINT( ETX_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__ )
+#else
+#define ETX_LOG_ERR( fmt, ... ) do{}while(0)
+#endif
+
+#if ( ETX_LOG_LEVEL >= ETX_LOG_LEVEL_WARN )
+#define ETX_LOG_WRN( fmt, ... ) ETX_LOG_PRINT( ETX_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__ )
+#else
+#define ETX_LOG_WRN( fmt, ... ) do{}while(0)
+#endif
+
+#if ( ETX_LOG_LEVEL >= ETX_LOG_LEVEL_INFO )
+#define ETX_LOG_INF( fmt, ... ) ETX_LOG_PRINT( ETX_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__ )
+#else
+#define ETX_LOG_INF( fmt, ... ) do{}while(0)
+#endif
+
+#if ( ETX_LOG_LEVEL >= ETX_LOG_LEVEL_DEBUG )
+#define ETX_LOG_DBG( fmt, ... ) ETX_LOG_PRINT( ETX_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__ )
+#else
+#define ETX_LOG_DBG( fmt, ... ) do{}while(0)
+#endif
+
+void     etx_log_init( void );
+void     etx_log_deinit( void );
+bool     etx_log_putc( uint8_t ch );
+bool     etx_log_write( const uint8_t *buf, uint32_t len );
+void     etx_log_token( uint8_t level, uint32_t id, uint32_t nargs, ... );
+void     etx_log_flush( void );
+uint32_t etx_log_get_dropped( void );
+#endif /* INC_ETX_LOG_H_ */
@@ -15,20 +15,53 @@
 #define ETX_OTA_EOF  0xBB    // End of Frame
 #define ETX_OTA_ACK  0x00    // ACK
 #define ETX_OTA_NACK 0x01    // NACK
+#define ETX_OTA_ALREADY 0x02 // Image is already present in a slot (no download)
 
 #define ETX_APP_FLASH_ADDR        0x08040000   //Application's Flash Address
 #define ETX_APP_SLOT0_FLASH_ADDR  0x080C0000   //App slot 0 address
 #define ETX_APP_SLOT1_FLASH_ADDR  0x08140000   //App slot 1 address
+#define ETX_BL_FLASH_ADDR         0x08000000   //Bootloader's Flash Address
 #define ETX_CONFIG_FLASH_ADDR     0x08020000   //Configuration's address
 
 #define ETX_NO_OF_SLOTS           2            //Number of slots
+#define ETX_NO_OF_SECTORS         12           //Number of flash sectors
+#define ETX_CONFIG_SECTOR_SIZE   (128 * 1024)  //Config's flash sector size (sector 4)
 #define ETX_SLOT_MAX_SIZE        (512 * 1024)  //Each slot size (512KB)
+#define ETX_APP_SECTOR_SIZE      (256 * 1024)  //App's flash sector size (256KB)
+#define ETX_BL_MAX_SIZE          (64 * 1024)   //Bootloader size (sector 0 and 1)
+
+#define ETX_DIGEST_SIZE           ( 32 )                  //SHA-256 digest size
+#define ETX_APP_DESC_MAGIC        ( 0x44585445 )          //"ETXD"
+#define ETX_FW_VERSION( major, minor, patch ) \
+          ( ( (major) << 16 ) | ( (minor) << 8 ) | (patch) )
 
 #define ETX_OTA_DATA_MAX_SIZE ( 1024 )  //Maximum data Size
 #define ETX_OTA_DATA_OVERHEAD (    9 )  //data overhead
 #define ETX_OTA_PACKET_MAX_SIZE ( ETX_OTA_DATA_MAX_SIZE + ETX_OTA_DATA_OVERHEAD )
 
+/*
+ * Hardware flow control on the OTA UART (USART2). RTS - PD4, CTS - PD3.
+ * Set it to 1 (or build with -DETX_OTA_FLOW_CTRL=1) only if both the lines
+ * are wired to the host. The USART drops RTS by itself when a byte is not
+ * read yet. RTS is also held high while the bootloader processes a frame
+ * (flash erase/program), so the host can't overrun us. CTS is pulled down,
+ * so an open CTS line never blocks us.
+ */
+#ifndef ETX_OTA_FLOW_CTRL
+#define ETX_OTA_FLOW_CTRL         ( 0 )
+#endif
+#define ETX_OTA_RTS_PORT          GPIOD
+#define ETX_OTA_RTS_PIN           GPIO_PIN_4
+#define ETX_OTA_CTS_PORT          GPIOD
+#define ETX_OTA_CTS_PIN           GPIO_PIN_3
+
 #define ETX_SD_CARD_FW_PATH "ETX_FW/app.bin"    //Firmware name present in SD card
+#define ETX_SD_CHUNK_SIZE   ( 32 * 1024 )       //SD read size (multiple of the sector and cluster sizes)
+#define ETX_SD_CLMT_SIZE    ( 64 )              //Cluster link map size (DWORDs). Up to 31 fragments.
+#define ETX_SD_CARD_MANIFEST_PATH "ETX_FW/manifest.txt"   //Image list in SD card (see ETX_SD_IMAGE_)
+#define ETX_SD_PATH_MAX_LEN ( 64 )              //Max length of an image path in the manifest
+#define ETX_SD_LINE_MAX_LEN ( 192 )             //Max length of a manifest line
+#define ETX_SD_STORE_INDEX_PATH "ETX_FW/store/index.txt"  //Image store's index (same format as the manifest)
 
 /*
  * Reboot reason
@@ -37,6 +70,31 @@
 #define ETX_NORMAL_BOOT           ( 0xBEEFFEED )      //Normal Boot
 #define ETX_OTA_REQUEST           ( 0xDEADBEEF )      //OTA request by application
 #define ETX_LOAD_PREV_APP         ( 0xFACEFADE )      //App requests to load the previous version
+#define ETX_LOAD_STORE_APP( ver ) ( 0x5E000000 | ( (ver) & 0x00FFFFFF ) ) //App requests a version from the SD image store
+#define ETX_LOAD_STORE_APP_MASK   ( 0xFF000000 )
+
+/*
+ * Trial boot. A new firmware runs in the trial state until the application
+ * confirms it. The bootloader arms the watchdog for every trial boot and
+ * reverts to the previous firmware if it is not confirmed within
+ * ETX_TRIAL_MAX_ATTEMPTS boots.
+ */
+#define ETX_SLOT_TRIAL            ( 0x7E57B007 )      //Firmware is not confirmed yet
+#define ETX_TRIAL_MAX_ATTEMPTS    ( 3 )               //Boot attempts before revert
+#define ETX_TRIAL_WDG_TIMEOUT     ( 8000 )            //Watchdog timeout in trial boot (ms)
+#define ETX_LSI_FREQ              ( 32000 )           //LSI frequency (Hz)
+
+/*
+ * Bootloader update. The new bootloader is staged in a slot and verified.
+ * Then it is copied over the bootloader's flash in the next boot by a
+ * routine that runs from the RAM. BOOT_ADD0 points to the ROM bootloader
+ * while the copy runs. So, if the power fails in the middle of the copy,
+ * the device boots the ROM bootloader and must be reflashed manually
+ * through it (UART/USB DFU). The marker is cleared by the new bootloader.
+ */
+#define ETX_BL_UPDATE_PENDING     ( 0xB007C0DE )      //New bootloader is staged in a slot
+#define ETX_BL_COPY_RETRIES       ( 3 )               //Erase/program attempts before giving up
+#define ETX_RAM_SIZE              ( 512 * 1024 )      //RAM size (to check the stack pointer)
 
 /*
  * Exception codes
@@ -56,6 +114,7 @@ typedef enum
   ETX_SD_EX_NO_SD    = 1,    // No SD card Found
   ETX_SD_EX_FU_ERR   = 2,    // Failure during Firmware update
   ETX_SD_EX_ERR      = 3,    // Other Failure
+  ETX_SD_EX_NO_UPDATE = 4,   // Images in the SD card are already installed
 }ETX_SD_EX_;
 
 /*
@@ -79,6 +138,7 @@ typedef enum
   ETX_OTA_PACKET_TYPE_DATA      = 1,    // Data
   ETX_OTA_PACKET_TYPE_HEADER    = 2,    // Header
   ETX_OTA_PACKET_TYPE_RESPONSE  = 3,    // Response
+  ETX_OTA_PACKET_TYPE_INFO      = 4,    // Device info (response to GET_INFO)
 }ETX_OTA_PACKET_TYPE_;
 
 /*
@@ -89,8 +149,56 @@ typedef enum
   ETX_OTA_CMD_START = 0,    // OTA Start command
   ETX_OTA_CMD_END   = 1,    // OTA End command
   ETX_OTA_CMD_ABORT = 2,    // OTA Abort command
+  ETX_OTA_CMD_GET_INFO = 3, // Device info/capability query
+  ETX_OTA_CMD_READ_BACK = 4,// Read back the flash (ETX_OTA_READ_CMD_)
 }ETX_OTA_CMD_;
 
+/*
+ * Device info record version. Increment it when the ETX_OTA_INFO_ changes.
+ * New fields must be added only at the end.
+ */
+#define ETX_OTA_INFO_VERSION        ( 2 )
+
+/*
+ * Features supported by the bootloader (ETX_OTA_INFO_.features)
+ */
+#define ETX_OTA_FEATURE_STREAM      ( 1u << 0 )   // Frames can be sent without inter-byte gaps
+#define ETX_OTA_FEATURE_SKIP_SAME   ( 1u << 1 )   // Skips the download if the image is present
+#define ETX_OTA_FEATURE_ROLLBACK    ( 1u << 2 )   // Supports the rollback to previous app
+#define ETX_OTA_FEATURE_TRIAL_BOOT  ( 1u << 3 )   // Trial boot with the watchdog
+#define ETX_OTA_FEATURE_READ_BACK   ( 1u << 4 )   // Supports the read back command
+#define ETX_OTA_FEATURE_BL_UPDATE   ( 1u << 5 )   // Supports the bootloader update
+#define ETX_OTA_FEATURE_WEAR        ( 1u << 6 )   // Reports the flash erase counters
+#define ETX_OTA_FEATURE_FLOW_CTRL   ( 1u << 7 )   // RTS/CTS flow control on the OTA UART
+
+/*
+ * Read back regions
+ */
+typedef enum
+{
+  ETX_OTA_REGION_SLOT0  = 0,    // Slot 0
+  ETX_OTA_REGION_SLOT1  = 1,    // Slot 1
+  ETX_OTA_REGION_APP    = 2,    // Application's flash
+}ETX_OTA_REGION_;
+
+/*
+ * Read back modes
+ */
+typedef enum
+{
+  ETX_OTA_READ_MODE_DATA  = 0,  // Send the data (one data packet per block)
+  ETX_OTA_READ_MODE_CRC   = 1,  // Send only the CRC of each block (verify only)
+}ETX_OTA_READ_MODE_;
+
+/*
+ * Image type (meta_info.image_type)
+ */
+typedef enum
+{
+  ETX_OTA_IMAGE_APP         = 0,    // Application
+  ETX_OTA_IMAGE_BOOTLOADER  = 1,    // Bootloader
+}ETX_OTA_IMAGE_;
+
 /*
  * Slot table
  */
@@ -101,20 +209,51 @@ typedef struct
     uint8_t  should_we_run_this_fw;   //Do we have to run this slot's firmware?
     uint32_t fw_size;                 //Slot's firmware/application size
     uint32_t fw_crc;                  //Slot's firmware/application CRC
-    uint32_t reserved1;
-    uint32_t reserved2;
-    uint32_t reserved3;
+    uint32_t trial_state;             //ETX_SLOT_TRIAL if the firmware is not confirmed yet
+    uint32_t boot_attempts;           //Number of boots in the trial state
+    uint32_t fw_version;              //Slot's firmware version (ETX_FW_VERSION)
+    uint32_t build_id;                //Slot's firmware build ID (build timestamp)
+    uint8_t  digest[ETX_DIGEST_SIZE]; //Slot's firmware SHA-256
 }__attribute__((packed)) ETX_SLOT_;
 
+/*
+ * Bootloader update marker
+ */
+typedef struct
+{
+    uint32_t state;                   //ETX_BL_UPDATE_PENDING if a new bootloader is staged
+    uint32_t slot_num;                //Slot that has the new bootloader
+    uint32_t size;                    //New bootloader's size
+    uint32_t crc;                     //New bootloader's CRC
+    uint32_t boot_addr;               //BOOT_ADD0 option byte to restore after the copy
+}__attribute__((packed)) ETX_BL_UPDATE_;
+
 /*
  * General configuration
  */
 typedef struct
 {
-    uint32_t  reboot_cause;
-    ETX_SLOT_ slot_table[ETX_NO_OF_SLOTS];
+    uint32_t       reboot_cause;
+    ETX_SLOT_      slot_table[ETX_NO_OF_SLOTS];
+    ETX_BL_UPDATE_ bl_update;
+    uint32_t       erase_count[ETX_NO_OF_SECTORS];  //Number of erases of each flash sector
 }__attribute__((packed)) ETX_GNRL_CFG_;
 
+/*
+ * Configuration record. The config sector is used as a log. Every config
+ * write appends a new record and the sector is erased only when it is full.
+ * The last record that has the magic is the current configuration. The magic
+ * is written after the configuration, so a half written record is skipped.
+ */
+#define ETX_CFG_RECORD_MAGIC      ( 0xC0F1C0DE )
+#define ETX_CFG_RECORD_SIZE       ( ( sizeof(ETX_CFG_RECORD_) + 3u ) & ~3u )
+
+typedef struct
+{
+    uint32_t       magic;             //ETX_CFG_RECORD_MAGIC
+    ETX_GNRL_CFG_  cfg;
+}__attribute__((packed)) ETX_CFG_RECORD_;
+
 /*
  * OTA meta info
  */
@@ -122,10 +261,39 @@ typedef struct
 {
   uint32_t package_size;
   uint32_t package_crc;
-  uint32_t reserved1;
-  uint32_t reserved2;
+  uint32_t fw_version;                // Firmware version (ETX_FW_VERSION)
+  uint32_t build_id;                  // Build ID (build timestamp)
+  uint8_t  digest[ETX_DIGEST_SIZE];   // SHA-256 of the image (all 0 - unknown)
+  uint32_t image_type;                // ETX_OTA_IMAGE_
 }__attribute__((packed)) meta_info;
 
+/*
+ * Application image descriptor. The application embeds this in its image, so
+ * the host tool can find the version and the build time of the image.
+ */
+typedef struct
+{
+  uint32_t magic;                     // ETX_APP_DESC_MAGIC
+  uint32_t fw_version;                // Firmware version (ETX_FW_VERSION)
+  char     build_time[24];            // __DATE__ " " __TIME__
+}__attribute__((packed)) ETX_APP_DESC_;
+
+/*
+ * SD card manifest entry. The manifest has one line per image:
+ *
+ *   <app|bootloader> <file> <major.minor.patch> <sha256> [crc32]
+ *
+ * Lines starting with '#' are comments. The file path is relative to the
+ * card's root. The digest is checked while the image is flashed. Images
+ * that are already installed are skipped, so the card can stay in.
+ */
+typedef struct
+{
+  uint32_t  image_type;                       // ETX_OTA_IMAGE_xxx
+  char      path[ETX_SD_PATH_MAX_LEN];        // Image file in the SD card
+  meta_info meta;                             // version, digest and CRC (0 if not given)
+}ETX_SD_IMAGE_;
+
 /*
  * OTA Command format
  *
@@ -145,6 +313,33 @@ typedef struct
   uint8_t   eof;
 }__attribute__((packed)) ETX_OTA_COMMAND_;
 
+/*
+ * OTA Read back command format
+ *
+ * __________________________________________________________________________________
+ * |     | Packet |     |     |        |        |        | Block |      |     |     |
+ * | SOF | Type   | Len | CMD | Region | Offset | Length | Size  | Mode | CRC | EOF |
+ * |_____|________|_____|_____|________|________|________|_______|______|_____|_____|
+ *   1B      1B     2B    1B      1B       4B       4B      2B      1B    4B    1B
+ *
+ * Length 0 reads the whole image of the region. The device replies with the
+ * data packets (data or the block CRCs) followed by ACK (or NACK on error).
+ */
+typedef struct
+{
+  uint8_t   sof;
+  uint8_t   packet_type;
+  uint16_t  data_len;
+  uint8_t   cmd;
+  uint8_t   region;
+  uint32_t  offset;
+  uint32_t  length;
+  uint16_t  block_size;
+  uint8_t   mode;
+  uint32_t  crc;
+  uint8_t   eof;
+}__attribute__((packed)) ETX_OTA_READ_CMD_;
+
 /*
  * OTA Header format
  *
@@ -152,7 +347,7 @@ typedef struct
  * |     | Packet |     | Header |     |     |
  * | SOF | Type   | Len |  Data  | CRC | EOF |
  * |_____|________|_____|________|_____|_____|
- *   1B      1B     2B     16B     4B    1B
+ *   1B      1B     2B     52B     4B    1B
  */
 typedef struct
 {
@@ -181,6 +376,63 @@ typedef struct
   uint8_t     *data;
 }__attribute__((packed)) ETX_OTA_DATA_;
 
+/*
+ * Slot status in the device info
+ */
+typedef struct
+{
+  uint8_t   is_valid;
+  uint8_t   is_active;
+  uint8_t   is_trial;                 // Firmware is not confirmed yet
+  uint8_t   reserved;
+  uint32_t  fw_size;
+  uint32_t  fw_crc;
+  uint32_t  fw_version;
+  uint32_t  build_id;
+}__attribute__((packed)) ETX_OTA_SLOT_INFO_;
+
+/*
+ * Device info
+ */
+typedef struct
+{
+  uint8_t             info_version;       // ETX_OTA_INFO_VERSION
+  uint8_t             bl_version[2];      // Bootloader version (major, minor)
+  uint8_t             no_of_slots;        // Number of slots
+  uint32_t            features;           // ETX_OTA_FEATURE_xxx
+  uint32_t            max_data_size;      // Maximum data size in one data packet
+  uint32_t            baudrate;           // OTA UART baudrate
+  uint32_t            flash_size;         // Total flash size in bytes
+  uint32_t            app_flash_addr;     // Application's flash address
+  uint32_t            slot_max_size;      // Each slot's size
+  uint32_t            reboot_cause;       // Reboot reason from the config
+  ETX_OTA_SLOT_INFO_  slots[ETX_NO_OF_SLOTS];
+  /* Info version 2 */
+  uint8_t             no_of_sectors;      // Number of flash sectors
+  uint8_t             reserved[3];
+  uint32_t            cfg_free_records;   // Config writes left before the config sector is erased
+  uint32_t            erase_count[ETX_NO_OF_SECTORS]; // Number of erases of each sector
+}__attribute__((packed)) ETX_OTA_INFO_;
+
+/*
+ * OTA Info format
+ *
+ * __________________________________________
+ * |     | Packet |     |  Info  |     |     |
+ * | SOF | Type   | Len |  Data  | CRC | EOF |
+ * |_____|________|_____|________|_____|_____|
+ *   1B      1B     2B    nBytes   4B    1B
+ */
+typedef struct
+{
+  uint8_t        sof;
+  uint8_t        packet_type;
+  uint16_t       data_len;
+  ETX_OTA_INFO_  info;
+  uint32_t       crc;
+  uint8_t        eof;
+}__attribute__((packed)) ETX_OTA_INFO_PACKET_;
+
 /*
  * OTA Response format
  *
@@ -200,7 +452,14 @@ typedef struct
   uint8_t   eof;
 }__attribute__((packed)) ETX_OTA_RESP_;
 
+/* Latest configuration in the flash (see load_config()) */
+extern ETX_GNRL_CFG_ *cfg_flash;
+
 ETX_OTA_EX_ etx_ota_download_and_flash( void );
-void load_new_app( void );
+ETX_OTA_EX_ load_new_app( void );
+ETX_OTA_EX_ load_prev_app( void );
+ETX_OTA_EX_ update_bootloader( void );
+void load_config( void );
 ETX_SD_EX_ check_update_frimware_SD_card( void );
+ETX_SD_EX_ load_store_app( uint32_t fw_version );
 #endif /* INC_ETX_OTA_UPDATE_H_ */
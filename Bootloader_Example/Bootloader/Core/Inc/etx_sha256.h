@@ -0,0 +1,33 @@
+/*
+ * etx_sha256.h
+ *
+ *  Created on: 18-Oct-2026
+ *      Author: EmbeTronicX
+ */
+
+#ifndef INC_ETX_SHA256_H_
+#define INC_ETX_SHA256_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ETX_SHA256_DIGEST_SIZE  ( 32 )    //SHA-256 digest size in bytes
+#define ETX_SHA256_BLOCK_SIZE   ( 64 )    //SHA-256 block size in bytes
+
+/*
+ * SHA-256 context
+ */
+typedef struct
+{
+  uint32_t state[8];
+  uint64_t total_len;                         //Total bytes processed
+  uint8_t  block[ETX_SHA256_BLOCK_SIZE];      //Partial block
+  uint32_t block_len;                         //Bytes in the partial block
+}ETX_SHA256_CTX_;
+
+void etx_sha256_init( ETX_SHA256_CTX_ *ctx );
+void etx_sha256_update( ETX_SHA256_CTX_ *ctx, const uint8_t *data, uint32_t len );
+void etx_sha256_final( ETX_SHA256_CTX_ *ctx, uint8_t *digest );
+void etx_sha256( const uint8_t *data, uint32_t len, uint8_t *digest );
+bool etx_sha256_is_empty( const uint8_t *digest );
+#endif /* INC_ETX_SHA256_H_ */
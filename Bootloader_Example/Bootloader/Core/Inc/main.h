@@ -48,6 +48,7 @@ extern "C" {
 /* Exported macro ------------------------------------------------------------*/
 /* USER CODE BEGIN EM */
 #define SD_SPI_HANDLE hspi1
+//#define SD_USE_SDMMC          //Use the SDMMC1 4-bit bus (PC8..PC12, PD2) instead of SPI1 for the SD card
 /* USER CODE END EM */
 
 /* Exported functions prototypes ---------------------------------------------*/
@@ -61,6 +62,9 @@ void Error_Handler(void);
 #define SD_CS_Pin GPIO_PIN_14
 #define SD_CS_GPIO_Port GPIOD
 /* USER CODE BEGIN Private defines */
+//Optional SD card detect switch. Without it, the SD drivers probe the card with a short timeout.
+//#define SD_CD_Pin GPIO_PIN_x
+//#define SD_CD_GPIO_Port GPIOx
 extern UART_HandleTypeDef huart2;
 extern UART_HandleTypeDef huart3;
 /* USER CODE END Private defines */
@@ -57,6 +57,10 @@ void DebugMon_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
 /* USER CODE BEGIN EFP */
+void DMA1_Stream3_IRQHandler(void);
+void USART3_IRQHandler(void);
+void DMA2_Stream2_IRQHandler(void);
+void DMA2_Stream5_IRQHandler(void);
 
 /* USER CODE END EFP */
 
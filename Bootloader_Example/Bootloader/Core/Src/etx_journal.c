@@ -0,0 +1,240 @@
+/*
+ * etx_journal.c
+ *
+ *  Created on: 18-Oct-2026
+ *      Author: EmbeTronicX
+ */
+
+#include "etx_journal.h"
+#include <string.h>
+#include "fatfs.h"
+#include "diskio.h"
+#include "etx_log.h"
+
+#define ETX_JOURNAL_BUF_SIZE  ( ETX_JOURNAL_MAX_SECTORS * ETX_JOURNAL_SECTOR_SIZE )
+#define ETX_JOURNAL_REC_ROOM  ( ETX_JOURNAL_BUF_SIZE - sizeof(ETX_JOURNAL_HDR_) - \
+                                ( 2u + ( ETX_JOURNAL_CNT_MAX * sizeof(uint16_t) ) ) )
+
+/* Batch in progress. Header first, then the records. */
+static uint8_t  jrnl_buf[ ETX_JOURNAL_BUF_SIZE ] __attribute__((aligned(32)));
+/* Length of the records in the batch */
+static uint32_t jrnl_len;
+/* Records that didn't fit in the batch */
+static uint8_t  jrnl_dropped;
+/* Reboot cause at the start of the boot */
+static uint32_t jrnl_reboot_cause;
+/* Error counters. Written as one record with the batch. */
+static uint16_t jrnl_counters[ ETX_JOURNAL_CNT_MAX ];
+
+/* Hardware CRC handle */
+extern CRC_HandleTypeDef hcrc;
+/* Bootloader version */
+extern const uint8_t BL_Version[2];
+
+static void etx_journal_add( uint8_t type, const void *data, uint8_t len );
+
+/**
+  * @brief Start a new batch.
+  * @param reboot_cause reboot cause at the start of the boot
+  * @retval None
+  */
+void etx_journal_init( uint32_t reboot_cause )
+{
+  jrnl_len          = 0u;
+  jrnl_dropped      = 0u;
+  jrnl_reboot_cause = reboot_cause;
+  memset( jrnl_counters, 0, sizeof(jrnl_counters) );
+}
+
+/**
+  * @brief Record the time taken by a boot stage.
+  * @param stage ETX_JOURNAL_STAGE_
+  * @param start_tick HAL_GetTick() at the start of the stage
+  * @param result stage's return code
+  * @retval None
+  */
+void etx_journal_stage( uint8_t stage, uint32_t start_tick, uint8_t result )
+{
+  ETX_JOURNAL_STAGE_REC_ rec;
+
+  rec.stage    = stage;
+  rec.result   = result;
+  rec.start    = start_tick;
+  rec.duration = HAL_GetTick() - start_tick;
+
+  etx_journal_add( ETX_JOURNAL_REC_STAGE, &rec, sizeof(rec) );
+}
+
+/**
+  * @brief Record an update and its throughput.
+  * @param source ETX_JOURNAL_SRC_
+  * @param image_type ETX_OTA_IMAGE_
+  * @param size image size
+  * @param start_tick HAL_GetTick() at the start of the update
+  * @param result 0 - OK
+  * @retval None
+  */
+void etx_journal_update( uint8_t source, uint8_t image_type, uint32_t size,
+                         uint32_t start_tick, uint8_t result )
+{
+  ETX_JOURNAL_UPDATE_REC_ rec;
+
+  rec.source     = source;
+  rec.image_type = image_type;
+  rec.result     = result;
+  rec.size       = size;
+  rec.duration   = HAL_GetTick() - start_tick;
+  rec.throughput = ( rec.duration != 0u ) ? (uint32_t)( ( (uint64_t)size * 1000u ) / rec.duration )
+                                          : 0u;
+
+  etx_journal_add( ETX_JOURNAL_REC_UPDATE, &rec, sizeof(rec) );
+}
+
+/**
+  * @brief Count an error.
+  * @param counter ETX_JOURNAL_CNT_
+  * @retval None
+  */
+void etx_journal_count( uint8_t counter )
+{
+  if( ( counter < ETX_JOURNAL_CNT_MAX ) && ( jrnl_counters[counter] != UINT16_MAX ) )
+  {
+    jrnl_counters[counter]++;
+  }
+}
+
+/**
+  * @brief Append the batch to the journal file in the SD card. Nothing is
+  *        written if the SD card was not found in this boot. A new batch is
+  *        started after this.
+  * @param None
+  * @retval None
+  */
+void etx_journal_flush( void )
+{
+  ETX_JOURNAL_HDR_ *hdr = (ETX_JOURNAL_HDR_ *)jrnl_buf;
+  FATFS             fs;
+  FIL               fil;
+  FRESULT           fres;
+  UINT              bw;
+  uint32_t          size;
+  uint8_t           cnt_len = (uint8_t)sizeof(jrnl_counters);
+
+  do
+  {
+    if( ( jrnl_len == 0u ) && ( jrnl_dropped == 0u ) )
+    {
+      //Nothing happened since the last batch
+      break;
+    }
+
+    //Don't wait for the card again if it was not there
+    if( ( disk_status( 0 ) & STA_NOINIT ) != 0u )
+    {
+      break;
+    }
+
+    //Counters go last. There is always room for them.
+    jrnl_buf[ sizeof(ETX_JOURNAL_HDR_) + jrnl_len++ ] = ETX_JOURNAL_REC_COUNTERS;
+    jrnl_buf[ sizeof(ETX_JOURNAL_HDR_) + jrnl_len++ ] = cnt_len;
+    memcpy( &jrnl_buf[ sizeof(ETX_JOURNAL_HDR_) + jrnl_len ], jrnl_counters, cnt_len );
+    jrnl_len += cnt_len;
+
+    size = sizeof(ETX_JOURNAL_HDR_) + jrnl_len;
+    size = ( size + ETX_JOURNAL_SECTOR_SIZE - 1u ) & ~( ETX_JOURNAL_SECTOR_SIZE - 1u );
+    memset( &jrnl_buf[ sizeof(ETX_JOURNAL_HDR_) + jrnl_len ], 0xFF,
+            size - ( sizeof(ETX_JOURNAL_HDR_) + jrnl_len ) );
+
+    hdr->magic         = ETX_JOURNAL_MAGIC;
+    hdr->sectors       = (uint16_t)( size / ETX_JOURNAL_SECTOR_SIZE );
+    hdr->rec_len       = (uint16_t)jrnl_len;
+    hdr->bl_version[0] = BL_Version[0];
+    hdr->bl_version[1] = BL_Version[1];
+    hdr->dropped       = jrnl_dropped;
+    hdr->reserved      = 0u;
+    hdr->reboot_cause  = jrnl_reboot_cause;
+    hdr->tick          = HAL_GetTick();
+    hdr->crc           = HAL_CRC_Calculate( &hcrc, (uint32_t *)&jrnl_buf[ sizeof(ETX_JOURNAL_HDR_) ],
+                                            jrnl_len );
+
+    fres = f_mount( &fs, "", 1 );
+    if( fres != FR_OK )
+    {
+      break;
+    }
+
+    fres = f_mkdir( ETX_JOURNAL_DIR );
+    if( ( fres == FR_OK ) || ( fres == FR_EXIST ) )
+    {
+      fres = f_open( &fil, ETX_JOURNAL_PATH, FA_WRITE | FA_OPEN_APPEND );
+    }
+
+    if( ( fres == FR_OK ) && ( f_size( &fil ) >= ETX_JOURNAL_MAX_SIZE ) )
+    {
+      //Keep one old journal. Start a new one.
+      f_close( &fil );
+      f_unlink( ETX_JOURNAL_OLD_PATH );
+      fres = f_rename( ETX_JOURNAL_PATH, ETX_JOURNAL_OLD_PATH );
+      if( fres == FR_OK )
+      {
+        fres = f_open( &fil, ETX_JOURNAL_PATH, FA_WRITE | FA_OPEN_APPEND );
+      }
+    }
+
+    if( fres == FR_OK )
+    {
+      //Start the batch at a sector boundary, if someone else wrote to the file
+      if( ( f_size( &fil ) % ETX_JOURNAL_SECTOR_SIZE ) != 0u )
+      {
+        fres = f_lseek( &fil, ( f_size( &fil ) + ETX_JOURNAL_SECTOR_SIZE - 1u ) &
+                              ~( ETX_JOURNAL_SECTOR_SIZE - 1u ) );
+      }
+
+      if( fres == FR_OK )
+      {
+        fres = f_write( &fil, jrnl_buf, size, &bw );
+        if( ( fres == FR_OK ) && ( bw != size ) )
+        {
+          fres = FR_DENIED;                           //Card is full
+        }
+      }
+      f_close( &fil );
+    }
+
+    f_mount( NULL, "", 0 );
+
+    if( fres != FR_OK )
+    {
+      ETX_LOG_WRN("Journal write error : (%i)\r\n", fres);
+    }
+  }while( false );
+
+  //Start a new batch
+  jrnl_len     = 0u;
+  jrnl_dropped = 0u;
+  memset( jrnl_counters, 0, sizeof(jrnl_counters) );
+}
+
+/**
+  * @brief Add a record to the batch.
+  * @param type ETX_JOURNAL_REC_
+  * @param data record data
+  * @param len record data length
+  * @retval None
+  */
+static void etx_journal_add( uint8_t type, const void *data, uint8_t len )
+{
+  if( ( jrnl_len + 2u + len ) > ETX_JOURNAL_REC_ROOM )
+  {
+    if( jrnl_dropped != UINT8_MAX )
+    {
+      jrnl_dropped++;
+    }
+    return;
+  }
+
+  jrnl_buf[ sizeof(ETX_JOURNAL_HDR_) + jrnl_len++ ] = type;
+  jrnl_buf[ sizeof(ETX_JOURNAL_HDR_) + jrnl_len++ ] = len;
+  memcpy( &jrnl_buf[ sizeof(ETX_JOURNAL_HDR_) + jrnl_len ], data, len );
+  jrnl_len += len;
+}
@@ -0,0 +1,350 @@
+/*
+ * etx_log.c
+ *
+ *  Created on: 18-Oct-2026
+ *      Author: EmbeTronicX
+ */
+
+#include "etx_log.h"
+#include <stdarg.h>
+
+#if ( ETX_LOG_RING_SIZE & ( ETX_LOG_RING_SIZE - 1 ) )
+#error "ETX_LOG_RING_SIZE must be a power of 2"
+#endif
+
+#define ETX_LOG_RING_MASK ( ETX_LOG_RING_SIZE - 1u )
+
+/* Ring buffer that holds the pending log bytes */
+static uint8_t log_ring[ ETX_LOG_RING_SIZE ];
+
+/* Write index. Updated only by the producer (thread mode). */
+static volatile uint32_t log_head;
+/* Read index. Updated only by the DMA completion callback. */
+static volatile uint32_t log_tail;
+/* Number of bytes handed over to the DMA in the current transfer */
+static volatile uint16_t log_dma_len;
+/* Is the DMA transfer ongoing? */
+static volatile bool     log_dma_busy;
+/* Is the logger initialized? */
+static bool              log_ready;
+/* Number of bytes dropped because the ring buffer was full */
+static volatile uint32_t log_dropped;
+
+#if ( ETX_LOG_TOKENISED )
+/* Keep the section even if there is no log call in the build */
+static const char etx_log_fmt_base[] __attribute__((section(".etx_log_fmt"), used)) = "";
+#endif
+
+/* USART3 TX DMA handle */
+DMA_HandleTypeDef hdma_usart3_tx;
+
+static void etx_log_kick( void );
+static uint32_t etx_log_varint( uint8_t *buf, uint32_t value );
+
+/**
+  * @brief Initialize the logger (USART3 TX DMA).
+  *        USART3 must be initialized before calling this.
+  * @param None
+  * @retval None
+  */
+void etx_log_init( void )
+{
+  log_head     = 0u;
+  log_tail     = 0u;
+  log_dma_len  = 0u;
+  log_dma_busy = false;
+  log_dropped  = 0u;
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* USART3_TX : DMA1 Stream 3, Channel 4 */
+  hdma_usart3_tx.Instance                 = DMA1_Stream3;
+  hdma_usart3_tx.Init.Channel             = DMA_CHANNEL_4;
+  hdma_usart3_tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+  hdma_usart3_tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+  hdma_usart3_tx.Init.MemInc              = DMA_MINC_ENABLE;
+  hdma_usart3_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma_usart3_tx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+  hdma_usart3_tx.Init.Mode                = DMA_NORMAL;
+  hdma_usart3_tx.Init.Priority            = DMA_PRIORITY_LOW;
+  hdma_usart3_tx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+  if( HAL_DMA_Init( &hdma_usart3_tx ) != HAL_OK )
+  {
+    /* Stay with the blocking prints */
+    return;
+  }
+
+  __HAL_LINKDMA( &huart3, hdmatx, hdma_usart3_tx );
+
+  HAL_NVIC_SetPriority( DMA1_Stream3_IRQn, 15, 0 );
+  HAL_NVIC_EnableIRQ( DMA1_Stream3_IRQn );
+  HAL_NVIC_SetPriority( USART3_IRQn, 15, 0 );
+  HAL_NVIC_EnableIRQ( USART3_IRQn );
+
+  log_ready = true;
+}
+
+/**
+  * @brief Flush the pending logs and release the DMA. This has to be called
+  *        before jumping to the application or resetting the controller.
+  * @param None
+  * @retval None
+  */
+void etx_log_deinit( void )
+{
+  if( !log_ready )
+  {
+    return;
+  }
+
+  if( log_dropped != 0u )
+  {
+    ETX_LOG_WRN("LOG: %lu bytes dropped\r\n", log_dropped);
+  }
+
+  etx_log_flush();
+
+  HAL_NVIC_DisableIRQ( DMA1_Stream3_IRQn );
+  HAL_NVIC_DisableIRQ( USART3_IRQn );
+  HAL_UART_AbortTransmit( &huart3 );
+  HAL_DMA_DeInit( &hdma_usart3_tx );
+
+  log_ready = false;
+}
+
+/**
+  * @brief Put one byte into the log ring buffer. Never blocks.
+  * @param ch byte to be logged
+  * @retval true - queued, false - dropped
+  */
+bool etx_log_putc( uint8_t ch )
+{
+  uint32_t head = log_head;
+
+  if( !log_ready )
+  {
+    /* Logger is not running yet. Fall back to the blocking transmit. */
+    HAL_UART_Transmit( &huart3, &ch, 1, HAL_MAX_DELAY );
+    return true;
+  }
+
+  if( ( head - log_tail ) >= ETX_LOG_RING_SIZE )
+  {
+    //Ring buffer is full. Drop it.
+    log_dropped++;
+    return false;
+  }
+
+  log_ring[ head & ETX_LOG_RING_MASK ] = ch;
+  log_head = head + 1u;
+
+  /* Start the DMA once we have a complete line or the buffer is half full */
+  if( ( ch == '\n' ) || ( ( log_head - log_tail ) >= ( ETX_LOG_RING_SIZE / 2u ) ) )
+  {
+    etx_log_kick();
+  }
+
+  return true;
+}
+
+/**
+  * @brief Put a complete block into the log ring buffer. Never blocks.
+  *        Either the whole block is queued or the whole block is dropped,
+  *        so the binary records never get cut in the middle.
+  * @param buf data to be logged
+  * @param len data length
+  * @retval true - queued, false - dropped
+  */
+bool etx_log_write( const uint8_t *buf, uint32_t len )
+{
+  uint32_t head = log_head;
+
+  if( !log_ready )
+  {
+    HAL_UART_Transmit( &huart3, (uint8_t *)buf, len, HAL_MAX_DELAY );
+    return true;
+  }
+
+  if( ( ETX_LOG_RING_SIZE - ( head - log_tail ) ) < len )
+  {
+    //Not enough space. Drop it.
+    log_dropped += len;
+    return false;
+  }
+
+  for( uint32_t i = 0u; i < len; i++ )
+  {
+    log_ring[ ( head + i ) & ETX_LOG_RING_MASK ] = buf[i];
+  }
+  log_head = head + len;
+
+  etx_log_kick();
+
+  return true;
+}
+
+/**
+  * @brief Emit one tokenised log record. Use the ETX_LOG_xxx macros instead
+  *        of calling this directly.
+  * @param level log level (ETX_LOG_LEVEL_xxx)
+  * @param id format string ID (offset in the .etx_log_fmt section)
+  * @param nargs number of arguments
+  * @param ... arguments (32bit integers)
+  * @retval None
+  */
+void etx_log_token( uint8_t level, uint32_t id, uint32_t nargs, ... )
+{
+  uint8_t  rec[ ETX_LOG_TOKEN_MAX_LEN ];
+  uint32_t len = 0u;
+  va_list  args;
+
+  if( nargs > ETX_LOG_TOKEN_MAX_ARGS )
+  {
+    nargs = ETX_LOG_TOKEN_MAX_ARGS;
+  }
+
+  rec[len++] = ETX_LOG_TOKEN_SOF;
+  rec[len++] = (uint8_t)( id );
+  rec[len++] = (uint8_t)( id >> 8 );
+  rec[len++] = (uint8_t)( ( level << 4 ) | nargs );
+  len       += etx_log_varint( &rec[len], HAL_GetTick() );
+
+  va_start( args, nargs );
+  for( uint32_t i = 0u; i < nargs; i++ )
+  {
+    len += etx_log_varint( &rec[len], va_arg( args, uint32_t ) );
+  }
+  va_end( args );
+
+  etx_log_write( rec, len );
+}
+
+/**
+  * @brief Wait until all the queued logs are sent out.
+  * @param None
+  * @retval None
+  */
+void etx_log_flush( void )
+{
+  uint32_t start_tick = HAL_GetTick();
+
+  if( !log_ready )
+  {
+    return;
+  }
+
+  etx_log_kick();
+
+  while( ( log_head != log_tail ) || ( log_dma_busy ) )
+  {
+    if( ( HAL_GetTick() - start_tick ) > ETX_LOG_FLUSH_TIMEOUT )
+    {
+      break;
+    }
+  }
+}
+
+/**
+  * @brief Return the number of bytes dropped due to the overflow.
+  * @param None
+  * @retval dropped count
+  */
+uint32_t etx_log_get_dropped( void )
+{
+  return log_dropped;
+}
+
+/**
+  * @brief Start the DMA transfer of the next contiguous block if the DMA is idle.
+  * @param None
+  * @retval None
+  */
+static void etx_log_kick( void )
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  do
+  {
+    if( log_dma_busy )
+    {
+      break;
+    }
+
+    uint32_t pending = log_head - log_tail;
+    if( pending == 0u )
+    {
+      break;
+    }
+
+    /* Send only till the end of the buffer. Remaining will go in the next one. */
+    uint32_t start = log_tail & ETX_LOG_RING_MASK;
+    if( pending > ( ETX_LOG_RING_SIZE - start ) )
+    {
+      pending = ETX_LOG_RING_SIZE - start;
+    }
+
+    log_dma_len  = (uint16_t)pending;
+    log_dma_busy = true;
+    if( HAL_UART_Transmit_DMA( &huart3, &log_ring[start], log_dma_len ) != HAL_OK )
+    {
+      log_dma_busy = false;
+    }
+  }while( false );
+
+  __set_PRIMASK( primask );
+}
+
+/**
+  * @brief Encode the value as LEB128 varint.
+  * @param buf buffer to store the encoded value (5 bytes max)
+  * @param value value to be encoded
+  * @retval number of bytes written
+  */
+static uint32_t etx_log_varint( uint8_t *buf, uint32_t value )
+{
+  uint32_t len = 0u;
+
+  while( value >= 0x80u )
+  {
+    buf[len++] = (uint8_t)( value | 0x80u );
+    value    >>= 7;
+  }
+  buf[len++] = (uint8_t)value;
+
+  return len;
+}
+
+/**
+  * @brief Tx Transfer completed callback.
+  * @param huart UART handle
+  * @retval None
+  */
+void HAL_UART_TxCpltCallback( UART_HandleTypeDef *huart )
+{
+  if( huart->Instance == USART3 )
+  {
+    log_tail    += log_dma_len;
+    log_dma_len  = 0u;
+    log_dma_busy = false;
+
+    //send the next block if any
+    etx_log_kick();
+  }
+}
+
+/**
+  * @brief UART error callback. Drop the current block and move on.
+  * @param huart UART handle
+  * @retval None
+  */
+void HAL_UART_ErrorCallback( UART_HandleTypeDef *huart )
+{
+  if( huart->Instance == USART3 )
+  {
+    log_tail    += log_dma_len;
+    log_dma_len  = 0u;
+    log_dma_busy = false;
+  }
+}
@@ -11,9 +11,12 @@
 #include <string.h>
 #include <stdbool.h>
 #include "fatfs.h"
+#include "etx_log.h"
+#include "etx_sha256.h"
+#include "etx_journal.h"
 
 /* Buffer to hold the received data */
-static uint8_t Rx_Buffer[ ETX_OTA_PACKET_MAX_SIZE ];
+static uint8_t Rx_Buffer[ ETX_OTA_PACKET_MAX_SIZE ] __attribute__((aligned(4)));
 
 /* OTA State */
 static ETX_OTA_STATE_ ota_state = ETX_OTA_STATE_IDLE;
@@ -26,15 +29,37 @@ static uint32_t ota_fw_crc;
 static uint32_t ota_fw_received_size;
 /* Slot number to write the received firmware */
 static uint8_t slot_num_to_write;
-/* Configuration */
+/* Received OTA meta info (version, build ID, digest) */
+static meta_info ota_meta;
+/* Is the incoming image already present in a slot? */
+static bool is_fw_already_present;
+/* Has the host asked for the device info? */
+static bool is_info_requested;
+/* Tick at the start of the UART download (for the journal) */
+static uint32_t ota_start_tick;
+/* Configuration (latest record in the config sector. See load_config()) */
 ETX_GNRL_CFG_ *cfg_flash   = (ETX_GNRL_CFG_*) (ETX_CONFIG_FLASH_ADDR);
+/* Offset of the next free config record */
+static uint32_t cfg_next_offset = ETX_CONFIG_SECTOR_SIZE;
+/* Number of erases of each flash sector. Saved with every config write. */
+static uint32_t erase_count[ETX_NO_OF_SECTORS];
+
+/* SD update buffer */
+static uint8_t sd_buf[ETX_SD_CHUNK_SIZE] __attribute__((aligned(32)));
+/* Cluster link map of the image file in the SD card */
+static DWORD sd_clmt[ETX_SD_CLMT_SIZE];
 
 /* Hardware CRC handle */
 extern CRC_HandleTypeDef hcrc;
+/* Bootloader version */
+extern const uint8_t BL_Version[2];
 
 static uint16_t etx_receive_chunk( uint8_t *buf, uint16_t max_len );
 static ETX_OTA_EX_ etx_process_data( uint8_t *buf, uint16_t len );
 static void etx_ota_send_resp( uint8_t type );
+static void etx_ota_send_info( void );
+static void etx_ota_send_packet( uint8_t type, const uint8_t *data, uint16_t len );
+static ETX_OTA_EX_ etx_ota_read_back( const ETX_OTA_READ_CMD_ *cmd );
 static HAL_StatusTypeDef write_data_to_slot( uint8_t slot_num,
                                              uint8_t *data,
                                              uint16_t data_len,
@@ -42,6 +67,35 @@ static HAL_StatusTypeDef write_data_to_slot( uint8_t slot_num,
 static HAL_StatusTypeDef write_data_to_flash_app( uint8_t *data, uint32_t data_len );
 static uint8_t get_available_slot_number( void );
 static HAL_StatusTypeDef write_cfg_to_flash( ETX_GNRL_CFG_ *cfg );
+static HAL_StatusTypeDef erase_sectors( uint32_t sector, uint32_t nb_sectors );
+static void save_erase_count( void );
+static bool is_erased( uint32_t addr, uint32_t size );
+static uint32_t get_slot_sector( uint8_t slot_num );
+static uint32_t get_slot_addr( uint8_t slot_num );
+static ETX_OTA_EX_ load_app( uint8_t *slot );
+static ETX_OTA_EX_ check_trial_boot( uint8_t slot_num );
+static ETX_OTA_EX_ revert_app( uint8_t bad_slot );
+static uint8_t select_prev_slot( ETX_GNRL_CFG_ *cfg, uint8_t exclude );
+static void etx_iwdg_start( uint32_t timeout_ms );
+static uint8_t find_slot_with_image( const meta_info *meta );
+static ETX_OTA_EX_ activate_slot( uint8_t slot_num );
+static void update_slot_meta( ETX_SLOT_ *slot, uint32_t slot_addr, const meta_info *meta );
+static uint32_t get_fw_version( uint32_t addr, uint32_t size );
+static bool is_valid_bootloader( uint32_t addr, uint32_t size );
+static HAL_StatusTypeDef set_boot_addr( uint32_t boot_addr );
+static ETX_SD_EX_ sd_update_from_manifest( FIL *fil );
+static ETX_SD_EX_ sd_install_image( FIL *fil, const ETX_SD_IMAGE_ *image, bool is_forced );
+static bool sd_is_installed( uint32_t image_type, const meta_info *meta );
+static bool sd_parse_image( char *line, ETX_SD_IMAGE_ *image );
+static char *sd_next_token( char **line );
+static bool sd_parse_version( const char *str, uint32_t *version );
+static bool sd_parse_hex( const char *str, uint8_t *out, uint32_t len );
+static HAL_StatusTypeDef sd_flash_image( FIL *fil, uint8_t slot_num, uint32_t max_size, meta_info *meta );
+static HAL_StatusTypeDef commit_app_slot( uint8_t slot_num, const meta_info *meta );
+static FRESULT sd_read_chunk( FIL *fil, uint32_t offset, uint8_t *buf, uint32_t len );
+static void etx_ota_rts_hold( bool is_hold );
+static __RAM_FUNC void etx_bl_copy( const uint32_t *src, uint32_t size, uint32_t boot_addr )
+                                                      __attribute__((noinline, noreturn));
 
 /**
   * @brief Download the application from UART and flash it.
@@ -53,7 +107,7 @@ ETX_OTA_EX_ etx_ota_download_and_flash( void )
   ETX_OTA_EX_ ret  = ETX_OTA_EX_OK;
   uint16_t    len;
 
-  printf("Waiting for the OTA data...\r\n");
+  ETX_LOG_INF("Waiting for the OTA data...\r\n");
 
   /* Reset the variables */
   ota_fw_total_size    = 0u;
@@ -61,6 +115,9 @@ ETX_OTA_EX_ etx_ota_download_and_flash( void )
   ota_fw_crc           = 0u;
   ota_state            = ETX_OTA_STATE_START;
   slot_num_to_write    = 0xFFu;
+  is_fw_already_present = false;
+  is_info_requested     = false;
+  memset( &ota_meta, 0, sizeof(ota_meta) );
 
   do
   {
@@ -71,7 +128,10 @@ ETX_OTA_EX_ etx_ota_download_and_flash( void )
 
     if( len != 0u )
     {
+      //Hold the host while the flash is busy
+      etx_ota_rts_hold( true );
       ret = etx_process_data( Rx_Buffer, len );
+      etx_ota_rts_hold( false );
     }
     else
     {
@@ -82,10 +142,22 @@ ETX_OTA_EX_ etx_ota_download_and_flash( void )
     //Send ACK or NACK
     if( ret != ETX_OTA_EX_OK )
     {
-      printf("Sending NACK\r\n");
+      ETX_LOG_ERR("Sending NACK\r\n");
+      etx_journal_count( ETX_JOURNAL_CNT_NACK );
       etx_ota_send_resp( ETX_OTA_NACK );
       break;
     }
+    else if( is_info_requested )
+    {
+      //Info packet acts as ACK
+      is_info_requested = false;
+      etx_ota_send_info();
+    }
+    else if( is_fw_already_present )
+    {
+      //Tell the host that we don't need the image
+      etx_ota_send_resp( ETX_OTA_ALREADY );
+    }
     else
     {
       //printf("Sending ACK\r\n");
@@ -94,6 +166,12 @@ ETX_OTA_EX_ etx_ota_download_and_flash( void )
 
   }while( ota_state != ETX_OTA_STATE_IDLE );
 
+  if( ( ota_fw_total_size != 0u ) && ( !is_fw_already_present ) )
+  {
+    etx_journal_update( ETX_JOURNAL_SRC_UART, (uint8_t)ota_meta.image_type, ota_fw_total_size,
+                        ota_start_tick, (uint8_t)ret );
+  }
+
   return ret;
 }
 
@@ -123,13 +201,32 @@ static ETX_OTA_EX_ etx_process_data( uint8_t *buf, uint16_t len )
         //received OTA Abort command. Stop the process
         break;
       }
+
+      if( cmd->cmd == ETX_OTA_CMD_GET_INFO )
+      {
+        //Host can query the info at any time. It doesn't change the state.
+        ETX_LOG_INF("Received GET_INFO Command\r\n");
+        is_info_requested = true;
+        ret = ETX_OTA_EX_OK;
+        break;
+      }
+
+      if( cmd->cmd == ETX_OTA_CMD_READ_BACK )
+      {
+        //Read back is allowed only before the download starts
+        if( ota_state == ETX_OTA_STATE_START )
+        {
+          ret = etx_ota_read_back( (ETX_OTA_READ_CMD_ *)buf );
+        }
+        break;
+      }
     }
 
     switch( ota_state )
     {
       case ETX_OTA_STATE_IDLE:
       {
-        printf("ETX_OTA_STATE_IDLE...\r\n");
+        ETX_LOG_DBG("ETX_OTA_STATE_IDLE...\r\n");
         ret = ETX_OTA_EX_OK;
       }
       break;
@@ -142,7 +239,7 @@ static ETX_OTA_EX_ etx_process_data( uint8_t *buf, uint16_t len )
         {
           if( cmd->cmd == ETX_OTA_CMD_START )
           {
-            printf("Received OTA START Command\r\n");
+            ETX_LOG_INF("Received OTA START Command\r\n");
             ota_state = ETX_OTA_STATE_HEADER;
             ret = ETX_OTA_EX_OK;
           }
@@ -155,9 +252,61 @@ static ETX_OTA_EX_ etx_process_data( uint8_t *buf, uint16_t len )
         ETX_OTA_HEADER_ *header = (ETX_OTA_HEADER_*)buf;
         if( header->packet_type == ETX_OTA_PACKET_TYPE_HEADER )
         {
-          ota_fw_total_size = header->meta_data.package_size;
-          ota_fw_crc        = header->meta_data.package_crc;
-          printf("Received OTA Header. FW Size = %ld\r\n", ota_fw_total_size);
+          //Older host tools send the short header. Rest will be 0 (unknown).
+          uint16_t meta_len = header->data_len;
+          if( meta_len > sizeof(meta_info) )
+          {
+            meta_len = sizeof(meta_info);
+          }
+          memcpy( &ota_meta, &header->meta_data, meta_len );
+
+          ota_fw_total_size = ota_meta.package_size;
+          ota_fw_crc        = ota_meta.package_crc;
+          ota_start_tick    = HAL_GetTick();
+          ETX_LOG_INF("Received OTA Header. FW Size = %ld, Version = 0x%06lX, Build = %lu\r\n",
+                      ota_fw_total_size, ota_meta.fw_version, ota_meta.build_id);
+
+          if( ota_meta.image_type == ETX_OTA_IMAGE_BOOTLOADER )
+          {
+            if( ota_fw_total_size > ETX_BL_MAX_SIZE )
+            {
+              ETX_LOG_ERR("Bootloader is too big\r\n");
+              break;
+            }
+
+            //Is this the bootloader that is running now?
+            uint32_t cal_crc = HAL_CRC_Calculate( &hcrc, (uint32_t*)ETX_BL_FLASH_ADDR,
+                                                  ota_fw_total_size );
+            if( cal_crc == ota_fw_crc )
+            {
+              ETX_LOG_INF("Bootloader is already up to date\r\n");
+              is_fw_already_present = true;
+              ota_state             = ETX_OTA_STATE_IDLE;
+              ret                   = ETX_OTA_EX_OK;
+              break;
+            }
+          }
+          else if( ota_meta.image_type == ETX_OTA_IMAGE_APP )
+          {
+            //Do we have this image already? Then just activate it.
+            uint8_t slot_num = find_slot_with_image( &ota_meta );
+            if( slot_num != 0xFF )
+            {
+              ETX_LOG_INF("Image is already present in the slot %d\r\n", slot_num);
+              if( activate_slot( slot_num ) == ETX_OTA_EX_OK )
+              {
+                is_fw_already_present = true;
+                ota_state             = ETX_OTA_STATE_IDLE;
+                ret                   = ETX_OTA_EX_OK;
+              }
+              break;
+            }
+          }
+          else
+          {
+            ETX_LOG_ERR("Unknown image type %lu\r\n", ota_meta.image_type);
+            break;
+          }
 
           //get the slot number
           slot_num_to_write = get_available_slot_number();
@@ -204,7 +353,7 @@ static ETX_OTA_EX_ etx_process_data( uint8_t *buf, uint16_t len )
 
           if( ex == HAL_OK )
           {
-            printf("[%ld/%ld]\r\n", ota_fw_received_size/ETX_OTA_DATA_MAX_SIZE, ota_fw_total_size/ETX_OTA_DATA_MAX_SIZE);
+            ETX_LOG_DBG("[%ld/%ld]\r\n", ota_fw_received_size/ETX_OTA_DATA_MAX_SIZE, ota_fw_total_size/ETX_OTA_DATA_MAX_SIZE);
             if( ota_fw_received_size >= ota_fw_total_size )
             {
               //received the full data. So, move to end
@@ -225,9 +374,9 @@ static ETX_OTA_EX_ etx_process_data( uint8_t *buf, uint16_t len )
         {
           if( cmd->cmd == ETX_OTA_CMD_END )
           {
-            printf("Received OTA END Command\r\n");
+            ETX_LOG_INF("Received OTA END Command\r\n");
 
-            printf("Validating the received Binary...\r\n");
+            ETX_LOG_INF("Validating the received Binary...\r\n");
 
             uint32_t slot_addr;
             if( slot_num_to_write == 0u )
@@ -243,28 +392,61 @@ static ETX_OTA_EX_ etx_process_data( uint8_t *buf, uint16_t len )
             uint32_t cal_crc = HAL_CRC_Calculate( &hcrc, (uint32_t*)slot_addr, ota_fw_total_size);
             if( cal_crc != ota_fw_crc )
             {
-              printf("ERROR: FW CRC Mismatch\r\n");
+              ETX_LOG_ERR("ERROR: FW CRC Mismatch\r\n");
               break;
             }
-            printf("Done!!!\r\n");
+            ETX_LOG_INF("Done!!!\r\n");
 
             /* Read the configuration */
             ETX_GNRL_CFG_ cfg;
             memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
 
-            //update the slot
-            cfg.slot_table[slot_num_to_write].fw_crc                 = cal_crc;
-            cfg.slot_table[slot_num_to_write].fw_size                = ota_fw_total_size;
-            cfg.slot_table[slot_num_to_write].is_this_slot_not_valid = 0u;
-            cfg.slot_table[slot_num_to_write].should_we_run_this_fw  = 1u;
+            //Calculate the digest and verify it (if the host sent it)
+            update_slot_meta( &cfg.slot_table[slot_num_to_write], slot_addr, &ota_meta );
+            if( ( !etx_sha256_is_empty( ota_meta.digest ) ) &&
+                ( memcmp( cfg.slot_table[slot_num_to_write].digest, ota_meta.digest,
+                          ETX_DIGEST_SIZE ) != 0 ) )
+            {
+              ETX_LOG_ERR("ERROR: FW Digest Mismatch\r\n");
+              etx_journal_count( ETX_JOURNAL_CNT_DIGEST_ERR );
+              break;
+            }
+
+            if( ota_meta.image_type == ETX_OTA_IMAGE_BOOTLOADER )
+            {
+              if( !is_valid_bootloader( slot_addr, ota_fw_total_size ) )
+              {
+                ETX_LOG_ERR("ERROR: Not a bootloader image\r\n");
+                break;
+              }
 
-            //reset other slots
-            for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+              /*
+               * The slot is not an app. So, it stays invalid. The new
+               * bootloader will be installed in the next boot.
+               */
+              cfg.bl_update.state    = ETX_BL_UPDATE_PENDING;
+              cfg.bl_update.slot_num = slot_num_to_write;
+              cfg.bl_update.size     = ota_fw_total_size;
+              cfg.bl_update.crc      = cal_crc;
+            }
+            else
             {
-              if( slot_num_to_write != i )
+              //update the slot
+              cfg.slot_table[slot_num_to_write].fw_crc                 = cal_crc;
+              cfg.slot_table[slot_num_to_write].fw_size                = ota_fw_total_size;
+              cfg.slot_table[slot_num_to_write].is_this_slot_not_valid = 0u;
+              cfg.slot_table[slot_num_to_write].should_we_run_this_fw  = 1u;
+              cfg.slot_table[slot_num_to_write].trial_state            = ETX_SLOT_TRIAL;
+              cfg.slot_table[slot_num_to_write].boot_attempts          = 0u;
+
+              //reset other slots
+              for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
               {
-                //update the slot as inactive
-                cfg.slot_table[i].should_we_run_this_fw = 0u;
+                if( slot_num_to_write != i )
+                {
+                  //update the slot as inactive
+                  cfg.slot_table[i].should_we_run_this_fw = 0u;
+                }
               }
             }
 
@@ -341,18 +523,23 @@ static uint16_t etx_receive_chunk( uint8_t *buf, uint16_t max_len )
     data_len = *(uint16_t *)&buf[index];
     index += 2u;
 
-    for( uint16_t i = 0u; i < data_len; i++ )
+    if( data_len > ETX_OTA_DATA_MAX_SIZE )
+    {
+      //Doesn't fit into our buffer
+      ret = ETX_OTA_EX_ERR;
+      break;
+    }
+
+    //Receive the whole data in one go, so the host can stream it.
+    //HAL rejects the zero size, so skip it for the empty packets.
+    if( data_len != 0u )
     {
-      ret = HAL_UART_Receive( &huart2, &buf[index++], 1, HAL_MAX_DELAY );
+      ret = HAL_UART_Receive( &huart2, &buf[index], data_len, HAL_MAX_DELAY );
       if( ret != HAL_OK )
       {
         break;
       }
-    }
-
-    if( ret != HAL_OK )
-    {
-      break;
+      index += data_len;
     }
 
     //Get the CRC.
@@ -384,7 +571,7 @@ static uint16_t etx_receive_chunk( uint8_t *buf, uint16_t max_len )
     //Verify the CRC
     if( cal_data_crc != rec_data_crc )
     {
-      printf("Chunk's CRC mismatch [Cal CRC = 0x%08lX] [Rec CRC = 0x%08lX]\r\n",
+      ETX_LOG_ERR("Chunk's CRC mismatch [Cal CRC = 0x%08lX] [Rec CRC = 0x%08lX]\r\n",
                                                    cal_data_crc, rec_data_crc );
       ret = ETX_OTA_EX_ERR;
       break;
@@ -396,11 +583,12 @@ static uint16_t etx_receive_chunk( uint8_t *buf, uint16_t max_len )
   {
     //clear the index if error
     index = 0u;
+    etx_journal_count( ETX_JOURNAL_CNT_FRAME_ERR );
   }
 
   if( max_len < index )
   {
-    printf("Received more data than expected. Expected = %d, Received = %d\r\n",
+    ETX_LOG_ERR("Received more data than expected. Expected = %d, Received = %d\r\n",
                                                               max_len, index );
     index = 0u;
   }
@@ -408,6 +596,39 @@ static uint16_t etx_receive_chunk( uint8_t *buf, uint16_t max_len )
   return index;
 }
 
+/**
+  * @brief Hold the host (RTS high) or give RTS back to the USART.
+  *        It does nothing without ETX_OTA_FLOW_CTRL.
+  * @param is_hold true - hold the host, false - release it
+  * @retval none
+  */
+static void etx_ota_rts_hold( bool is_hold )
+{
+#if ( ETX_OTA_FLOW_CTRL == 1 )
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  GPIO_InitStruct.Pin   = ETX_OTA_RTS_PIN;
+  GPIO_InitStruct.Pull  = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+
+  if( is_hold )
+  {
+    //RTS is active low. Drive it high before the USART lets it go.
+    HAL_GPIO_WritePin( ETX_OTA_RTS_PORT, ETX_OTA_RTS_PIN, GPIO_PIN_SET );
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+  }
+  else
+  {
+    GPIO_InitStruct.Mode      = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Alternate = GPIO_AF7_USART2;
+  }
+
+  HAL_GPIO_Init( ETX_OTA_RTS_PORT, &GPIO_InitStruct );
+#else
+  (void)is_hold;
+#endif
+}
+
 /**
   * @brief Send the response.
   * @param type ACK or NACK
@@ -430,6 +651,199 @@ static void etx_ota_send_resp( uint8_t type )
   HAL_UART_Transmit(&huart2, (uint8_t *)&rsp, sizeof(ETX_OTA_RESP_), HAL_MAX_DELAY);
 }
 
+/**
+  * @brief Send the device info (response to GET_INFO).
+  * @param none
+  * @retval none
+  */
+static void etx_ota_send_info( void )
+{
+  ETX_OTA_INFO_PACKET_ pkt;
+
+  memset( &pkt, 0, sizeof(pkt) );
+
+  pkt.sof         = ETX_OTA_SOF;
+  pkt.packet_type = ETX_OTA_PACKET_TYPE_INFO;
+  pkt.data_len    = sizeof(ETX_OTA_INFO_);
+  pkt.eof         = ETX_OTA_EOF;
+
+  pkt.info.info_version   = ETX_OTA_INFO_VERSION;
+  pkt.info.bl_version[0]  = BL_Version[0];
+  pkt.info.bl_version[1]  = BL_Version[1];
+  pkt.info.no_of_slots    = ETX_NO_OF_SLOTS;
+  pkt.info.features       = ETX_OTA_FEATURE_STREAM     |
+                            ETX_OTA_FEATURE_SKIP_SAME  |
+                            ETX_OTA_FEATURE_ROLLBACK   |
+                            ETX_OTA_FEATURE_TRIAL_BOOT |
+                            ETX_OTA_FEATURE_READ_BACK  |
+                            ETX_OTA_FEATURE_BL_UPDATE  |
+                            ETX_OTA_FEATURE_WEAR       |
+                            ( ( ETX_OTA_FLOW_CTRL == 1 ) ? ETX_OTA_FEATURE_FLOW_CTRL : 0u );
+  pkt.info.max_data_size  = ETX_OTA_DATA_MAX_SIZE;
+  pkt.info.baudrate       = huart2.Init.BaudRate;
+  pkt.info.flash_size     = (uint32_t)( *(uint16_t *)FLASHSIZE_BASE ) * 1024u;
+  pkt.info.app_flash_addr = ETX_APP_FLASH_ADDR;
+  pkt.info.slot_max_size  = ETX_SLOT_MAX_SIZE;
+  pkt.info.reboot_cause   = cfg_flash->reboot_cause;
+
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    ETX_SLOT_ *slot = &cfg_flash->slot_table[i];
+
+    pkt.info.slots[i].is_valid   = ( slot->is_this_slot_not_valid == 0u );
+    pkt.info.slots[i].is_active  = ( slot->is_this_slot_active == 1u );
+    pkt.info.slots[i].is_trial   = ( slot->trial_state == ETX_SLOT_TRIAL );
+    pkt.info.slots[i].fw_size    = slot->fw_size;
+    pkt.info.slots[i].fw_crc     = slot->fw_crc;
+    pkt.info.slots[i].fw_version = slot->fw_version;
+    pkt.info.slots[i].build_id   = slot->build_id;
+  }
+
+  pkt.info.no_of_sectors    = ETX_NO_OF_SECTORS;
+  pkt.info.cfg_free_records = ( ETX_CONFIG_SECTOR_SIZE - cfg_next_offset ) / ETX_CFG_RECORD_SIZE;
+  memcpy( pkt.info.erase_count, erase_count, sizeof(erase_count) );
+
+  //CRC of the info data (after SOF, type and length)
+  pkt.crc = HAL_CRC_Calculate( &hcrc, (uint32_t*)&((uint8_t *)&pkt)[4], sizeof(ETX_OTA_INFO_) );
+
+  //send the info
+  HAL_UART_Transmit(&huart2, (uint8_t *)&pkt, sizeof(ETX_OTA_INFO_PACKET_), HAL_MAX_DELAY);
+}
+
+/**
+  * @brief Send a packet. The data is sent from where it is (no copy), so it
+  *        can be sent directly from the flash.
+  * @param type packet type
+  * @param data data to be sent
+  * @param len data length
+  * @retval none
+  */
+static void etx_ota_send_packet( uint8_t type, const uint8_t *data, uint16_t len )
+{
+  uint8_t  head[4];
+  uint8_t  tail[5];
+  uint32_t crc = HAL_CRC_Calculate( &hcrc, (uint32_t*)data, len );
+
+  head[0] = ETX_OTA_SOF;
+  head[1] = type;
+  head[2] = (uint8_t)( len );
+  head[3] = (uint8_t)( len >> 8 );
+
+  memcpy( tail, &crc, sizeof(crc) );
+  tail[4] = ETX_OTA_EOF;
+
+  HAL_UART_Transmit( &huart2, head, sizeof(head), HAL_MAX_DELAY );
+  HAL_UART_Transmit( &huart2, (uint8_t *)data, len, HAL_MAX_DELAY );
+  HAL_UART_Transmit( &huart2, tail, sizeof(tail), HAL_MAX_DELAY );
+}
+
+/**
+  * @brief Stream the flash content (or the CRC of each block) to the host.
+  * @param cmd read back command
+  * @retval ETX_OTA_EX_
+  */
+static ETX_OTA_EX_ etx_ota_read_back( const ETX_OTA_READ_CMD_ *cmd )
+{
+  ETX_OTA_EX_ ret = ETX_OTA_EX_ERR;
+  uint32_t    base;
+  uint32_t    length     = cmd->length;
+  uint32_t    offset     = cmd->offset;
+  uint32_t    block_size = cmd->block_size;
+  uint32_t    fw_size    = 0u;
+
+  do
+  {
+    if( cmd->data_len != ( sizeof(ETX_OTA_READ_CMD_) - 9u ) )
+    {
+      break;
+    }
+
+    if( cmd->region == ETX_OTA_REGION_APP )
+    {
+      base = ETX_APP_FLASH_ADDR;
+      //Size of the running app
+      for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+      {
+        if( cfg_flash->slot_table[i].is_this_slot_active == 1u )
+        {
+          fw_size = cfg_flash->slot_table[i].fw_size;
+          break;
+        }
+      }
+    }
+    else if( cmd->region < ETX_NO_OF_SLOTS )
+    {
+      base    = get_slot_addr( cmd->region );
+      fw_size = cfg_flash->slot_table[cmd->region].fw_size;
+    }
+    else
+    {
+      break;
+    }
+
+    if( length == 0u )
+    {
+      //Read the whole image
+      length = fw_size;
+    }
+
+    if( ( offset > ETX_SLOT_MAX_SIZE ) || ( length > ( ETX_SLOT_MAX_SIZE - offset ) ) )
+    {
+      ETX_LOG_ERR("Read back : Invalid range\r\n");
+      break;
+    }
+
+    if( block_size == 0u )
+    {
+      block_size = ETX_OTA_DATA_MAX_SIZE;
+    }
+
+    ETX_LOG_INF("Read back : Region %d, Offset %lu, Length %lu, Mode %d\r\n",
+                cmd->region, offset, length, cmd->mode);
+
+    if( cmd->mode == ETX_OTA_READ_MODE_DATA )
+    {
+      if( block_size > ETX_OTA_DATA_MAX_SIZE )
+      {
+        block_size = ETX_OTA_DATA_MAX_SIZE;
+      }
+
+      for( uint32_t pos = 0u; pos < length; pos += block_size )
+      {
+        uint32_t len = ( ( length - pos ) > block_size ) ? block_size : ( length - pos );
+        etx_ota_send_packet( ETX_OTA_PACKET_TYPE_DATA, (uint8_t *)( base + offset + pos ), len );
+      }
+    }
+    else if( cmd->mode == ETX_OTA_READ_MODE_CRC )
+    {
+      //Send the block CRCs in batches. Reuse the Rx buffer. We are done with the command.
+      uint32_t *crcs  = (uint32_t *)Rx_Buffer;
+      uint32_t  count = 0u;
+
+      for( uint32_t pos = 0u; pos < length; pos += block_size )
+      {
+        uint32_t len = ( ( length - pos ) > block_size ) ? block_size : ( length - pos );
+
+        crcs[count++] = HAL_CRC_Calculate( &hcrc, (uint32_t *)( base + offset + pos ), len );
+
+        if( ( count == ( ETX_OTA_DATA_MAX_SIZE / sizeof(uint32_t) ) ) || ( ( pos + len ) >= length ) )
+        {
+          etx_ota_send_packet( ETX_OTA_PACKET_TYPE_DATA, (uint8_t *)crcs, count * sizeof(uint32_t) );
+          count = 0u;
+        }
+      }
+    }
+    else
+    {
+      break;
+    }
+
+    ret = ETX_OTA_EX_OK;
+  }while( false );
+
+  return ret;
+}
+
 /**
   * @brief Write data to the Slot
   * @param slot_num slot to be written
@@ -463,27 +877,12 @@ static HAL_StatusTypeDef write_data_to_slot( uint8_t slot_num,
     //No need to erase every time. Erase only the first time.
     if( is_first_block )
     {
-      printf("Erasing the Slot %d Flash memory...\r\n", slot_num);
-      //Erase the Flash
-      FLASH_EraseInitTypeDef EraseInitStruct;
-      uint32_t SectorError;
-
-      EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
-      if( slot_num == 0 )
-      {
-        EraseInitStruct.Sector        = FLASH_SECTOR_7;
-      }
-      else
-      {
-        EraseInitStruct.Sector        = FLASH_SECTOR_9;
-      }
-      EraseInitStruct.NbSectors     = 2;                    //erase 2 sectors
-      EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
-
-      ret = HAL_FLASHEx_Erase( &EraseInitStruct, &SectorError );
+      ETX_LOG_INF("Erasing the Slot %d Flash memory...\r\n", slot_num);
+      //Erase the Flash (2 sectors)
+      ret = erase_sectors( get_slot_sector( slot_num ), 2 );
       if( ret != HAL_OK )
       {
-        printf("Flash Erase Error\r\n");
+        ETX_LOG_ERR("Flash Erase Error\r\n");
         break;
       }
     }
@@ -511,7 +910,8 @@ static HAL_StatusTypeDef write_data_to_slot( uint8_t slot_num,
       }
       else
       {
-        printf("Flash Write Error\r\n");
+        ETX_LOG_ERR("Flash Write Error\r\n");
+        etx_journal_count( ETX_JOURNAL_CNT_FLASH_ERR );
         break;
       }
     }
@@ -526,6 +926,11 @@ static HAL_StatusTypeDef write_data_to_slot( uint8_t slot_num,
     {
       break;
     }
+
+    if( is_first_block )
+    {
+      save_erase_count();
+    }
   }while( false );
 
   return ret;
@@ -547,21 +952,55 @@ static uint8_t get_available_slot_number( void )
    * Check the slot is valid or not. If it is valid,
    * then check the slot is active or not.
    *
-   * If it is valid and not active, then use that slot.
-   * If it is not valid, then use that slot.
+   * If it is valid and not active, then we can use that slot.
+   * If it is not valid, then we can use that slot.
    *
+   * If more than one slot can be used, prefer the invalid one (keeps the
+   * previous app for the rollback) and then the least erased one.
    */
 
    for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
    {
-     if( ( cfg.slot_table[i].is_this_slot_not_valid != 0u ) || ( cfg.slot_table[i].is_this_slot_active == 0u ) )
+     bool is_invalid = ( cfg.slot_table[i].is_this_slot_not_valid != 0u );
+
+     if( ( !is_invalid ) && ( cfg.slot_table[i].is_this_slot_active != 0u ) )
+     {
+       //Running app. Don't touch it.
+       continue;
+     }
+
+     if( slot_number == 0xFF )
      {
        slot_number = i;
-       printf("Slot %d is available for OTA update\r\n", slot_number);
-       break;
+       continue;
+     }
+
+     bool is_best_invalid = ( cfg.slot_table[slot_number].is_this_slot_not_valid != 0u );
+     if( is_invalid != is_best_invalid )
+     {
+       if( is_invalid )
+       {
+         slot_number = i;
+       }
+     }
+     else
+     {
+       uint32_t sector      = get_slot_sector( i );
+       uint32_t best_sector = get_slot_sector( slot_number );
+
+       if( ( erase_count[sector] + erase_count[sector + 1u] ) <
+           ( erase_count[best_sector] + erase_count[best_sector + 1u] ) )
+       {
+         slot_number = i;
+       }
      }
    }
 
+   if( slot_number != 0xFF )
+   {
+     ETX_LOG_DBG("Slot %d is available for OTA update\r\n", slot_number);
+   }
+
    return slot_number;
 }
 
@@ -591,32 +1030,31 @@ static HAL_StatusTypeDef write_data_to_flash_app( uint8_t *data, uint32_t data_l
     __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR |
                 FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR);
 
-    printf("Erasing the App Flash memory...\r\n");
-    //Erase the Flash
-    FLASH_EraseInitTypeDef EraseInitStruct;
-    uint32_t SectorError;
-
-    EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
-    EraseInitStruct.Sector        = FLASH_SECTOR_5;
-    EraseInitStruct.NbSectors     = 2;                    //erase 2 sectors(5,6)
-    EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
-
-    ret = HAL_FLASHEx_Erase( &EraseInitStruct, &SectorError );
+    ETX_LOG_INF("Erasing the App Flash memory...\r\n");
+    //Erase the Flash. Erase sector 6 only if the app doesn't fit into the sector 5.
+    ret = erase_sectors( FLASH_SECTOR_5, ( data_len > ETX_APP_SECTOR_SIZE ) ? 2u : 1u );
     if( ret != HAL_OK )
     {
-      printf("Flash erase Error\r\n");
+      ETX_LOG_ERR("Flash erase Error\r\n");
       break;
     }
 
-    for( uint32_t i = 0; i < data_len; i++ )
+    //Program word by word. It is 4 times faster than the byte programming.
+    for( uint32_t i = 0; i < data_len; i += 4u )
     {
-      ret = HAL_FLASH_Program( FLASH_TYPEPROGRAM_BYTE,
+      uint32_t word = 0xFFFFFFFF;
+      uint32_t len  = ( ( data_len - i ) >= 4u ) ? 4u : ( data_len - i );
+
+      memcpy( &word, &data[i], len );
+
+      ret = HAL_FLASH_Program( FLASH_TYPEPROGRAM_WORD,
                                (ETX_APP_FLASH_ADDR + i),
-                               data[i]
+                               word
                              );
       if( ret != HAL_OK )
       {
-        printf("App Flash Write Error\r\n");
+        ETX_LOG_ERR("App Flash Write Error\r\n");
+        etx_journal_count( ETX_JOURNAL_CNT_FLASH_ERR );
         break;
       }
     }
@@ -635,20 +1073,58 @@ static HAL_StatusTypeDef write_data_to_flash_app( uint8_t *data, uint32_t data_l
     //Check if the FLASH_FLAG_BSY.
     FLASH_WaitForLastOperation( HAL_MAX_DELAY );
 
+    save_erase_count();
   }while( false );
 
   return ret;
 }
 
 /**
-  * @brief Load the new app to the app's actual flash memory.
+  * @brief Load the new app to the app's actual flash memory. If the app
+  *        is corrupted or it didn't confirm within the trial boots, revert
+  *        to the previous valid slot.
   * @param none
-  * @retval none
+  * @retval ETX_OTA_EX_OK - valid app is loaded, ETX_OTA_EX_ERR - no valid app
+  */
+ETX_OTA_EX_ load_new_app( void )
+{
+  ETX_OTA_EX_ ret = ETX_OTA_EX_ERR;
+
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    uint8_t slot_num = 0xFF;
+
+    ret = load_app( &slot_num );
+    if( ret == ETX_OTA_EX_OK )
+    {
+      ret = check_trial_boot( slot_num );
+    }
+
+    if( ( ret == ETX_OTA_EX_OK ) || ( slot_num == 0xFF ) )
+    {
+      break;
+    }
+
+    //This app is bad. Go back to the previous one.
+    if( revert_app( slot_num ) != ETX_OTA_EX_OK )
+    {
+      break;
+    }
+  }
+
+  return ret;
+}
+
+/**
+  * @brief Load the new app (if any) to the app's actual flash memory and
+  *        verify the app.
+  * @param slot slot number of the loaded app (0xFF if there is no app)
+  * @retval ETX_OTA_EX_
   */
-void load_new_app( void )
+static ETX_OTA_EX_ load_app( uint8_t *slot )
 {
   bool              is_update_available = false;
-  uint8_t           slot_num;
+  uint8_t           slot_num            = 0xFF;
   HAL_StatusTypeDef ret;
 
   /* Read the configuration */
@@ -663,7 +1139,7 @@ void load_new_app( void )
    {
      if( cfg.slot_table[i].should_we_run_this_fw == 1u )
      {
-       printf("New Application is available in the slot %d!!!\r\n", i);
+       ETX_LOG_INF("New Application is available in the slot %d!!!\r\n", i);
        is_update_available               = true;
        slot_num                          = i;
 
@@ -687,21 +1163,28 @@ void load_new_app( void )
        }
      }
 
-     uint32_t slot_addr;
-     if( slot_num == 0u )
+     uint32_t slot_addr = get_slot_addr( slot_num );
+
+     /*
+      * The app's flash may already have this image (rollback to the image
+      * that was copied before). Don't erase and copy it again in that case.
+      */
+     uint32_t app_crc = HAL_CRC_Calculate( &hcrc, (uint32_t*)ETX_APP_FLASH_ADDR,
+                                           cfg.slot_table[slot_num].fw_size );
+     if( app_crc == cfg.slot_table[slot_num].fw_crc )
      {
-       slot_addr = ETX_APP_SLOT0_FLASH_ADDR;
+       ETX_LOG_INF("Application is already loaded. Skipping the copy.\r\n");
+       ret = HAL_OK;
      }
      else
      {
-       slot_addr = ETX_APP_SLOT1_FLASH_ADDR;
+       //Load the new app or firmware to app's flash address
+       ret = write_data_to_flash_app( (uint8_t*)slot_addr, cfg.slot_table[slot_num].fw_size );
      }
 
-     //Load the new app or firmware to app's flash address
-     ret = write_data_to_flash_app( (uint8_t*)slot_addr, cfg.slot_table[slot_num].fw_size );
      if( ret != HAL_OK )
      {
-       printf("App Flash write Error\r\n");
+       ETX_LOG_ERR("App Flash write Error\r\n");
      }
      else
      {
@@ -709,7 +1192,7 @@ void load_new_app( void )
        ret = write_cfg_to_flash( &cfg );
        if( ret != HAL_OK )
        {
-         printf("Config Flash write Error\r\n");
+         ETX_LOG_ERR("Config Flash write Error\r\n");
        }
      }
    }
@@ -726,8 +1209,15 @@ void load_new_app( void )
      }
    }
 
+   *slot = slot_num;
+   if( slot_num == 0xFF )
+   {
+     ETX_LOG_ERR("No Application found\r\n");
+     return ETX_OTA_EX_ERR;
+   }
+
    //Verify the application is corrupted or not
-   printf("Verifying the Application...");
+   ETX_LOG_INF("Verifying the Application...");
 
    FLASH_WaitForLastOperation( HAL_MAX_DELAY );
    //Verify the application
@@ -737,174 +1227,368 @@ void load_new_app( void )
    //Verify the CRC
    if( cal_data_crc != cfg.slot_table[slot_num].fw_crc )
    {
-     printf("ERROR!!!\r\n");
-     printf("Invalid Application. HALT!!!\r\n");
-     while(1);
+     ETX_LOG_ERR("ERROR!!!\r\n");
+     ETX_LOG_ERR("Invalid Application\r\n");
+     etx_journal_count( ETX_JOURNAL_CNT_APP_CRC_ERR );
+     return ETX_OTA_EX_ERR;
    }
-   printf("Done!!!\r\n");
+   ETX_LOG_INF("Done!!!\r\n");
+
+   return ETX_OTA_EX_OK;
 }
 
 /**
-  * @brief Check the SD for Firmware update
-  * @param none
-  * @retval ETX_SD_EX_
+  * @brief Count the boot attempts of the unconfirmed app and arm the watchdog.
+  *        The app has to confirm itself (see ETX_SLOT_TRIAL) before it runs out
+  *        of attempts.
+  * @param slot_num slot number of the loaded app
+  * @retval ETX_OTA_EX_OK - boot the app, ETX_OTA_EX_ERR - revert the app
   */
-ETX_SD_EX_ check_update_frimware_SD_card( void )
+static ETX_OTA_EX_ check_trial_boot( uint8_t slot_num )
 {
-  ETX_SD_EX_  ret = ETX_SD_EX_ERR;
-  FATFS       FatFs;                //Fatfs handle
-  FIL         fil;                  //File handle
-  FRESULT     fres;                 //Result after operations
+  ETX_OTA_EX_ ret = ETX_OTA_EX_ERR;
+
+  /* Read the configuration */
+  ETX_GNRL_CFG_ cfg;
+  memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
 
   do
   {
-    //Mount the SD Card
-    fres = f_mount(&FatFs, "", 1);    //1=mount now
-    if (fres != FR_OK)
+    if( cfg.slot_table[slot_num].trial_state != ETX_SLOT_TRIAL )
     {
-      printf("No SD Card found : (%i)\r\n", fres);
-      ret = ETX_SD_EX_NO_SD;
+      //Confirmed app. Nothing to do.
+      ret = ETX_OTA_EX_OK;
       break;
     }
-    printf("SD Card Mounted Successfully!!!\r\n");
 
-    fres = f_open(&fil, ETX_SD_CARD_FW_PATH, FA_WRITE | FA_READ | FA_OPEN_EXISTING);
-    if(fres != FR_OK)
+    if( cfg.slot_table[slot_num].boot_attempts >= ETX_TRIAL_MAX_ATTEMPTS )
     {
-      printf("No Firmware found in SD Card : (%i)\r\n", fres);
+      ETX_LOG_ERR("App is not confirmed after %lu attempts\r\n",
+                                        cfg.slot_table[slot_num].boot_attempts);
       break;
     }
 
-    UINT bytesRead;
-    BYTE readBuf[ETX_OTA_DATA_MAX_SIZE];
-    UINT fw_size = f_size(&fil);
-    UINT size;
+    cfg.slot_table[slot_num].boot_attempts++;
 
-    printf("Firmware found in SD Card. \r\nFW Size = %d Bytes\r\n", fw_size);
+    ETX_LOG_INF("Trial boot %lu/%d\r\n", cfg.slot_table[slot_num].boot_attempts,
+                                          ETX_TRIAL_MAX_ATTEMPTS );
 
-    //get the slot number
-    slot_num_to_write = get_available_slot_number();
-    if( slot_num_to_write == 0xFF )
+    /* write back the updated config */
+    if( write_cfg_to_flash( &cfg ) != HAL_OK )
     {
-      printf("f_getfree error (%i)\r\n", fres);
-      ret = ETX_SD_EX_FU_ERR;
-      f_close(&fil);
+      ETX_LOG_ERR("Config Flash write Error\r\n");
       break;
     }
 
-    bool is_first_block = true;
+    //If the app hangs, the watchdog will bring us back here
+    etx_iwdg_start( ETX_TRIAL_WDG_TIMEOUT );
 
-    /* Read the configuration */
-    ETX_GNRL_CFG_ cfg;
-    memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+    ret = ETX_OTA_EX_OK;
+  }while( false );
 
-    /* Before writing the data, reset the available slot */
-    cfg.slot_table[slot_num_to_write].is_this_slot_not_valid = 1u;
+  return ret;
+}
 
-    /* write back the updated config */
-    HAL_StatusTypeDef ex = write_cfg_to_flash( &cfg );
-    if( ex != HAL_OK )
-    {
-      ret = ETX_SD_EX_FU_ERR;
-      f_close(&fil);
-      break;
-    }
+/**
+  * @brief Mark the app as invalid and select the previous valid slot.
+  * @param bad_slot slot number of the bad app
+  * @retval ETX_OTA_EX_OK - previous app is selected, ETX_OTA_EX_ERR - no app
+  */
+static ETX_OTA_EX_ revert_app( uint8_t bad_slot )
+{
+  ETX_OTA_EX_ ret = ETX_OTA_EX_ERR;
+
+  /* Read the configuration */
+  ETX_GNRL_CFG_ cfg;
+  memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+
+  ETX_LOG_WRN("Reverting the app in the slot %d\r\n", bad_slot);
+  etx_journal_count( ETX_JOURNAL_CNT_REVERT );
+
+  //Don't use this slot anymore
+  cfg.slot_table[bad_slot].is_this_slot_not_valid = 1u;
+  cfg.slot_table[bad_slot].should_we_run_this_fw  = 0u;
+  cfg.slot_table[bad_slot].trial_state            = 0u;
+  cfg.slot_table[bad_slot].boot_attempts          = 0u;
+
+  if( select_prev_slot( &cfg, bad_slot ) != 0xFF )
+  {
+    ret = ETX_OTA_EX_OK;
+  }
+
+  /* write back the updated config */
+  if( write_cfg_to_flash( &cfg ) != HAL_OK )
+  {
+    ETX_LOG_ERR("Config Flash write Error\r\n");
+    ret = ETX_OTA_EX_ERR;
+  }
+
+  return ret;
+}
+
+/**
+  * @brief Select the previous valid application (rollback).
+  *        This only updates the slot table. load_new_app() will load it.
+  * @param none
+  * @retval ETX_OTA_EX_
+  */
+ETX_OTA_EX_ load_prev_app( void )
+{
+  ETX_OTA_EX_ ret    = ETX_OTA_EX_ERR;
+  uint8_t     active = 0xFF;
 
-    ota_fw_received_size = 0;
+  /* Read the configuration */
+  ETX_GNRL_CFG_ cfg;
+  memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
 
-    for(uint32_t i = 0; i < fw_size; )
+  //Find the currently running slot
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    if( cfg.slot_table[i].is_this_slot_active == 1u )
     {
-      if( (fw_size - i) >= ETX_OTA_DATA_MAX_SIZE )
-      {
-        size = ETX_OTA_DATA_MAX_SIZE;
-      }
-      else
-      {
-        size = fw_size - i;
-      }
+      active = i;
+      break;
+    }
+  }
+
+  if( select_prev_slot( &cfg, active ) != 0xFF )
+  {
+    ret = ETX_OTA_EX_OK;
+  }
+
+  //Don't try the rollback again in the next boot
+  cfg.reboot_cause = ETX_NORMAL_BOOT;
+
+  /* write back the updated config */
+  if( write_cfg_to_flash( &cfg ) != HAL_OK )
+  {
+    ETX_LOG_ERR("Config Flash write Error\r\n");
+    ret = ETX_OTA_EX_ERR;
+  }
+
+  return ret;
+}
 
-      //clear the buffer
-      memset(readBuf, 0, ETX_OTA_DATA_MAX_SIZE);
+/**
+  * @brief Find a valid slot other than the given one and mark it to run.
+  *        Only the cfg copy is updated. Caller has to write it to the flash.
+  * @param cfg configuration
+  * @param exclude slot that must not be selected
+  * @retval selected slot number (0xFF if there is no valid slot)
+  */
+static uint8_t select_prev_slot( ETX_GNRL_CFG_ *cfg, uint8_t exclude )
+{
+  uint8_t prev_slot = 0xFF;
 
-      fres = f_read(&fil, readBuf, size, &bytesRead);
-      if( ( fres != FR_OK) || (size != bytesRead ) )
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    if( ( i != exclude ) && ( cfg->slot_table[i].is_this_slot_not_valid == 0u ) )
+    {
+      //Make sure the slot is not corrupted before we select it
+      uint32_t cal_crc = HAL_CRC_Calculate( &hcrc, (uint32_t*)get_slot_addr( i ),
+                                            cfg->slot_table[i].fw_size );
+      if( cal_crc == cfg->slot_table[i].fw_crc )
       {
-        printf("FW Read Error : (%i)\r\n", fres);
-        ret = ETX_SD_EX_FU_ERR;
+        prev_slot = i;
         break;
       }
+      ETX_LOG_WRN("Slot %d is corrupted\r\n", i);
+    }
+  }
+
+  if( prev_slot == 0xFF )
+  {
+    ETX_LOG_ERR("No previous application to load\r\n");
+  }
+  else
+  {
+    ETX_LOG_INF("Rolling back to the slot %d...\r\n", prev_slot);
+
+    //run the previous slot and reset other slots
+    for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+    {
+      cfg->slot_table[i].should_we_run_this_fw = ( i == prev_slot ) ? 1u : 0u;
+    }
+  }
 
-      /* write the chunk to the Flash (Slot location) */
-      ex = write_data_to_slot( slot_num_to_write, readBuf, size, is_first_block );
-      if( ex != HAL_OK )
+  return prev_slot;
+}
+
+/**
+  * @brief Install the new bootloader, if it is staged in a slot. The copy is
+  *        done from the RAM and the controller is reset after that. So, this
+  *        returns only if there is nothing to install or on error.
+  * @param none
+  * @retval ETX_OTA_EX_
+  */
+ETX_OTA_EX_ update_bootloader( void )
+{
+  ETX_OTA_EX_                ret = ETX_OTA_EX_ERR;
+  FLASH_OBProgramInitTypeDef ob;
+
+  /* Read the configuration */
+  ETX_GNRL_CFG_ cfg;
+  memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+
+  do
+  {
+    if( cfg.bl_update.state != ETX_BL_UPDATE_PENDING )
+    {
+      //Nothing to install
+      ret = ETX_OTA_EX_OK;
+      break;
+    }
+
+    ETX_LOG_INF("Bootloader update is pending...\r\n");
+
+    HAL_FLASHEx_OBGetConfig( &ob );
+
+    //Are we the new bootloader? Then the copy is done.
+    if( ( cfg.bl_update.size <= ETX_BL_MAX_SIZE ) &&
+        ( HAL_CRC_Calculate( &hcrc, (uint32_t*)ETX_BL_FLASH_ADDR, cfg.bl_update.size ) == cfg.bl_update.crc ) )
+    {
+      ETX_LOG_INF("Bootloader is updated\r\n");
+
+      cfg.bl_update.state = 0u;
+      if( write_cfg_to_flash( &cfg ) == HAL_OK )
       {
-        printf("Flash Erite Error : (%d)\r\n", ex);
-        ret = ETX_SD_EX_FU_ERR;
-        break;
+        ret = ETX_OTA_EX_OK;
       }
-
-      is_first_block = false;
-      i += size;
+      break;
     }
 
-    if( ret == ETX_SD_EX_FU_ERR )
+    //Make sure the staged image is still good before we erase the bootloader
+    uint32_t slot_addr = get_slot_addr( cfg.bl_update.slot_num );
+    if( ( cfg.bl_update.slot_num >= ETX_NO_OF_SLOTS ) ||
+        ( cfg.bl_update.size > ETX_BL_MAX_SIZE )      ||
+        ( HAL_CRC_Calculate( &hcrc, (uint32_t*)slot_addr, cfg.bl_update.size ) != cfg.bl_update.crc ) ||
+        ( !is_valid_bootloader( slot_addr, cfg.bl_update.size ) ) )
     {
-      f_close(&fil);
+      ETX_LOG_ERR("Staged bootloader is corrupted. Dropping it.\r\n");
+      cfg.bl_update.state = 0u;
+      write_cfg_to_flash( &cfg );
       break;
     }
 
-    uint32_t slot_addr;
-    if( slot_num_to_write == 0u )
+    //Remember the boot address. The copy restores it once it is done.
+    if( ob.BootAddr0 != OB_BOOTADDR_SYSTEM )
     {
-      slot_addr = ETX_APP_SLOT0_FLASH_ADDR;
+      cfg.bl_update.boot_addr = ob.BootAddr0;
     }
-    else
+
+    //The copy can't update the counters. Count the erases now.
+    erase_count[FLASH_SECTOR_0]++;
+    erase_count[FLASH_SECTOR_1]++;
+
+    if( write_cfg_to_flash( &cfg ) != HAL_OK )
+    {
+      ETX_LOG_ERR("Config Flash write Error\r\n");
+      break;
+    }
+
+    /*
+     * Boot from the ROM bootloader till the copy is done. If the power fails
+     * in the middle of the copy, the device comes up in the ROM bootloader
+     * and has to be reflashed manually through it (UART/USB DFU).
+     */
+    if( set_boot_addr( OB_BOOTADDR_SYSTEM ) != HAL_OK )
     {
-      slot_addr = ETX_APP_SLOT1_FLASH_ADDR;
+      ETX_LOG_ERR("Option byte write Error\r\n");
+      break;
     }
 
-    //Calculate the CRC
-    uint32_t cal_crc = HAL_CRC_Calculate( &hcrc, (uint32_t*)slot_addr, fw_size);
+    ETX_LOG_INF("Installing the new bootloader (%lu bytes)...\r\n", cfg.bl_update.size);
+    etx_journal_flush();
+    etx_log_deinit();
 
-    /* Read the configuration */
-    memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+    //Nothing in the flash can run from now on
+    __disable_irq();
+    SysTick->CTRL = 0u;
 
-    //update the slot
-    cfg.slot_table[slot_num_to_write].fw_crc                 = cal_crc;
-    cfg.slot_table[slot_num_to_write].fw_size                = fw_size;
-    cfg.slot_table[slot_num_to_write].is_this_slot_not_valid = 0u;
-    cfg.slot_table[slot_num_to_write].should_we_run_this_fw  = 1u;
+    etx_bl_copy( (const uint32_t *)slot_addr, cfg.bl_update.size, cfg.bl_update.boot_addr );
+  }while( false );
 
-    //reset other slots
-    for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  return ret;
+}
+
+/**
+  * @brief Check the SD for Firmware update. If the card has a manifest, the
+  *        images listed in it are installed (see ETX_SD_IMAGE_). Otherwise
+  *        ETX_SD_CARD_FW_PATH is flashed and deleted.
+  * @param none
+  * @retval ETX_SD_EX_
+  */
+ETX_SD_EX_ check_update_frimware_SD_card( void )
+{
+  ETX_SD_EX_  ret = ETX_SD_EX_ERR;
+  FATFS       FatFs;                //Fatfs handle
+  FIL         fil;                  //File handle
+  FRESULT     fres;                 //Result after operations
+
+  do
+  {
+    //Mount the SD Card
+    fres = f_mount(&FatFs, "", 1);    //1=mount now
+    if (fres != FR_OK)
     {
-      if( slot_num_to_write != i )
-      {
-        //update the slot as inactive
-        cfg.slot_table[i].should_we_run_this_fw = 0u;
-      }
+      ETX_LOG_INF("No SD Card found : (%i)\r\n", fres);
+      ret = ETX_SD_EX_NO_SD;
+      break;
     }
+    ETX_LOG_INF("SD Card Mounted Successfully!!!\r\n");
 
-    //update the reboot reason
-    cfg.reboot_cause = ETX_NORMAL_BOOT;
+    //The manifest takes precedence over the plain firmware file
+    if( f_open(&fil, ETX_SD_CARD_MANIFEST_PATH, FA_READ | FA_OPEN_EXISTING) == FR_OK )
+    {
+      ret = sd_update_from_manifest( &fil );
+      break;
+    }
 
-    /* write back the updated config */
-    ex = write_cfg_to_flash( &cfg );
-    if( ex != HAL_OK )
+    fres = f_open(&fil, ETX_SD_CARD_FW_PATH, FA_WRITE | FA_READ | FA_OPEN_EXISTING);
+    if(fres != FR_OK)
+    {
+      ETX_LOG_INF("No Firmware found in SD Card : (%i)\r\n", fres);
+      break;
+    }
+
+    ETX_LOG_INF("Firmware found in SD Card. \r\nFW Size = %lu Bytes\r\n", f_size(&fil));
+
+    //get the slot number
+    uint8_t slot_num = get_available_slot_number();
+    if( slot_num == 0xFF )
     {
-      printf("Flash Erite Error : (%d)\r\n", ex);
+      ETX_LOG_ERR("No slot is available\r\n");
       ret = ETX_SD_EX_FU_ERR;
+      f_close(&fil);
       break;
     }
 
+    meta_info sd_meta;
+    uint32_t  start_tick = HAL_GetTick();
+    HAL_StatusTypeDef ex = sd_flash_image( &fil, slot_num, ETX_SLOT_MAX_SIZE, &sd_meta );
+    etx_journal_update( ETX_JOURNAL_SRC_SD, ETX_OTA_IMAGE_APP, f_size(&fil), start_tick, (uint8_t)ex );
+
     //close your file
     f_close(&fil);
 
+    if( ex == HAL_OK )
+    {
+      //We don't have the header here. Take the version from the image.
+      sd_meta.fw_version = get_fw_version( get_slot_addr( slot_num ), sd_meta.package_size );
+      ex = commit_app_slot( slot_num, &sd_meta );
+    }
+
+    if( ex != HAL_OK )
+    {
+      ret = ETX_SD_EX_FU_ERR;
+      break;
+    }
+
     //Once you flash the file, please delete it.
     fres = f_unlink(ETX_SD_CARD_FW_PATH);
     if (fres != FR_OK)
     {
-      printf("Cannot able to delete the FW file\n");
+      ETX_LOG_ERR("Cannot able to delete the FW file\n");
     }
 
     //update the status okay
@@ -921,82 +1605,1316 @@ ETX_SD_EX_ check_update_frimware_SD_card( void )
   return ret;
 }
 
-
-
 /**
-  * @brief Write the configuration to flash
-  * @param cfg config structure
-  * @retval none
+  * @brief Install an application from the SD card's image store
+  *        (ETX_SD_STORE_INDEX_PATH). The index lists any number of images in
+  *        the manifest format. The image is streamed into the inactive slot
+  *        and checked against its digest. If a slot has it already, that
+  *        slot is just activated.
+  * @param fw_version version to install.
+  *                   0 - newest version that is older than the running one.
+  * @retval ETX_SD_EX_
   */
-static HAL_StatusTypeDef write_cfg_to_flash( ETX_GNRL_CFG_ *cfg )
+ETX_SD_EX_ load_store_app( uint32_t fw_version )
 {
-  HAL_StatusTypeDef ret;
+  ETX_SD_EX_    ret = ETX_SD_EX_ERR;
+  FATFS         FatFs;                //Fatfs handle
+  FIL           fil;                  //File handle
+  FRESULT       fres;                 //Result after operations
+  ETX_SD_IMAGE_ image;
+  ETX_SD_IMAGE_ selected;
+  char          line[ETX_SD_LINE_MAX_LEN];
+  bool          is_found    = false;
+  uint32_t      run_version = 0u;
+
+  //Version of the running app
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    if( cfg_flash->slot_table[i].is_this_slot_active == 1u )
+    {
+      run_version = cfg_flash->slot_table[i].fw_version;
+      break;
+    }
+  }
+
+  ETX_LOG_INF("Looking for the version 0x%06lX in the SD image store...\r\n", fw_version);
 
   do
   {
-    if( cfg == NULL )
+    fres = f_mount(&FatFs, "", 1);    //1=mount now
+    if (fres != FR_OK)
     {
-      ret = HAL_ERROR;
+      ETX_LOG_ERR("No SD Card found : (%i)\r\n", fres);
+      ret = ETX_SD_EX_NO_SD;
       break;
     }
 
-    ret = HAL_FLASH_Unlock();
-    if( ret != HAL_OK )
+    fres = f_open(&fil, ETX_SD_STORE_INDEX_PATH, FA_READ | FA_OPEN_EXISTING);
+    if( fres != FR_OK )
     {
+      ETX_LOG_ERR("No image store in SD Card : (%i)\r\n", fres);
       break;
     }
 
-    //Check if the FLASH_FLAG_BSY.
-    FLASH_WaitForLastOperation( HAL_MAX_DELAY );
+    //One pass over the index. Nothing is kept but the best match.
+    while( f_gets( line, sizeof(line), &fil ) != NULL )
+    {
+      if( ( !sd_parse_image( line, &image ) ) || ( image.image_type != ETX_OTA_IMAGE_APP ) )
+      {
+        continue;
+      }
 
-    //Erase the Flash
-    FLASH_EraseInitTypeDef EraseInitStruct;
-    uint32_t SectorError;
+      if( fw_version != 0u )
+      {
+        if( image.meta.fw_version != fw_version )
+        {
+          continue;
+        }
+      }
+      else if( ( image.meta.fw_version >= run_version ) ||
+               ( ( is_found ) && ( image.meta.fw_version <= selected.meta.fw_version ) ) )
+      {
+        continue;
+      }
 
-    EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
-    EraseInitStruct.Sector        = FLASH_SECTOR_4;
-    EraseInitStruct.NbSectors     = 1;                    //erase only sector 4
-    EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
+      memcpy( &selected, &image, sizeof(ETX_SD_IMAGE_) );
+      is_found = true;
 
-    // clear all flags before you write it to flash
-    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR |
-                FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR);
+      if( fw_version != 0u )
+      {
+        break;
+      }
+    }
+    f_close( &fil );
 
-    ret = HAL_FLASHEx_Erase( &EraseInitStruct, &SectorError );
-    if( ret != HAL_OK )
+    if( !is_found )
     {
+      ETX_LOG_ERR("Version is not found in the image store\r\n");
       break;
     }
 
-    //write the configuration
-    uint8_t *data = (uint8_t *) cfg;
-    for( uint32_t i = 0u; i < sizeof(ETX_GNRL_CFG_); i++ )
+    ETX_LOG_INF("Selected the version 0x%06lX from the image store\r\n", selected.meta.fw_version);
+    ret = sd_install_image( &fil, &selected, true );
+  }while( false );
+
+  if( ret != ETX_SD_EX_NO_SD )
+  {
+    //We're done, so de-mount the drive
+    f_mount(NULL, "", 0);
+  }
+
+  //Don't try again in the next boot
+  if( cfg_flash->reboot_cause != ETX_NORMAL_BOOT )
+  {
+    ETX_GNRL_CFG_ cfg;
+    memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+    cfg.reboot_cause = ETX_NORMAL_BOOT;
+
+    if( write_cfg_to_flash( &cfg ) != HAL_OK )
     {
-      ret = HAL_FLASH_Program( FLASH_TYPEPROGRAM_BYTE,
-                               ETX_CONFIG_FLASH_ADDR + i,
-                               data[i]
-                             );
-      if( ret != HAL_OK )
-      {
-        printf("Slot table Flash Write Error\r\n");
-        break;
-      }
+      ETX_LOG_ERR("Config Flash write Error\r\n");
+      ret = ETX_SD_EX_ERR;
     }
+  }
 
-    //Check if the FLASH_FLAG_BSY.
-    FLASH_WaitForLastOperation( HAL_MAX_DELAY );
+  return ret;
+}
 
-    if( ret != HAL_OK )
+/**
+  * @brief Install the images listed in the SD card's manifest. A new
+  *        bootloader is handled first. Once it is staged, the application is
+  *        left for the next boot, so that the two don't compete for a slot.
+  * @param fil opened manifest. It is closed and reused for the images.
+  * @retval ETX_SD_EX_
+  */
+static ETX_SD_EX_ sd_update_from_manifest( FIL *fil )
+{
+  ETX_SD_IMAGE_ images[ETX_OTA_IMAGE_BOOTLOADER + 1];       //One image of each type
+  bool          is_listed[ETX_OTA_IMAGE_BOOTLOADER + 1] = { false };
+  ETX_SD_IMAGE_ image;
+  char          line[ETX_SD_LINE_MAX_LEN];
+  ETX_SD_EX_    ret = ETX_SD_EX_NO_UPDATE;
+
+  ETX_LOG_INF("Reading the SD card manifest...\r\n");
+
+  while( f_gets( line, sizeof(line), fil ) != NULL )
+  {
+    if( !sd_parse_image( line, &image ) )
     {
-      break;
+      continue;
     }
 
-    ret = HAL_FLASH_Lock();
-    if( ret != HAL_OK )
+    if( is_listed[image.image_type] )
     {
-      break;
+      ETX_LOG_WRN("Only one image of type %lu is supported. Skipping the rest.\r\n", image.image_type);
+      continue;
     }
-  }while( false );
+
+    memcpy( &images[image.image_type], &image, sizeof(ETX_SD_IMAGE_) );
+    is_listed[image.image_type] = true;
+  }
+  f_close( fil );
+
+  if( is_listed[ETX_OTA_IMAGE_BOOTLOADER] )
+  {
+    ret = sd_install_image( fil, &images[ETX_OTA_IMAGE_BOOTLOADER], false );
+    if( ret == ETX_SD_EX_OK )
+    {
+      return ret;
+    }
+  }
+
+  if( is_listed[ETX_OTA_IMAGE_APP] )
+  {
+    ETX_SD_EX_ app_ret = sd_install_image( fil, &images[ETX_OTA_IMAGE_APP], false );
+
+    //Don't hide the bootloader's error if the app is up to date
+    if( app_ret != ETX_SD_EX_NO_UPDATE )
+    {
+      ret = app_ret;
+    }
+  }
 
   return ret;
 }
+
+/**
+  * @brief Install an image listed in the manifest, unless it is already
+  *        installed. The image has to match the manifest's digest. A new
+  *        application is committed for the trial boot and a new bootloader
+  *        is staged for update_bootloader().
+  * @param fil file handle to use
+  * @param image manifest entry
+  * @param is_forced true - the image is requested. Activate the slot that
+  *                  has it or install it again, whatever its version is.
+  * @retval ETX_SD_EX_
+  */
+static ETX_SD_EX_ sd_install_image( FIL *fil, const ETX_SD_IMAGE_ *image, bool is_forced )
+{
+  ETX_SD_EX_        ret   = ETX_SD_EX_FU_ERR;
+  bool              is_bl = ( image->image_type == ETX_OTA_IMAGE_BOOTLOADER );
+  meta_info         meta;
+  meta_info         sd_meta;
+  HAL_StatusTypeDef ex;
+
+  do
+  {
+    if( f_open( fil, image->path, FA_READ | FA_OPEN_EXISTING ) != FR_OK )
+    {
+      ETX_LOG_ERR("Image (type %lu) is not found in SD Card\r\n", image->image_type);
+      ret = ETX_SD_EX_ERR;
+      break;
+    }
+
+    memcpy( &meta, &image->meta, sizeof(meta_info) );
+    meta.package_size = f_size( fil );
+
+    if( ( is_forced ) && ( !is_bl ) )
+    {
+      //Do we have this image already? Then just activate it.
+      uint8_t slot_num = find_slot_with_image( &meta );
+      if( slot_num != 0xFF )
+      {
+        ETX_LOG_INF("Image is already present in the slot %d\r\n", slot_num);
+        ret = ( activate_slot( slot_num ) == ETX_OTA_EX_OK ) ? ETX_SD_EX_OK : ETX_SD_EX_FU_ERR;
+        f_close( fil );
+        break;
+      }
+    }
+    else if( sd_is_installed( image->image_type, &meta ) )
+    {
+      ETX_LOG_INF("Image (type %lu) is up to date\r\n", image->image_type);
+      ret = ETX_SD_EX_NO_UPDATE;
+      f_close( fil );
+      break;
+    }
+
+    //get the slot number
+    uint8_t slot_num = get_available_slot_number();
+    if( slot_num == 0xFF )
+    {
+      ETX_LOG_ERR("No slot is available\r\n");
+      f_close( fil );
+      break;
+    }
+
+    ETX_LOG_INF("Installing the image (type %lu). Version = 0x%06lX, Size = %lu\r\n",
+                image->image_type, meta.fw_version, meta.package_size);
+
+    uint32_t start_tick = HAL_GetTick();
+    ex = sd_flash_image( fil, slot_num, ( is_bl ? ETX_BL_MAX_SIZE : ETX_SLOT_MAX_SIZE ), &sd_meta );
+    etx_journal_update( ETX_JOURNAL_SRC_SD, (uint8_t)image->image_type, meta.package_size,
+                        start_tick, (uint8_t)ex );
+    f_close( fil );
+    if( ex != HAL_OK )
+    {
+      break;
+    }
+
+    //The slot stays invalid if the file is not what the manifest says
+    if( ( memcmp( sd_meta.digest, meta.digest, ETX_DIGEST_SIZE ) != 0 ) ||
+        ( ( meta.package_crc != 0u ) && ( sd_meta.package_crc != meta.package_crc ) ) )
+    {
+      ETX_LOG_ERR("ERROR: FW Digest Mismatch\r\n");
+      etx_journal_count( ETX_JOURNAL_CNT_DIGEST_ERR );
+      break;
+    }
+
+    uint32_t slot_addr = get_slot_addr( slot_num );
+    if( is_bl )
+    {
+      if( !is_valid_bootloader( slot_addr, sd_meta.package_size ) )
+      {
+        ETX_LOG_ERR("ERROR: Not a bootloader image\r\n");
+        break;
+      }
+
+      /* Read the configuration */
+      ETX_GNRL_CFG_ cfg;
+      memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+
+      //The slot is not an app. So, it stays invalid.
+      cfg.bl_update.state    = ETX_BL_UPDATE_PENDING;
+      cfg.bl_update.slot_num = slot_num;
+      cfg.bl_update.size     = sd_meta.package_size;
+      cfg.bl_update.crc      = sd_meta.package_crc;
+
+      ex = write_cfg_to_flash( &cfg );
+    }
+    else
+    {
+      sd_meta.fw_version = meta.fw_version;
+      if( sd_meta.fw_version == 0u )
+      {
+        sd_meta.fw_version = get_fw_version( slot_addr, sd_meta.package_size );
+      }
+      ex = commit_app_slot( slot_num, &sd_meta );
+    }
+
+    if( ex == HAL_OK )
+    {
+      ret = ETX_SD_EX_OK;
+    }
+  }while( false );
+
+  return ret;
+}
+
+/**
+  * @brief Check whether a manifest image has to be installed. An app is
+  *        skipped if a slot still has it (also when it was reverted, so a
+  *        bad image is not installed again) or if it is older than the
+  *        running one. A bootloader is skipped if it is the running one.
+  * @param image_type ETX_OTA_IMAGE_xxx
+  * @param meta image's size, version, digest and CRC (0 if not known)
+  * @retval true - already installed, false - has to be installed
+  */
+static bool sd_is_installed( uint32_t image_type, const meta_info *meta )
+{
+  uint8_t digest[ETX_DIGEST_SIZE];
+
+  if( image_type == ETX_OTA_IMAGE_BOOTLOADER )
+  {
+    if( meta->package_size > ETX_BL_MAX_SIZE )
+    {
+      return false;
+    }
+
+    //The hardware CRC is much quicker than the digest. Use it, if we have it.
+    if( meta->package_crc != 0u )
+    {
+      return ( HAL_CRC_Calculate( &hcrc, (uint32_t*)ETX_BL_FLASH_ADDR, meta->package_size )
+                                                                 == meta->package_crc );
+    }
+
+    etx_sha256( (const uint8_t *)ETX_BL_FLASH_ADDR, meta->package_size, digest );
+    return ( memcmp( digest, meta->digest, ETX_DIGEST_SIZE ) == 0 );
+  }
+
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    ETX_SLOT_ *slot = &cfg_flash->slot_table[i];
+
+    if( ( slot->is_this_slot_not_valid == 0u ) && ( slot->is_this_slot_active == 1u ) &&
+        ( meta->fw_version != 0u ) && ( meta->fw_version < slot->fw_version ) )
+    {
+      ETX_LOG_WRN("Version 0x%06lX is older than the running one\r\n", meta->fw_version);
+      return true;
+    }
+
+    if( ( slot->fw_size != meta->package_size ) ||
+        ( memcmp( slot->digest, meta->digest, ETX_DIGEST_SIZE ) != 0 ) )
+    {
+      continue;
+    }
+
+    /*
+     * An invalid slot keeps the meta of its last image. If the image is
+     * still there, it was reverted. Otherwise the slot has been rewritten.
+     */
+    if( HAL_CRC_Calculate( &hcrc, (uint32_t*)get_slot_addr( i ), slot->fw_size ) == slot->fw_crc )
+    {
+      if( slot->is_this_slot_not_valid != 0u )
+      {
+        ETX_LOG_WRN("Image was reverted from the slot %d before\r\n", i);
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+  * @brief Parse a manifest line (see ETX_SD_IMAGE_).
+  * @param line manifest line. It is modified.
+  * @param image parsed image
+  * @retval true - image is found, false - comment, blank or bad line
+  */
+static bool sd_parse_image( char *line, ETX_SD_IMAGE_ *image )
+{
+  char    *type    = sd_next_token( &line );
+  char    *path    = sd_next_token( &line );
+  char    *version = sd_next_token( &line );
+  char    *digest  = sd_next_token( &line );
+  char    *crc     = sd_next_token( &line );
+  uint8_t  crc_bytes[4];
+  uint32_t fw_version;
+
+  if( ( type == NULL ) || ( type[0] == '#' ) )
+  {
+    return false;
+  }
+
+  memset( image, 0, sizeof(ETX_SD_IMAGE_) );
+
+  if( !strcmp( type, "app" ) )
+  {
+    image->image_type = ETX_OTA_IMAGE_APP;
+  }
+  else if( !strcmp( type, "bootloader" ) )
+  {
+    image->image_type = ETX_OTA_IMAGE_BOOTLOADER;
+  }
+  else
+  {
+    ETX_LOG_WRN("Unknown image type in the manifest\r\n");
+    return false;
+  }
+
+  //CRC is optional. Accept it with or without 0x.
+  if( ( crc != NULL ) && ( crc[0] == '0' ) && ( ( crc[1] == 'x' ) || ( crc[1] == 'X' ) ) )
+  {
+    crc += 2;
+  }
+
+  if( ( path == NULL ) || ( strlen( path ) >= ETX_SD_PATH_MAX_LEN )                     ||
+      ( version == NULL ) || ( !sd_parse_version( version, &fw_version ) )                ||
+      ( digest == NULL ) || ( !sd_parse_hex( digest, image->meta.digest, ETX_DIGEST_SIZE ) ) ||
+      ( ( crc != NULL ) && ( !sd_parse_hex( crc, crc_bytes, sizeof(crc_bytes) ) ) ) )
+  {
+    ETX_LOG_WRN("Bad line in the manifest\r\n");
+    return false;
+  }
+
+  strcpy( image->path, path );
+  image->meta.fw_version = fw_version;
+  if( crc != NULL )
+  {
+    image->meta.package_crc = ( (uint32_t)crc_bytes[0] << 24 ) | ( (uint32_t)crc_bytes[1] << 16 ) |
+                              ( (uint32_t)crc_bytes[2] << 8 )  |   (uint32_t)crc_bytes[3];
+  }
+
+  return true;
+}
+
+/**
+  * @brief Split the next space separated token from a manifest line.
+  * @param line current position in the line. It is moved past the token.
+  * @retval token (NULL if there are no more tokens)
+  */
+static char *sd_next_token( char **line )
+{
+  char *c = *line;
+  char *token;
+
+  while( ( *c == ' ' ) || ( *c == '\t' ) )
+  {
+    c++;
+  }
+
+  if( ( *c == '\0' ) || ( *c == '\r' ) || ( *c == '\n' ) )
+  {
+    *line = c;
+    return NULL;
+  }
+
+  token = c;
+  while( ( *c != '\0' ) && ( *c != ' ' ) && ( *c != '\t' ) && ( *c != '\r' ) && ( *c != '\n' ) )
+  {
+    c++;
+  }
+
+  if( *c != '\0' )
+  {
+    *c++ = '\0';
+  }
+  *line = c;
+
+  return token;
+}
+
+/**
+  * @brief Parse a version string (major.minor.patch).
+  * @param str version string
+  * @param version parsed version (ETX_FW_VERSION)
+  * @retval true - OK, false - bad version
+  */
+static bool sd_parse_version( const char *str, uint32_t *version )
+{
+  uint32_t field[3] = { 0u, 0u, 0u };
+  uint8_t  n        = 0u;
+
+  for( ; *str != '\0'; str++ )
+  {
+    if( ( *str == '.' ) && ( n < 2u ) )
+    {
+      n++;
+    }
+    else if( ( *str >= '0' ) && ( *str <= '9' ) && ( field[n] < 256u ) )
+    {
+      field[n] = ( field[n] * 10u ) + (uint32_t)( *str - '0' );
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  if( ( n != 2u ) || ( field[0] > 255u ) || ( field[1] > 255u ) || ( field[2] > 255u ) )
+  {
+    return false;
+  }
+
+  *version = ETX_FW_VERSION( field[0], field[1], field[2] );
+  return true;
+}
+
+/**
+  * @brief Parse a hex string of the exact length.
+  * @param str hex string
+  * @param out parsed bytes
+  * @param len number of bytes
+  * @retval true - OK, false - bad string
+  */
+static bool sd_parse_hex( const char *str, uint8_t *out, uint32_t len )
+{
+  for( uint32_t i = 0u; i < ( len * 2u ); i++ )
+  {
+    char    c = str[i];
+    uint8_t nibble;
+
+    if( ( c >= '0' ) && ( c <= '9' ) )
+    {
+      nibble = (uint8_t)( c - '0' );
+    }
+    else if( ( c >= 'a' ) && ( c <= 'f' ) )
+    {
+      nibble = (uint8_t)( c - 'a' + 10 );
+    }
+    else if( ( c >= 'A' ) && ( c <= 'F' ) )
+    {
+      nibble = (uint8_t)( c - 'A' + 10 );
+    }
+    else
+    {
+      return false;
+    }
+
+    out[i / 2u] = ( i & 1u ) ? (uint8_t)( out[i / 2u] | nibble ) : (uint8_t)( nibble << 4 );
+  }
+
+  return ( str[len * 2u] == '\0' );
+}
+
+/**
+  * @brief Flash an image from the SD card to a slot. The slot is invalidated
+  *        and erased first. The digest and the CRC of the image are
+  *        calculated from the chunks read from the SD card. The flash is
+  *        checked against the CRC at the end.
+  * @param fil opened image file
+  * @param slot_num slot number
+  * @param max_size max image size
+  * @param meta image's size, CRC and digest (rest is cleared)
+  * @retval HAL_StatusTypeDef
+  */
+static HAL_StatusTypeDef sd_flash_image( FIL *fil, uint8_t slot_num, uint32_t max_size, meta_info *meta )
+{
+  HAL_StatusTypeDef ex        = HAL_ERROR;
+  uint32_t          fw_size   = f_size( fil );
+  uint32_t          slot_addr = get_slot_addr( slot_num );
+  uint32_t          offset    = 0u;
+  uint32_t          crc       = 0u;
+  uint32_t          size;
+  uint32_t          tick;
+  FRESULT           fres;
+  ETX_SHA256_CTX_   sha;
+
+  memset( meta, 0, sizeof(meta_info) );
+
+  do
+  {
+    if( ( fw_size == 0u ) || ( fw_size > max_size ) )
+    {
+      ETX_LOG_ERR("FW Size Error : (%lu)\r\n", fw_size);
+      break;
+    }
+
+    /*
+     * Map the file's cluster chain. The reads can then go straight to the
+     * disk, one multi sector read for each contiguous run of clusters.
+     */
+    sd_clmt[0] = ETX_SD_CLMT_SIZE;
+    fil->cltbl = sd_clmt;
+    if( f_lseek(fil, CREATE_LINKMAP) == FR_OK )
+    {
+      //FatFs puts the number of used items (2 + 2 per fragment) in the first entry
+      ETX_LOG_INF("FW file fragments : %lu\r\n", ( sd_clmt[0] - 2u ) / 2u );
+    }
+    else
+    {
+      //Too fragmented for the table. Read through FatFs.
+      fil->cltbl = NULL;
+    }
+
+    /* Read the configuration */
+    ETX_GNRL_CFG_ cfg;
+    memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+
+    /* Before writing the data, reset the available slot */
+    cfg.slot_table[slot_num].is_this_slot_not_valid = 1u;
+
+    /* write back the updated config */
+    ex = write_cfg_to_flash( &cfg );
+    if( ex != HAL_OK )
+    {
+      break;
+    }
+
+    /* Erase the whole slot once */
+    ETX_LOG_INF("Erasing the Slot %d Flash memory...\r\n", slot_num);
+    ex = HAL_FLASH_Unlock();
+    if( ex == HAL_OK )
+    {
+      ex = erase_sectors( get_slot_sector( slot_num ), 2 );
+      HAL_FLASH_Lock();
+    }
+    if( ex != HAL_OK )
+    {
+      ETX_LOG_ERR("Flash Erase Error\r\n");
+      break;
+    }
+    save_erase_count();
+
+    tick = HAL_GetTick();
+
+    /*
+     * Read a chunk with raw multi sector reads (see sd_read_chunk()), hash it
+     * and program it. The code runs from the single bank flash, so nothing
+     * can run while a word is programmed. Hence, it is done one after the
+     * other.
+     */
+    etx_sha256_init( &sha );
+
+    ex = HAL_FLASH_Unlock();
+    while( ( ex == HAL_OK ) && ( offset < fw_size ) )
+    {
+      size = ( ( fw_size - offset ) < ETX_SD_CHUNK_SIZE ) ? ( fw_size - offset ) : ETX_SD_CHUNK_SIZE;
+      fres = sd_read_chunk( fil, offset, sd_buf, size );
+      if( fres != FR_OK )
+      {
+        ETX_LOG_ERR("FW Read Error : (%i)\r\n", fres);
+        etx_journal_count( ETX_JOURNAL_CNT_SD_ERR );
+        ex = HAL_ERROR;
+        break;
+      }
+
+      etx_sha256_update( &sha, sd_buf, size );
+      if( offset == 0u )
+      {
+        crc = HAL_CRC_Calculate( &hcrc, (uint32_t *)sd_buf, size );
+      }
+      else
+      {
+        crc = HAL_CRC_Accumulate( &hcrc, (uint32_t *)sd_buf, size );
+      }
+
+      //pad the last word of the image
+      uint32_t words = ( size + 3u ) / 4u;
+      memset( &sd_buf[size], 0xFF, ( words * 4u ) - size );
+
+      for( uint32_t i = 0u; i < words; i++ )
+      {
+        ex = HAL_FLASH_Program( FLASH_TYPEPROGRAM_WORD, ( slot_addr + offset + ( i * 4u ) ),
+                                ((const uint32_t *)sd_buf)[i] );
+        if( ex != HAL_OK )
+        {
+          ETX_LOG_ERR("Flash Write Error : (%d)\r\n", ex);
+          etx_journal_count( ETX_JOURNAL_CNT_FLASH_ERR );
+          break;
+        }
+      }
+
+      offset += size;
+    }
+    HAL_FLASH_Lock();
+
+    if( ex != HAL_OK )
+    {
+      break;
+    }
+
+    ETX_LOG_INF("Read and programmed %lu bytes in %lu ms\r\n", fw_size, HAL_GetTick() - tick);
+
+    //Make sure the flash has what we have read
+    if( HAL_CRC_Calculate( &hcrc, (uint32_t*)slot_addr, fw_size ) != crc )
+    {
+      ETX_LOG_ERR("Flash Verify Error\r\n");
+      ex = HAL_ERROR;
+      break;
+    }
+
+    meta->package_size = fw_size;
+    meta->package_crc  = crc;
+    etx_sha256_final( &sha, meta->digest );
+  }while( false );
+
+  return ex;
+}
+
+/**
+  * @brief Mark the freshly written slot as valid and run it in the trial
+  *        state from the next boot. Other slots are made inactive.
+  * @param slot_num slot number
+  * @param meta image's size, CRC, version, build ID and digest
+  * @retval HAL_StatusTypeDef
+  */
+static HAL_StatusTypeDef commit_app_slot( uint8_t slot_num, const meta_info *meta )
+{
+  HAL_StatusTypeDef ex;
+
+  /* Read the configuration */
+  ETX_GNRL_CFG_ cfg;
+  memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+
+  //update the slot
+  cfg.slot_table[slot_num].fw_crc                 = meta->package_crc;
+  cfg.slot_table[slot_num].fw_size                = meta->package_size;
+  cfg.slot_table[slot_num].fw_version             = meta->fw_version;
+  cfg.slot_table[slot_num].build_id               = meta->build_id;
+  cfg.slot_table[slot_num].is_this_slot_not_valid = 0u;
+  cfg.slot_table[slot_num].should_we_run_this_fw  = 1u;
+  cfg.slot_table[slot_num].trial_state            = ETX_SLOT_TRIAL;
+  cfg.slot_table[slot_num].boot_attempts          = 0u;
+  memcpy( cfg.slot_table[slot_num].digest, meta->digest, ETX_DIGEST_SIZE );
+
+  //reset other slots
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    if( slot_num != i )
+    {
+      //update the slot as inactive
+      cfg.slot_table[i].should_we_run_this_fw = 0u;
+    }
+  }
+
+  //update the reboot reason
+  cfg.reboot_cause = ETX_NORMAL_BOOT;
+
+  /* write back the updated config */
+  ex = write_cfg_to_flash( &cfg );
+  if( ex != HAL_OK )
+  {
+    ETX_LOG_ERR("Config Flash write Error\r\n");
+  }
+
+  return ex;
+}
+
+
+
+/**
+  * @brief Find the latest configuration record and the next free record in
+  *        the config sector. This has to be called before using the config.
+  * @param none
+  * @retval none
+  */
+void load_config( void )
+{
+  //Erased sector or the old layout (config at the start of the sector)
+  cfg_flash       = (ETX_GNRL_CFG_*) (ETX_CONFIG_FLASH_ADDR);
+  cfg_next_offset = ETX_CONFIG_SECTOR_SIZE;
+
+  for( uint32_t offset = 0u;
+       ( offset + ETX_CFG_RECORD_SIZE ) <= ETX_CONFIG_SECTOR_SIZE;
+       offset += ETX_CFG_RECORD_SIZE )
+  {
+    ETX_CFG_RECORD_ *rec = (ETX_CFG_RECORD_ *)( ETX_CONFIG_FLASH_ADDR + offset );
+
+    if( rec->magic == ETX_CFG_RECORD_MAGIC )
+    {
+      cfg_flash = &rec->cfg;
+    }
+    else if( is_erased( (uint32_t)rec, ETX_CFG_RECORD_SIZE ) )
+    {
+      //Records are only appended. So, rest of the sector is free.
+      cfg_next_offset = offset;
+      break;
+    }
+    //else: the write was interrupted. Skip it.
+  }
+
+  //Counters read as 0xFFFFFFFF till they are written for the first time
+  for( uint32_t i = 0u; i < ETX_NO_OF_SECTORS; i++ )
+  {
+    erase_count[i] = ( cfg_flash->erase_count[i] == 0xFFFFFFFF ) ? 0u : cfg_flash->erase_count[i];
+  }
+
+  ETX_LOG_DBG("Config record at 0x%08lX, %lu bytes free\r\n", (uint32_t)cfg_flash,
+                                        ETX_CONFIG_SECTOR_SIZE - cfg_next_offset);
+}
+
+/**
+  * @brief Write the configuration to flash. The config is appended to the
+  *        config sector. The sector is erased only when it is full.
+  * @param cfg config structure
+  * @retval none
+  */
+static HAL_StatusTypeDef write_cfg_to_flash( ETX_GNRL_CFG_ *cfg )
+{
+  HAL_StatusTypeDef ret;
+  ETX_CFG_RECORD_   rec;
+
+  do
+  {
+    if( cfg == NULL )
+    {
+      ret = HAL_ERROR;
+      break;
+    }
+
+    //The erase counters are kept here. Not in the caller's copy.
+    memcpy( &rec.cfg, cfg, sizeof(ETX_GNRL_CFG_) );
+    rec.magic = ETX_CFG_RECORD_MAGIC;
+
+    ret = HAL_FLASH_Unlock();
+    if( ret != HAL_OK )
+    {
+      break;
+    }
+
+    //Check if the FLASH_FLAG_BSY.
+    FLASH_WaitForLastOperation( HAL_MAX_DELAY );
+
+    // clear all flags before you write it to flash
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR |
+                FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR);
+
+    if( ( cfg_next_offset + ETX_CFG_RECORD_SIZE ) > ETX_CONFIG_SECTOR_SIZE )
+    {
+      //Config sector is full. Start over.
+      ETX_LOG_INF("Erasing the Config Flash memory...\r\n");
+      ret = erase_sectors( FLASH_SECTOR_4, 1 );
+      if( ret != HAL_OK )
+      {
+        break;
+      }
+      cfg_next_offset = 0u;
+    }
+    memcpy( rec.cfg.erase_count, erase_count, sizeof(erase_count) );
+
+    uint32_t rec_addr = ETX_CONFIG_FLASH_ADDR + cfg_next_offset;
+
+    //Don't use this record again, even if the write fails
+    cfg_next_offset += ETX_CFG_RECORD_SIZE;
+
+    //write the configuration
+    uint8_t *data = (uint8_t *) &rec.cfg;
+    for( uint32_t i = 0u; i < sizeof(ETX_GNRL_CFG_); i++ )
+    {
+      ret = HAL_FLASH_Program( FLASH_TYPEPROGRAM_BYTE,
+                               rec_addr + sizeof(rec.magic) + i,
+                               data[i]
+                             );
+      if( ret != HAL_OK )
+      {
+        ETX_LOG_ERR("Slot table Flash Write Error\r\n");
+        break;
+      }
+    }
+
+    //write the magic at the end. Now the record is valid.
+    if( ret == HAL_OK )
+    {
+      ret = HAL_FLASH_Program( FLASH_TYPEPROGRAM_WORD, rec_addr, rec.magic );
+    }
+
+    //Check if the FLASH_FLAG_BSY.
+    FLASH_WaitForLastOperation( HAL_MAX_DELAY );
+
+    if( ret != HAL_OK )
+    {
+      break;
+    }
+
+    cfg_flash = &( (ETX_CFG_RECORD_ *)rec_addr )->cfg;
+
+    ret = HAL_FLASH_Lock();
+    if( ret != HAL_OK )
+    {
+      break;
+    }
+  }while( false );
+
+  return ret;
+}
+
+/**
+  * @brief Erase the flash sectors and count the erases. The flash has to be
+  *        unlocked by the caller. The counters are saved with the next config
+  *        write (see save_erase_count()).
+  * @param sector first sector to be erased
+  * @param nb_sectors number of sectors to be erased
+  * @retval HAL_StatusTypeDef
+  */
+static HAL_StatusTypeDef erase_sectors( uint32_t sector, uint32_t nb_sectors )
+{
+  HAL_StatusTypeDef      ret;
+  FLASH_EraseInitTypeDef EraseInitStruct;
+  uint32_t               SectorError = 0xFFFFFFFF;
+
+  EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
+  EraseInitStruct.Sector        = sector;
+  EraseInitStruct.NbSectors     = nb_sectors;
+  EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
+
+  ret = HAL_FLASHEx_Erase( &EraseInitStruct, &SectorError );
+  if( ret != HAL_OK )
+  {
+    etx_journal_count( ETX_JOURNAL_CNT_FLASH_ERR );
+  }
+
+  //Count the sectors that are erased (SectorError is the failed one)
+  for( uint32_t i = sector; ( i < ( sector + nb_sectors ) ) && ( i < ETX_NO_OF_SECTORS ); i++ )
+  {
+    if( ( ret == HAL_OK ) || ( i < SectorError ) )
+    {
+      erase_count[i]++;
+    }
+  }
+
+  return ret;
+}
+
+/**
+  * @brief Save the erase counters (with the current config).
+  * @param none
+  * @retval none
+  */
+static void save_erase_count( void )
+{
+  ETX_GNRL_CFG_ cfg;
+  memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+
+  if( write_cfg_to_flash( &cfg ) != HAL_OK )
+  {
+    ETX_LOG_ERR("Config Flash write Error\r\n");
+  }
+}
+
+/**
+  * @brief Check the flash is erased.
+  * @param addr start address
+  * @param size size in bytes (multiple of 4)
+  * @retval true - erased, false - not erased
+  */
+static bool is_erased( uint32_t addr, uint32_t size )
+{
+  for( uint32_t i = 0u; i < size; i += 4u )
+  {
+    if( *(volatile uint32_t *)( addr + i ) != 0xFFFFFFFF )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+  * @brief Read a chunk of the firmware file from the SD card. With the cluster
+  *        link map, the sectors are read straight from the disk with one
+  *        multi sector read for each contiguous run of clusters. So, a
+  *        contiguous file takes one disk_read() per chunk.
+  * @param fil firmware file
+  * @param offset file offset (multiple of the sector size)
+  * @param buf buffer (room for whole sectors)
+  * @param len number of bytes to read
+  * @retval FRESULT
+  */
+static FRESULT sd_read_chunk( FIL *fil, uint32_t offset, uint8_t *buf, uint32_t len )
+{
+  FATFS    *fs = fil->obj.fs;
+  DWORD    *tbl;
+  uint32_t  clst, sect, nb_sect, cnt;
+
+  if( fil->cltbl == NULL )
+  {
+    UINT    br;
+    FRESULT fres = f_read( fil, buf, len, &br );
+    return ( ( fres == FR_OK ) && ( br != len ) ) ? FR_INT_ERR : fres;
+  }
+
+  clst    = offset / ( fs->csize * _MIN_SS );           //cluster index in the file
+  sect    = ( offset / _MIN_SS ) % fs->csize;           //sector in the cluster
+  nb_sect = ( len + _MIN_SS - 1u ) / _MIN_SS;
+
+  //find the run (fragment) holding the offset. Each entry is {length, start cluster}.
+  tbl = &fil->cltbl[1];
+  while( ( tbl[0] != 0u ) && ( clst >= tbl[0] ) )
+  {
+    clst -= tbl[0];
+    tbl  += 2;
+  }
+
+  while( nb_sect != 0u )
+  {
+    if( tbl[0] == 0u )
+    {
+      return FR_INT_ERR;                                //beyond the end of the chain
+    }
+
+    cnt = ( ( tbl[0] - clst ) * fs->csize ) - sect;     //sectors left in this run
+    if( cnt > nb_sect )
+    {
+      cnt = nb_sect;
+    }
+
+    if( disk_read( fs->drv, buf, fs->database + ( ( tbl[1] - 2u + clst ) * fs->csize ) + sect, cnt ) != RES_OK )
+    {
+      return FR_DISK_ERR;
+    }
+
+    buf     += cnt * _MIN_SS;
+    nb_sect -= cnt;
+    clst     = 0u;
+    sect     = 0u;
+    tbl     += 2;
+  }
+
+  return FR_OK;
+}
+
+/**
+  * @brief Return the slot's flash address
+  * @param slot_num slot number
+  * @retval slot address
+  */
+static uint32_t get_slot_addr( uint8_t slot_num )
+{
+  if( slot_num == 0u )
+  {
+    return ETX_APP_SLOT0_FLASH_ADDR;
+  }
+  return ETX_APP_SLOT1_FLASH_ADDR;
+}
+
+/**
+  * @brief Return the slot's first flash sector. Each slot has 2 sectors.
+  * @param slot_num slot number
+  * @retval sector number
+  */
+static uint32_t get_slot_sector( uint8_t slot_num )
+{
+  if( slot_num == 0u )
+  {
+    return FLASH_SECTOR_7;
+  }
+  return FLASH_SECTOR_9;
+}
+
+/**
+  * @brief Start the independent watchdog. Once started, it can't be stopped
+  *        (until the next reset). So, the app has to refresh it.
+  * @param timeout_ms watchdog timeout in ms
+  * @retval none
+  */
+static void etx_iwdg_start( uint32_t timeout_ms )
+{
+  /* LSI (32KHz) / 256 = 125Hz */
+  uint32_t reload = ( timeout_ms * ( ETX_LSI_FREQ / 256u ) ) / 1000u;
+
+  if( reload > IWDG_RLR_RL )
+  {
+    reload = IWDG_RLR_RL;
+  }
+
+  IWDG->KR  = 0xCCCC;             //Start the watchdog (also starts the LSI)
+  IWDG->KR  = 0x5555;             //Enable the write access to PR and RLR
+  IWDG->PR  = IWDG_PR_PR_2 | IWDG_PR_PR_1;    //Prescaler /256
+  IWDG->RLR = reload;
+
+  //Wait for the registers to be updated
+  while( IWDG->SR != 0u );
+
+  IWDG->KR  = 0xAAAA;             //Refresh
+}
+
+/**
+  * @brief Find the valid slot that has the same image.
+  * @param meta meta info of the incoming image
+  * @retval slot number (0xFF if not found)
+  */
+static uint8_t find_slot_with_image( const meta_info *meta )
+{
+  uint8_t slot_number = 0xFF;
+
+  //We can't match an image without the digest. CRC is optional (0 - not known).
+  if( etx_sha256_is_empty( meta->digest ) )
+  {
+    return slot_number;
+  }
+
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    ETX_SLOT_ *slot = &cfg_flash->slot_table[i];
+
+    if( ( slot->is_this_slot_not_valid != 0u )           ||
+        ( slot->fw_size != meta->package_size )          ||
+        ( ( meta->package_crc != 0u ) && ( slot->fw_crc != meta->package_crc ) ) ||
+        ( memcmp( slot->digest, meta->digest, ETX_DIGEST_SIZE ) != 0 ) )
+    {
+      continue;
+    }
+
+    //Make sure the slot is not corrupted after it was written
+    uint32_t cal_crc = HAL_CRC_Calculate( &hcrc, (uint32_t*)get_slot_addr( i ), slot->fw_size );
+    if( cal_crc == slot->fw_crc )
+    {
+      slot_number = i;
+      break;
+    }
+  }
+
+  return slot_number;
+}
+
+/**
+  * @brief Mark the slot to run in the next boot.
+  * @param slot_num slot number
+  * @retval ETX_OTA_EX_
+  */
+static ETX_OTA_EX_ activate_slot( uint8_t slot_num )
+{
+  /* Read the configuration */
+  ETX_GNRL_CFG_ cfg;
+  memcpy( &cfg, cfg_flash, sizeof(ETX_GNRL_CFG_) );
+
+  //run this slot and reset other slots
+  for( uint8_t i = 0; i < ETX_NO_OF_SLOTS; i++ )
+  {
+    cfg.slot_table[i].should_we_run_this_fw = ( i == slot_num ) ? 1u : 0u;
+  }
+
+  //update the reboot reason
+  cfg.reboot_cause = ETX_NORMAL_BOOT;
+
+  /* write back the updated config */
+  if( write_cfg_to_flash( &cfg ) != HAL_OK )
+  {
+    ETX_LOG_ERR("Config Flash write Error\r\n");
+    return ETX_OTA_EX_ERR;
+  }
+
+  return ETX_OTA_EX_OK;
+}
+
+/**
+  * @brief Update the slot's version, build ID and digest.
+  *        The digest is always calculated from the slot's content.
+  * @param slot slot entry (in RAM) to be updated
+  * @param slot_addr slot's flash address
+  * @param meta meta info of the image
+  * @retval none
+  */
+static void update_slot_meta( ETX_SLOT_ *slot, uint32_t slot_addr, const meta_info *meta )
+{
+  uint8_t digest[ETX_DIGEST_SIZE];
+
+  ETX_LOG_INF("Calculating the digest...\r\n");
+  etx_sha256( (const uint8_t *)slot_addr, meta->package_size, digest );
+
+  slot->fw_version = meta->fw_version;
+  slot->build_id   = meta->build_id;
+  memcpy( slot->digest, digest, ETX_DIGEST_SIZE );
+}
+
+/**
+  * @brief Find the firmware version from the image descriptor (ETX_APP_DESC_).
+  * @param addr image address
+  * @param size image size
+  * @retval firmware version (0 if not found)
+  */
+static uint32_t get_fw_version( uint32_t addr, uint32_t size )
+{
+  for( uint32_t i = 0u; ( i + sizeof(ETX_APP_DESC_) ) <= size; i += 4u )
+  {
+    ETX_APP_DESC_ *desc = (ETX_APP_DESC_ *)( addr + i );
+    if( desc->magic == ETX_APP_DESC_MAGIC )
+    {
+      return desc->fw_version;
+    }
+  }
+  return 0u;
+}
+
+/**
+  * @brief Sanity check the bootloader image's vector table.
+  * @param addr image address
+  * @param size image size
+  * @retval true - looks like a bootloader, false - not a bootloader
+  */
+static bool is_valid_bootloader( uint32_t addr, uint32_t size )
+{
+  uint32_t sp    = *(volatile uint32_t *)addr;
+  uint32_t reset = *(volatile uint32_t *)( addr + 4u );
+
+  return ( ( size >= 8u ) && ( size <= ETX_BL_MAX_SIZE )           &&
+           ( sp > RAMDTCM_BASE ) && ( sp <= ( RAMDTCM_BASE + ETX_RAM_SIZE ) ) &&
+           ( reset >= ETX_BL_FLASH_ADDR ) && ( reset < ( ETX_BL_FLASH_ADDR + size ) ) &&
+           ( ( reset & 1u ) != 0u ) );
+}
+
+/**
+  * @brief Set the boot address (BOOT_ADD0 option byte). It is used from the
+  *        next reset.
+  * @param boot_addr boot address (OB_BOOTADDR_xxx)
+  * @retval HAL_StatusTypeDef
+  */
+static HAL_StatusTypeDef set_boot_addr( uint32_t boot_addr )
+{
+  FLASH_OBProgramInitTypeDef ob = { 0 };
+  HAL_StatusTypeDef          ret;
+
+  ob.OptionType = OPTIONBYTE_BOOTADDR_0;
+  ob.BootAddr0  = boot_addr;
+
+  do
+  {
+    ret = HAL_FLASH_OB_Unlock();
+    if( ret != HAL_OK )
+    {
+      break;
+    }
+
+    ret = HAL_FLASHEx_OBProgram( &ob );
+    if( ret == HAL_OK )
+    {
+      ret = HAL_FLASH_OB_Launch();
+    }
+
+    HAL_FLASH_OB_Lock();
+  }while( false );
+
+  return ret;
+}
+
+/**
+  * @brief Copy the new bootloader over the bootloader's flash (sector 0 and 1),
+  *        restore the boot address and reset. This runs from the RAM with the
+  *        interrupts disabled, because the flash code is erased underneath.
+  *        So, it must not call anything that lives in the flash.
+  * @param src new bootloader's address (in the slot)
+  * @param size new bootloader's size
+  * @param boot_addr BOOT_ADD0 option byte to restore
+  * @retval none (resets the controller)
+  */
+static __RAM_FUNC void etx_bl_copy( const uint32_t *src, uint32_t size, uint32_t boot_addr )
+{
+  volatile uint32_t *dst    = (volatile uint32_t *)ETX_BL_FLASH_ADDR;
+  uint32_t           words  = ( size + 3u ) / 4u;
+  uint32_t           errors = FLASH_SR_OPERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR |
+                              FLASH_SR_PGPERR | FLASH_SR_ERSERR;
+  bool               is_ok  = false;
+
+  //Unlock the flash
+  FLASH->KEYR = FLASH_KEY1;
+  FLASH->KEYR = FLASH_KEY2;
+
+  for( uint32_t retry = 0u; ( retry < ETX_BL_COPY_RETRIES ) && ( !is_ok ); retry++ )
+  {
+    is_ok = true;
+
+    //Erase the sector 0 and 1
+    for( uint32_t sector = 0u; sector < 2u; sector++ )
+    {
+      while( FLASH->SR & FLASH_SR_BSY );
+      FLASH->SR  = FLASH_SR_EOP | errors;
+      FLASH->CR  = FLASH_CR_PSIZE_1 | FLASH_CR_SER | ( sector << FLASH_CR_SNB_Pos );
+      FLASH->CR |= FLASH_CR_STRT;
+      __DSB();
+      while( FLASH->SR & FLASH_SR_BSY )
+      {
+        IWDG->KR = 0xAAAA;    //in case the watchdog is running
+      }
+    }
+
+    //Program word by word
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+    for( uint32_t i = 0u; i < words; i++ )
+    {
+      dst[i] = src[i];
+      __DSB();
+      while( FLASH->SR & FLASH_SR_BSY );
+    }
+    FLASH->CR = 0u;
+
+    if( FLASH->SR & errors )
+    {
+      is_ok = false;
+      continue;
+    }
+
+    //Verify
+    for( uint32_t i = 0u; i < words; i++ )
+    {
+      if( dst[i] != src[i] )
+      {
+        is_ok = false;
+        break;
+      }
+    }
+  }
+
+  if( is_ok )
+  {
+    //Boot from the flash again
+    FLASH->OPTKEYR = FLASH_OPT_KEY1;
+    FLASH->OPTKEYR = FLASH_OPT_KEY2;
+    FLASH->OPTCR1  = ( FLASH->OPTCR1 & ~FLASH_OPTCR1_BOOT_ADD0 ) |
+                     ( boot_addr & FLASH_OPTCR1_BOOT_ADD0 );
+    FLASH->OPTCR  |= FLASH_OPTCR_OPTSTRT;
+    __DSB();
+    while( FLASH->SR & FLASH_SR_BSY );
+    FLASH->OPTCR  |= FLASH_OPTCR_OPTLOCK;
+  }
+  //else: stay with the ROM bootloader. The device can be recovered through it.
+
+  FLASH->CR |= FLASH_CR_LOCK;
+
+  //Reset
+  SCB->AIRCR = ( 0x5FAUL << SCB_AIRCR_VECTKEY_Pos )      |
+               ( SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk ) |
+               SCB_AIRCR_SYSRESETREQ_Msk;
+  __DSB();
+  while( true );
+}
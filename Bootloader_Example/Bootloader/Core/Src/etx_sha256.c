@@ -0,0 +1,203 @@
+/*
+ * etx_sha256.c
+ *
+ *  Created on: 18-Oct-2026
+ *      Author: EmbeTronicX
+ */
+
+#include <string.h>
+#include "etx_sha256.h"
+
+#define ROTR( x, n )  ( ( (x) >> (n) ) | ( (x) << ( 32u - (n) ) ) )
+
+static const uint32_t sha256_k[64] =
+{
+  0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+  0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+  0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+  0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+  0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+  0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+  0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+  0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static void sha256_transform( uint32_t *state, const uint8_t *block );
+
+/**
+  * @brief Initialize the SHA-256 context.
+  * @param ctx SHA-256 context
+  * @retval None
+  */
+void etx_sha256_init( ETX_SHA256_CTX_ *ctx )
+{
+  ctx->state[0]  = 0x6A09E667;
+  ctx->state[1]  = 0xBB67AE85;
+  ctx->state[2]  = 0x3C6EF372;
+  ctx->state[3]  = 0xA54FF53A;
+  ctx->state[4]  = 0x510E527F;
+  ctx->state[5]  = 0x9B05688C;
+  ctx->state[6]  = 0x1F83D9AB;
+  ctx->state[7]  = 0x5BE0CD19;
+  ctx->total_len = 0u;
+  ctx->block_len = 0u;
+}
+
+/**
+  * @brief Add the data to the SHA-256 calculation.
+  * @param ctx SHA-256 context
+  * @param data data
+  * @param len data length
+  * @retval None
+  */
+void etx_sha256_update( ETX_SHA256_CTX_ *ctx, const uint8_t *data, uint32_t len )
+{
+  ctx->total_len += len;
+
+  //Fill the partial block first
+  if( ctx->block_len != 0u )
+  {
+    uint32_t copy = ETX_SHA256_BLOCK_SIZE - ctx->block_len;
+    if( copy > len )
+    {
+      copy = len;
+    }
+    memcpy( &ctx->block[ctx->block_len], data, copy );
+    ctx->block_len += copy;
+    data           += copy;
+    len            -= copy;
+
+    if( ctx->block_len < ETX_SHA256_BLOCK_SIZE )
+    {
+      return;
+    }
+    sha256_transform( ctx->state, ctx->block );
+    ctx->block_len = 0u;
+  }
+
+  //Process the full blocks directly from the source
+  while( len >= ETX_SHA256_BLOCK_SIZE )
+  {
+    sha256_transform( ctx->state, data );
+    data += ETX_SHA256_BLOCK_SIZE;
+    len  -= ETX_SHA256_BLOCK_SIZE;
+  }
+
+  //Keep the remaining bytes for the next call
+  memcpy( ctx->block, data, len );
+  ctx->block_len = len;
+}
+
+/**
+  * @brief Finish the SHA-256 calculation.
+  * @param ctx SHA-256 context
+  * @param digest buffer to store the digest (32 bytes)
+  * @retval None
+  */
+void etx_sha256_final( ETX_SHA256_CTX_ *ctx, uint8_t *digest )
+{
+  uint64_t bit_len = ctx->total_len * 8u;
+
+  //Padding : 0x80, zeros and the length in bits (big endian)
+  ctx->block[ctx->block_len++] = 0x80;
+  if( ctx->block_len > ( ETX_SHA256_BLOCK_SIZE - 8u ) )
+  {
+    memset( &ctx->block[ctx->block_len], 0, ETX_SHA256_BLOCK_SIZE - ctx->block_len );
+    sha256_transform( ctx->state, ctx->block );
+    ctx->block_len = 0u;
+  }
+  memset( &ctx->block[ctx->block_len], 0, ( ETX_SHA256_BLOCK_SIZE - 8u ) - ctx->block_len );
+
+  for( uint32_t i = 0u; i < 8u; i++ )
+  {
+    ctx->block[ETX_SHA256_BLOCK_SIZE - 1u - i] = (uint8_t)( bit_len >> ( i * 8u ) );
+  }
+  sha256_transform( ctx->state, ctx->block );
+
+  for( uint32_t i = 0u; i < 8u; i++ )
+  {
+    digest[i * 4u]      = (uint8_t)( ctx->state[i] >> 24 );
+    digest[i * 4u + 1u] = (uint8_t)( ctx->state[i] >> 16 );
+    digest[i * 4u + 2u] = (uint8_t)( ctx->state[i] >> 8 );
+    digest[i * 4u + 3u] = (uint8_t)( ctx->state[i] );
+  }
+}
+
+/**
+  * @brief Calculate the SHA-256 of the data in one go.
+  * @param data data
+  * @param len data length
+  * @param digest buffer to store the digest (32 bytes)
+  * @retval None
+  */
+void etx_sha256( const uint8_t *data, uint32_t len, uint8_t *digest )
+{
+  ETX_SHA256_CTX_ ctx;
+
+  etx_sha256_init( &ctx );
+  etx_sha256_update( &ctx, data, len );
+  etx_sha256_final( &ctx, digest );
+}
+
+/**
+  * @brief Check whether the digest is not filled (all 0x00 or all 0xFF).
+  * @param digest digest (32 bytes)
+  * @retval true - empty, false - not empty
+  */
+bool etx_sha256_is_empty( const uint8_t *digest )
+{
+  bool is_zero   = true;
+  bool is_erased = true;
+
+  for( uint32_t i = 0u; i < ETX_SHA256_DIGEST_SIZE; i++ )
+  {
+    is_zero   = is_zero   && ( digest[i] == 0x00 );
+    is_erased = is_erased && ( digest[i] == 0xFF );
+  }
+
+  return ( is_zero || is_erased );
+}
+
+/**
+  * @brief Process one 64 bytes block.
+  * @param state SHA-256 state
+  * @param block 64 bytes block
+  * @retval None
+  */
+static void sha256_transform( uint32_t *state, const uint8_t *block )
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+
+  for( uint32_t i = 0u; i < 16u; i++ )
+  {
+    w[i] = ( (uint32_t)block[i * 4u] << 24 ) | ( (uint32_t)block[i * 4u + 1u] << 16 ) |
+           ( (uint32_t)block[i * 4u + 2u] << 8 ) | ( (uint32_t)block[i * 4u + 3u] );
+  }
+
+  for( uint32_t i = 16u; i < 64u; i++ )
+  {
+    uint32_t s0 = ROTR( w[i - 15u], 7 ) ^ ROTR( w[i - 15u], 18 ) ^ ( w[i - 15u] >> 3 );
+    uint32_t s1 = ROTR( w[i - 2u], 17 ) ^ ROTR( w[i - 2u], 19 ) ^ ( w[i - 2u] >> 10 );
+    w[i] = w[i - 16u] + s0 + w[i - 7u] + s1;
+  }
+
+  a = state[0]; b = state[1]; c = state[2]; d = state[3];
+  e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+  for( uint32_t i = 0u; i < 64u; i++ )
+  {
+    uint32_t s1  = ROTR( e, 6 ) ^ ROTR( e, 11 ) ^ ROTR( e, 25 );
+    uint32_t ch  = ( e & f ) ^ ( ~e & g );
+    uint32_t t1  = h + s1 + ch + sha256_k[i] + w[i];
+    uint32_t s0  = ROTR( a, 2 ) ^ ROTR( a, 13 ) ^ ROTR( a, 22 );
+    uint32_t maj = ( a & b ) ^ ( a & c ) ^ ( b & c );
+    uint32_t t2  = s0 + maj;
+
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
@@ -26,6 +26,10 @@
 #include <stdio.h>
 #include <string.h>
 #include "etx_ota_update.h"
+#include "etx_log.h"
+#include "etx_journal.h"
+#include "user_diskio_spi.h"
+#include "user_diskio_sdmmc.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -105,19 +109,40 @@ int main(void)
   MX_SPI1_Init();
   MX_FATFS_Init();
   /* USER CODE BEGIN 2 */
+  // Start the non-blocking logger
+  etx_log_init();
 
   // Turn ON the Green Led to tell the user that Bootloader is running
   HAL_GPIO_WritePin(GPIOB, GPIO_PIN_0, GPIO_PIN_SET );    //Green LED ON
-  printf("Starting Bootloader(%d.%d)\r\n", BL_Version[0], BL_Version[1] );
+  ETX_LOG_INF("Starting Bootloader(%d.%d)\r\n", BL_Version[0], BL_Version[1] );
 
+  //Find the latest configuration
+  load_config();
+
+  //Start the telemetry journal of this boot
+  etx_journal_init( cfg_flash->reboot_cause );
+
+  //Install the new bootloader, if it is staged. This doesn't return on success.
+  uint32_t    stage_tick = HAL_GetTick();
+  ETX_OTA_EX_ ota_ex     = update_bootloader();
+  etx_journal_stage( ETX_JOURNAL_STAGE_BL_UPDATE, stage_tick, ota_ex );
+  if( ota_ex != ETX_OTA_EX_OK )
+  {
+    ETX_LOG_ERR("Bootloader Update : ERROR!!!\r\n");
+  }
+
+  stage_tick = HAL_GetTick();
   ETX_SD_EX_ sd_ex = check_update_frimware_SD_card();
+  etx_journal_stage( ETX_JOURNAL_STAGE_SD, stage_tick, sd_ex );
 
   //Check for firmware in SD Card
   if( sd_ex == ETX_SD_EX_FU_ERR )
   {
-    /* Fw update error. Don't process. */
-    printf("SD Card Fw Update : ERROR!!! HALT!!!\r\n");
-    while( 1 );
+    /*
+     * Fw update error. The slot that we were writing is marked as invalid.
+     * So, continue with the current application.
+     */
+    ETX_LOG_ERR("SD Card Fw Update : ERROR!!!\r\n");
   }
   else if( sd_ex == ETX_SD_EX_OK )
   {
@@ -125,15 +150,21 @@ int main(void)
      * We have updated the firmware through SD card. Skip other firmware
      * update mechanism.
      */
+
+    //The SD card may have staged a new bootloader. This doesn't return on success.
+    if( update_bootloader() != ETX_OTA_EX_OK )
+    {
+      ETX_LOG_ERR("Bootloader Update : ERROR!!!\r\n");
+    }
   }
   else
   {
     //check for other firmware update mechanisms
 
     //Read the reboot cause and act accordingly
-    printf("Reading the reboot reason...\r\n");
+    ETX_LOG_INF("Reading the reboot reason...\r\n");
 
-    ETX_GNRL_CFG_ *cfg          = (ETX_GNRL_CFG_*) (ETX_CONFIG_FLASH_ADDR);
+    ETX_GNRL_CFG_ *cfg          = cfg_flash;
     bool          goto_ota_mode = false;
 
     switch( cfg->reboot_cause )
@@ -143,7 +174,7 @@ int main(void)
         /*
          * It is a normal boot. So, do nothing here.
          */
-        printf("Normal Boot\r\n");
+        ETX_LOG_INF("Normal Boot\r\n");
         break;
       }
     case ETX_OTA_REQUEST:
@@ -154,18 +185,41 @@ int main(void)
          * time boot. So, don't wait for the user to press the button.
          * Directly go to OTA mode.
          */
-        printf("First time boot / OTA Request...\r\n");
-        printf("Going to OTA mode...\r\n");
+        ETX_LOG_INF("First time boot / OTA Request...\r\n");
+        ETX_LOG_INF("Going to OTA mode...\r\n");
         goto_ota_mode = true;
         break;
       }
     case ETX_LOAD_PREV_APP:
       {
-        //TODO: Implement
+        /*
+         * Application has requested to load the previous version.
+         * Select the other valid slot. It will be loaded by load_new_app().
+         */
+        ETX_LOG_INF("Load previous Application Request...\r\n");
+        if( load_prev_app() != ETX_OTA_EX_OK )
+        {
+          //No previous app in the flash. Take it from the SD card.
+          if( load_store_app( 0u ) != ETX_SD_EX_OK )
+          {
+            ETX_LOG_ERR("Rollback failed. Continuing with the current app\r\n");
+          }
+        }
         break;
       }
     default:
-      /* should not get here */
+      if( ( cfg->reboot_cause & ETX_LOAD_STORE_APP_MASK ) == ETX_LOAD_STORE_APP( 0u ) )
+      {
+        /*
+         * Application has requested a version from the SD image store.
+         * It will be loaded by load_new_app().
+         */
+        ETX_LOG_INF("Load Application from the SD image store Request...\r\n");
+        if( load_store_app( cfg->reboot_cause & ~ETX_LOAD_STORE_APP_MASK ) != ETX_SD_EX_OK )
+        {
+          ETX_LOG_ERR("Install failed. Continuing with the current app\r\n");
+        }
+      }
       break;
     };
 
@@ -173,7 +227,7 @@ int main(void)
     GPIO_PinState OTA_Pin_state;
     uint32_t end_tick = HAL_GetTick() + 3000;   // from now to 3 Seconds
 
-    printf("Press the User Button PC13 to trigger OTA update...\r\n");
+    ETX_LOG_INF("Press the User Button PC13 to trigger OTA update...\r\n");
     do
     {
       OTA_Pin_state = HAL_GPIO_ReadPin( GPIOC, GPIO_PIN_13 );
@@ -190,25 +244,53 @@ int main(void)
     /*Start the Firmware or Application update */
     if( ( OTA_Pin_state == GPIO_PIN_SET ) || ( goto_ota_mode ) )
     {
-      printf("Starting Firmware Download!!!\r\n");
+      ETX_LOG_INF("Starting Firmware Download!!!\r\n");
       /* OTA Request. Receive the data from the UART4 and flash */
-      if( etx_ota_download_and_flash() != ETX_OTA_EX_OK )
+      stage_tick = HAL_GetTick();
+      ota_ex     = etx_ota_download_and_flash();
+      etx_journal_stage( ETX_JOURNAL_STAGE_OTA, stage_tick, ota_ex );
+      if( ota_ex != ETX_OTA_EX_OK )
       {
-        /* Error. Don't process. */
-        printf("OTA Update : ERROR!!! HALT!!!\r\n");
-        while( 1 );
+        /* Error. Continue with the current application. */
+        ETX_LOG_ERR("OTA Update : ERROR!!!\r\n");
       }
       else
       {
         /* Reset to load the new application */
-        printf("Firmware update is done!!! Rebooting...\r\n");
+        ETX_LOG_INF("Firmware update is done!!! Rebooting...\r\n");
+        etx_journal_flush();
+        etx_log_deinit();
         HAL_NVIC_SystemReset();
       }
     }
   }
 
   //Load the updated app, if it is available
-  load_new_app();
+  stage_tick = HAL_GetTick();
+  while( load_new_app() != ETX_OTA_EX_OK )
+  {
+    etx_journal_stage( ETX_JOURNAL_STAGE_APP_LOAD, stage_tick, ETX_OTA_EX_ERR );
+
+    /* We don't have any valid application. Stay here till we get one. */
+    ETX_LOG_ERR("No valid Application. Waiting for the OTA...\r\n");
+    stage_tick = HAL_GetTick();
+    ota_ex     = etx_ota_download_and_flash();
+    etx_journal_stage( ETX_JOURNAL_STAGE_OTA, stage_tick, ota_ex );
+    if( ota_ex != ETX_OTA_EX_OK )
+    {
+      ETX_LOG_ERR("OTA Update : ERROR!!!\r\n");
+    }
+    else
+    {
+      /* Reset to load the new application (or install the new bootloader) */
+      ETX_LOG_INF("Firmware update is done!!! Rebooting...\r\n");
+      etx_journal_flush();
+      etx_log_deinit();
+      HAL_NVIC_SystemReset();
+    }
+    stage_tick = HAL_GetTick();
+  }
+  etx_journal_stage( ETX_JOURNAL_STAGE_APP_LOAD, stage_tick, ETX_OTA_EX_OK );
 
   // Jump to application
   goto_application();
@@ -373,7 +455,13 @@ static void MX_USART2_UART_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN USART2_Init 2 */
-
+#if ( ETX_OTA_FLOW_CTRL == 1 )
+  huart2.Init.HwFlowCtl = UART_HWCONTROL_RTS_CTS;
+  if (HAL_UART_Init(&huart2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
   /* USER CODE END USART2_Init 2 */
 
 }
@@ -469,9 +557,8 @@ int __io_putchar(int ch)
 int fputc(int ch, FILE *f)
 #endif /* __GNUC__ */
 {
-  /* Place your implementation of fputc here */
-  /* e.g. write a character to the UART3 and Loop until the end of transmission */
-  HAL_UART_Transmit(&huart3, (uint8_t *)&ch, 1, HAL_MAX_DELAY);
+  /* Queue the character. USART3 TX DMA sends it in the background. */
+  etx_log_putc( (uint8_t)ch );
 
   return ch;
 }
@@ -482,7 +569,15 @@ int fputc(int ch, FILE *f)
   */
 static void goto_application(void)
 {
-  printf("Gonna Jump to Application\r\n");
+  ETX_LOG_INF("Gonna Jump to Application\r\n");
+
+  // Append this boot's telemetry to the SD card journal
+  etx_journal_flush();
+
+  // Send out the pending logs and release the DMA before leaving
+  etx_log_deinit();
+  USER_SPI_deinit();
+  USER_SDMMC_deinit();
 
   void (*app_reset_handler)(void) = (void*)(*((volatile uint32_t*) (ETX_APP_FLASH_ADDR + 4U)));
 
@@ -22,7 +22,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
 /* USER CODE BEGIN Includes */
-
+#include "etx_ota_update.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -218,7 +218,18 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
     HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
 
   /* USER CODE BEGIN USART2_MspInit 1 */
+#if ( ETX_OTA_FLOW_CTRL == 1 )
+    /**USART2 GPIO Configuration
+    PD3     ------> USART2_CTS
+    PD4     ------> USART2_RTS
+    */
+    GPIO_InitStruct.Pin = ETX_OTA_RTS_PIN;
+    HAL_GPIO_Init(ETX_OTA_RTS_PORT, &GPIO_InitStruct);
 
+    GPIO_InitStruct.Pin = ETX_OTA_CTS_PIN;
+    GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+    HAL_GPIO_Init(ETX_OTA_CTS_PORT, &GPIO_InitStruct);
+#endif
   /* USER CODE END USART2_MspInit 1 */
   }
   else if(huart->Instance==USART3)
@@ -271,7 +282,10 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* huart)
     HAL_GPIO_DeInit(GPIOD, GPIO_PIN_5|GPIO_PIN_6);
 
   /* USER CODE BEGIN USART2_MspDeInit 1 */
-
+#if ( ETX_OTA_FLOW_CTRL == 1 )
+    HAL_GPIO_DeInit(ETX_OTA_RTS_PORT, ETX_OTA_RTS_PIN);
+    HAL_GPIO_DeInit(ETX_OTA_CTS_PORT, ETX_OTA_CTS_PIN);
+#endif
   /* USER CODE END USART2_MspDeInit 1 */
   }
   else if(huart->Instance==USART3)
@@ -5,7 +5,10 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../Core/Src/etx_journal.c \
+../Core/Src/etx_log.c \
 ../Core/Src/etx_ota_update.c \
+../Core/Src/etx_sha256.c \
 ../Core/Src/main.c \
 ../Core/Src/stm32f7xx_hal_msp.c \
 ../Core/Src/stm32f7xx_it.c \
@@ -14,7 +17,10 @@ C_SRCS += \
 ../Core/Src/system_stm32f7xx.c 
 
 OBJS += \
+./Core/Src/etx_journal.o \
+./Core/Src/etx_log.o \
 ./Core/Src/etx_ota_update.o \
+./Core/Src/etx_sha256.o \
 ./Core/Src/main.o \
 ./Core/Src/stm32f7xx_hal_msp.o \
 ./Core/Src/stm32f7xx_it.o \
@@ -23,7 +29,10 @@ OBJS += \
 ./Core/Src/system_stm32f7xx.o 
 
 C_DEPS += \
+./Core/Src/etx_journal.d \
+./Core/Src/etx_log.d \
 ./Core/Src/etx_ota_update.d \
+./Core/Src/etx_sha256.d \
 ./Core/Src/main.d \
 ./Core/Src/stm32f7xx_hal_msp.d \
 ./Core/Src/stm32f7xx_it.d \
@@ -6,14 +6,17 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../FATFS/Target/user_diskio.c \
+../FATFS/Target/user_diskio_sdmmc.c \
 ../FATFS/Target/user_diskio_spi.c 
 
 OBJS += \
 ./FATFS/Target/user_diskio.o \
+./FATFS/Target/user_diskio_sdmmc.o \
 ./FATFS/Target/user_diskio_spi.o 
 
 C_DEPS += \
 ./FATFS/Target/user_diskio.d \
+./FATFS/Target/user_diskio_sdmmc.d \
 ./FATFS/Target/user_diskio_spi.d 
 
 
@@ -36,10 +36,29 @@
 /* Includes ------------------------------------------------------------------*/
 #include <string.h>
 #include "ff_gen_drv.h"
+#include "main.h"
+#ifdef SD_USE_SDMMC
+#include "user_diskio_sdmmc.h"
+#else
 #include "user_diskio_spi.h"
+#endif
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
+/* SD card on the SDMMC1 4-bit bus or on SPI1 */
+#ifdef SD_USE_SDMMC
+#define USER_SD_initialize  USER_SDMMC_initialize
+#define USER_SD_status      USER_SDMMC_status
+#define USER_SD_read        USER_SDMMC_read
+#define USER_SD_write       USER_SDMMC_write
+#define USER_SD_ioctl       USER_SDMMC_ioctl
+#else
+#define USER_SD_initialize  USER_SPI_initialize
+#define USER_SD_status      USER_SPI_status
+#define USER_SD_read        USER_SPI_read
+#define USER_SD_write       USER_SPI_write
+#define USER_SD_ioctl       USER_SPI_ioctl
+#endif
 
 /* Private variables ---------------------------------------------------------*/
 /* Disk status */
@@ -83,7 +102,7 @@ DSTATUS USER_initialize (
 )
 {
   /* USER CODE BEGIN INIT */
-  return USER_SPI_initialize(pdrv);
+  return USER_SD_initialize(pdrv);
   /* USER CODE END INIT */
 }
 
@@ -97,7 +116,7 @@ DSTATUS USER_status (
 )
 {
   /* USER CODE BEGIN STATUS */
-  return USER_SPI_status(pdrv);
+  return USER_SD_status(pdrv);
   /* USER CODE END STATUS */
 }
 
@@ -117,7 +136,7 @@ DRESULT USER_read (
 )
 {
   /* USER CODE BEGIN READ */
-  return USER_SPI_read(pdrv, buff, sector, count);
+  return USER_SD_read(pdrv, buff, sector, count);
   /* USER CODE END READ */
 }
 
@@ -139,7 +158,7 @@ DRESULT USER_write (
 {
   /* USER CODE BEGIN WRITE */
   /* USER CODE HERE */
-  return USER_SPI_write(pdrv, buff, sector, count);
+  return USER_SD_write(pdrv, buff, sector, count);
   /* USER CODE END WRITE */
 }
 #endif /* _USE_WRITE == 1 */
@@ -159,7 +178,7 @@ DRESULT USER_ioctl (
 )
 {
   /* USER CODE BEGIN IOCTL */
-  return USER_SPI_ioctl(pdrv, cmd, buff);
+  return USER_SD_ioctl(pdrv, cmd, buff);
   /* USER CODE END IOCTL */
 }
 #endif /* _USE_IOCTL == 1 */
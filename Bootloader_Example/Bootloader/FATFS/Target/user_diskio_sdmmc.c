@@ -0,0 +1,607 @@
+/**
+ ******************************************************************************
+  * @file    user_diskio_sdmmc.c
+  * @brief   This file contains the implementation of the user_diskio_sdmmc
+  *          FatFs driver (SD card on the SDMMC1 4-bit bus).
+  ******************************************************************************
+  */
+
+//This is the SD bus counterpart of user_diskio_spi.c. It drives SDMMC1 at
+//register level (the HAL SD module is not part of this project) with a 4-bit
+//bus and DMA2 Stream 3 Channel 4 for the data blocks.
+//
+//Pins (AF12) : D0..D3 = PC8..PC11, CK = PC12, CMD = PD2
+//
+//SDMMC1 is clocked from SYSCLK. The card is switched to the high speed mode
+//(50MHz) only when the kernel clock is fast enough to make use of it.
+
+#include <string.h>
+#include "stm32f7xx_hal.h" /* Provide the low-level HAL functions */
+#include "main.h"
+#include "user_diskio_sdmmc.h"
+
+/*--------------------------------------------------------------------------
+
+   Module Private Functions
+
+---------------------------------------------------------------------------*/
+
+/* SD command */
+#define CMD0  (0)     /* GO_IDLE_STATE */
+#define CMD2  (2)     /* ALL_SEND_CID */
+#define CMD3  (3)     /* SEND_RELATIVE_ADDR */
+#define ACMD6 (0x80+6)  /* SET_BUS_WIDTH */
+#define CMD6  (6)     /* SWITCH_FUNC */
+#define CMD7  (7)     /* SELECT_CARD */
+#define CMD8  (8)     /* SEND_IF_COND */
+#define CMD9  (9)     /* SEND_CSD */
+#define CMD12 (12)    /* STOP_TRANSMISSION */
+#define CMD13 (13)    /* SEND_STATUS */
+#define ACMD13  (0x80+13) /* SD_STATUS */
+#define CMD16 (16)    /* SET_BLOCKLEN */
+#define CMD17 (17)    /* READ_SINGLE_BLOCK */
+#define CMD18 (18)    /* READ_MULTIPLE_BLOCK */
+#define CMD24 (24)    /* WRITE_BLOCK */
+#define CMD25 (25)    /* WRITE_MULTIPLE_BLOCK */
+#define ACMD41  (0x80+41) /* SD_SEND_OP_COND */
+#define CMD55 (55)    /* APP_CMD */
+
+/* Response type */
+#define RESP_NONE 0     /* No response */
+#define RESP_R1   1     /* Card status (R1, R1b) */
+#define RESP_R2   2     /* CID/CSD (136 bit) */
+#define RESP_R3   3     /* OCR (no CRC) */
+#define RESP_R6   4     /* RCA / interface condition (R6, R7) */
+
+/* Card type flags */
+#define CT_SD1    0x02    /* SD ver 1 */
+#define CT_SD2    0x04    /* SD ver 2 */
+#define CT_BLOCK  0x08    /* Block addressing */
+
+#define R1_ERRORS     0xFDFFE008  /* Error bits of the card status */
+#define R1_STATE(r)   (((r) >> 9) & 0x0F)
+#define R1_STATE_TRAN 4
+#define R1_READY      0x00000100  /* READY_FOR_DATA */
+
+#define SD_INIT_CLK     400000    /* Identification mode clock [Hz] */
+#define SD_DS_CLK       25000000  /* Default speed [Hz] */
+#define SD_HS_CLK       50000000  /* High speed [Hz] */
+#define SD_CMD_TIMEOUT  10        /* Command response timeout [ms] */
+#define SD_DATA_TIMEOUT 1000      /* Data transfer timeout [ms] */
+#define SD_BUSY_TIMEOUT 500       /* Programming timeout [ms] */
+
+//Card detect switch (optional), same as user_diskio_spi.c. Without it, a card that does not answer
+//the first commands (hardware timeout of 64 bus clocks) is taken as no card.
+#ifndef SD_CD_ACTIVE
+#define SD_CD_ACTIVE    GPIO_PIN_RESET  /* Level of the pin when a card is inserted */
+#endif
+
+#define SD_DMA_STREAM   DMA2_Stream3
+#define SD_DMA_CHANNEL  4
+#define SD_DMA_FLAGS    (DMA_LIFCR_CFEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTCIF3)
+
+#define SD_CMD_FLAGS    (SDMMC_ICR_CCRCFAILC | SDMMC_ICR_CTIMEOUTC | SDMMC_ICR_CMDRENDC | SDMMC_ICR_CMDSENTC)
+#define SD_DATA_FLAGS   (SDMMC_ICR_DCRCFAILC | SDMMC_ICR_DTIMEOUTC | SDMMC_ICR_TXUNDERRC | SDMMC_ICR_RXOVERRC | \
+                         SDMMC_ICR_DATAENDC | SDMMC_ICR_DBCKENDC)
+#define SD_DATA_ERRORS  (SDMMC_STA_DCRCFAIL | SDMMC_STA_DTIMEOUT | SDMMC_STA_TXUNDERR | SDMMC_STA_RXOVERR)
+
+static volatile
+DSTATUS Stat = STA_NOINIT;  /* Physical drive status */
+
+static
+BYTE CardType;      /* Card type flags */
+
+static
+DWORD Rca;          /* Relative card address (upper 16 bits) */
+
+static
+DWORD SdClk;        /* Current bus clock [Hz] */
+
+static
+BYTE Csd[16];       /* CSD register, read while the card is in the stand-by state */
+
+/* Used instead of the caller's buffer when the D-Cache is ON and the buffer is not line aligned */
+static
+BYTE DmaBuf[512] __attribute__((aligned(32)));
+
+
+/*-----------------------------------------------------------------------*/
+/* SDMMC controls (Platform dependent)                                   */
+/*-----------------------------------------------------------------------*/
+
+/* Is the D-Cache turned ON? */
+static
+int dcache_on (void)
+{
+  return (SCB->CCR & SCB_CCR_DC_Msk) ? 1 : 0;
+}
+
+
+/* Set the bus clock (not above the given frequency) */
+static
+void set_clock (
+  DWORD hz    /* Maximum bus clock [Hz] */
+)
+{
+  DWORD clk = HAL_RCC_GetSysClockFreq();  /* SDMMC1SEL = SYSCLK */
+  DWORD cr  = SDMMC1->CLKCR & ~(SDMMC_CLKCR_CLKDIV | SDMMC_CLKCR_BYPASS);
+  DWORD div;
+
+  if (clk <= hz) {
+    cr |= SDMMC_CLKCR_BYPASS;     /* SDMMC_CK = SDMMCCLK */
+    SdClk = clk;
+  } else {
+    div = (clk + hz - 1) / hz;    /* SDMMC_CK = SDMMCCLK / (CLKDIV + 2) */
+    div = (div < 2) ? 0 : div - 2;
+    if (div > 255) div = 255;
+    cr |= div;
+    SdClk = clk / (div + 2);
+  }
+  SDMMC1->CLKCR = cr;
+  SDMMC1->DTIMER = (SdClk / 1000) * SD_DATA_TIMEOUT;  /* Data timeout in bus clocks */
+}
+
+
+/* Send a command and get its response */
+static
+int send_cmd (  /* 1:OK, 0:Error */
+  BYTE cmd,     /* Command index (bit7: ACMD) */
+  DWORD arg,    /* Argument */
+  UINT rt,      /* Response type */
+  DWORD *resp   /* Response (1 or 4 words), can be NULL */
+)
+{
+  DWORD sta, wait, reg, start;
+
+
+  if (cmd & 0x80) {   /* Send a CMD55 prior to ACMD<n> */
+    cmd &= 0x7F;
+    if (!send_cmd(CMD55, Rca, RESP_R1, NULL)) return 0;
+  }
+
+  reg = cmd | SDMMC_CMD_CPSMEN;
+  if (rt == RESP_R2) {
+    reg |= SDMMC_CMD_WAITRESP_0 | SDMMC_CMD_WAITRESP_1; /* Long response */
+  } else if (rt != RESP_NONE) {
+    reg |= SDMMC_CMD_WAITRESP_0;    /* Short response */
+  }
+  wait = (rt == RESP_NONE) ? SDMMC_STA_CMDSENT : (SDMMC_STA_CMDREND | SDMMC_STA_CCRCFAIL | SDMMC_STA_CTIMEOUT);
+
+  SDMMC1->ICR = SD_CMD_FLAGS;
+  SDMMC1->ARG = arg;
+  SDMMC1->CMD = reg;
+
+  start = HAL_GetTick();
+  do {
+    sta = SDMMC1->STA;
+    if ((HAL_GetTick() - start) >= SD_CMD_TIMEOUT) return 0;
+  } while (!(sta & wait));
+  SDMMC1->ICR = SD_CMD_FLAGS;
+
+  if (sta & SDMMC_STA_CTIMEOUT) return 0;               /* No response */
+  if ((sta & SDMMC_STA_CCRCFAIL) && rt != RESP_R3) return 0;  /* R3 is not CRC protected */
+  if ((rt == RESP_R1 || rt == RESP_R6) && (SDMMC1->RESPCMD & 0x3F) != cmd) return 0;
+
+  if (resp) {
+    resp[0] = SDMMC1->RESP1;
+    if (rt == RESP_R2) {
+      resp[1] = SDMMC1->RESP2;
+      resp[2] = SDMMC1->RESP3;
+      resp[3] = SDMMC1->RESP4;
+    }
+  }
+  if (rt == RESP_R1 && (SDMMC1->RESP1 & R1_ERRORS)) return 0;
+
+  return 1;
+}
+
+
+/* Wait for the card to be back in the transfer state */
+static
+int wait_ready (  /* 1:Ready, 0:Timeout */
+  UINT wt     /* Timeout [ms] */
+)
+{
+  DWORD r1, start = HAL_GetTick();
+
+  do {
+    if (send_cmd(CMD13, Rca, RESP_R1, &r1) && (r1 & R1_READY) && R1_STATE(r1) == R1_STATE_TRAN) return 1;
+  } while ((HAL_GetTick() - start) < wt);
+
+  return 0;
+}
+
+
+/* Start the DMA stream (the SDMMC is the flow controller) */
+static
+void start_dma (
+  BYTE *buff,   /* Memory address */
+  int rd      /* 1:Card to memory, 0:Memory to card */
+)
+{
+  DWORD cr;
+
+  SD_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+  while (SD_DMA_STREAM->CR & DMA_SxCR_EN) ;
+  DMA2->LIFCR = SD_DMA_FLAGS;
+
+  SD_DMA_STREAM->PAR  = (DWORD)&SDMMC1->FIFO;
+  SD_DMA_STREAM->M0AR = (DWORD)buff;
+  SD_DMA_STREAM->NDTR = 0;              /* Ignored with the peripheral flow control */
+  SD_DMA_STREAM->FCR  = DMA_SxFCR_DMDIS | DMA_SxFCR_FTH;  /* FIFO, full threshold */
+
+  cr = (SD_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL | DMA_SxCR_PBURST_0 |
+       DMA_SxCR_PSIZE_1 | DMA_SxCR_MINC | DMA_SxCR_PFCTRL;
+  if (!((DWORD)buff & 15)) {
+    cr |= DMA_SxCR_MBURST_0 | DMA_SxCR_MSIZE_1; /* Word bursts, never cross the 1KB boundary */
+  }                         /* else single bytes, any alignment */
+  if (!rd) cr |= DMA_SxCR_DIR_0;
+
+  SD_DMA_STREAM->CR = cr;
+  SD_DMA_STREAM->CR |= DMA_SxCR_EN;
+}
+
+
+/* Stop the data path after an error */
+static
+void stop_data (void)
+{
+  SDMMC1->DCTRL = 0;
+  SD_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+  while (SD_DMA_STREAM->CR & DMA_SxCR_EN) ;
+  SDMMC1->ICR = SD_DATA_FLAGS;
+}
+
+
+/* Transfer data blocks with the DMA */
+static
+int xfer_data (   /* 1:OK, 0:Error */
+  BYTE cmd,     /* Data command */
+  DWORD arg,    /* Argument */
+  BYTE *buff,   /* Data buffer (cache maintained by the caller) */
+  UINT nblk,    /* Number of blocks */
+  UINT bpow,    /* Block size (2^bpow) */
+  int rd      /* 1:Read, 0:Write */
+)
+{
+  DWORD sta, start, dctrl;
+  int ok = 0;
+
+
+  if (cmd & 0x80) {   /* The CMD55 must go before the data path is armed */
+    cmd &= 0x7F;
+    if (!send_cmd(CMD55, Rca, RESP_R1, NULL)) return 0;
+  }
+
+  start_dma(buff, rd);
+  SDMMC1->ICR   = SD_DATA_FLAGS;
+  SDMMC1->DLEN  = (DWORD)nblk << bpow;
+  dctrl = SDMMC_DCTRL_DTEN | SDMMC_DCTRL_DMAEN | (bpow << SDMMC_DCTRL_DBLOCKSIZE_Pos);
+
+  do {
+    if (rd) {       /* Read: arm the data path first, the card starts right after the response */
+      SDMMC1->DCTRL = dctrl | SDMMC_DCTRL_DTDIR;
+      if (!send_cmd(cmd, arg, RESP_R1, NULL)) break;
+    } else {        /* Write: the card waits for the data */
+      if (!send_cmd(cmd, arg, RESP_R1, NULL)) break;
+      SDMMC1->DCTRL = dctrl;
+    }
+
+    start = HAL_GetTick();
+    do {
+      sta = SDMMC1->STA;
+      if ((HAL_GetTick() - start) >= SD_DATA_TIMEOUT) sta |= SDMMC_STA_DTIMEOUT;
+    } while (!(sta & (SDMMC_STA_DATAEND | SD_DATA_ERRORS)));
+    if (sta & SD_DATA_ERRORS) break;
+
+    /* The stream disables itself when the SDMMC signals the last burst */
+    start = HAL_GetTick();
+    while ((SD_DMA_STREAM->CR & DMA_SxCR_EN) && (HAL_GetTick() - start) < SD_CMD_TIMEOUT) ;
+    if ((SD_DMA_STREAM->CR & DMA_SxCR_EN) || (DMA2->LISR & DMA_LISR_TEIF3)) break;
+
+    ok = 1;
+  } while (0);
+
+  if (!ok) stop_data();
+  SDMMC1->ICR = SD_DATA_FLAGS;
+
+  if (cmd == CMD18 || cmd == CMD25) {
+    if (!send_cmd(CMD12, 0, RESP_R1, NULL)) ok = 0; /* STOP_TRANSMISSION */
+  }
+  if (!rd && !wait_ready(SD_BUSY_TIMEOUT)) ok = 0;  /* Wait for end of programming */
+
+  return ok;
+}
+
+
+/* Initialize the GPIOs, the clocks and power up the bus */
+static
+void init_sdmmc (void)
+{
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  __HAL_RCC_GPIOC_CLK_ENABLE();
+  __HAL_RCC_GPIOD_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
+  __HAL_RCC_SDMMC1_CLK_ENABLE();
+  RCC->DCKCFGR2 |= RCC_DCKCFGR2_SDMMC1SEL;  /* SDMMC1 kernel clock = SYSCLK */
+
+  GPIO_InitStruct.Mode      = GPIO_MODE_AF_PP;
+  GPIO_InitStruct.Pull      = GPIO_PULLUP;
+  GPIO_InitStruct.Speed     = GPIO_SPEED_FREQ_VERY_HIGH;
+  GPIO_InitStruct.Alternate = GPIO_AF12_SDMMC1;
+  GPIO_InitStruct.Pin       = GPIO_PIN_8 | GPIO_PIN_9 | GPIO_PIN_10 | GPIO_PIN_11;
+  HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);   /* D0..D3 */
+  GPIO_InitStruct.Pin       = GPIO_PIN_2;
+  HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);   /* CMD */
+  GPIO_InitStruct.Pull      = GPIO_NOPULL;
+  GPIO_InitStruct.Pin       = GPIO_PIN_12;
+  HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);   /* CK */
+
+  SDMMC1->POWER = 0;
+  SDMMC1->CLKCR = 0;
+  set_clock(SD_INIT_CLK);
+  SDMMC1->POWER = SDMMC_POWER_PWRCTRL;    /* Power ON */
+  HAL_Delay(2);
+  SDMMC1->CLKCR |= SDMMC_CLKCR_CLKEN;
+  HAL_Delay(2);               /* At least 74 clocks before the first command */
+}
+
+
+
+/*--------------------------------------------------------------------------
+
+   Public FatFs Functions (wrapped in user_diskio.c)
+
+---------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------*/
+/* Initialize disk drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS USER_SDMMC_initialize (
+  BYTE drv    /* Physical drive number (0) */
+)
+{
+  DWORD r[4], start;
+  BYTE ty = 0, n;
+
+  if (drv != 0) return STA_NOINIT;    /* Supports only drive 0 */
+
+#ifdef SD_CD_Pin
+  if (HAL_GPIO_ReadPin(SD_CD_GPIO_Port, SD_CD_Pin) != SD_CD_ACTIVE) { /* Is card existing in the socket? */
+    Stat = STA_NOINIT | STA_NODISK;
+    return Stat;
+  }
+#endif
+
+  init_sdmmc();
+  Rca = 0;
+  Stat |= STA_NODISK;
+
+  do {
+    send_cmd(CMD0, 0, RESP_NONE, NULL);   /* Idle state */
+
+    if (send_cmd(CMD8, 0x1AA, RESP_R6, r)) {  /* SDv2? */
+      if ((r[0] & 0xFFF) != 0x1AA) break;   /* The card does not support 2.7-3.6V */
+      ty = CT_SD2;
+    } else if (send_cmd(CMD55, 0, RESP_R1, NULL)) {
+      ty = CT_SD1;
+    } else {
+      break;              /* No answer at all: no card */
+    }
+    Stat &= ~STA_NODISK;
+
+    start = HAL_GetTick();        /* Initialization timeout = 1 sec */
+    do {
+      if (!send_cmd(ACMD41, 0x80100000 | ((ty & CT_SD2) ? 0x40000000 : 0), RESP_R3, r)) r[0] = 0;
+    } while (!(r[0] & 0x80000000) && (HAL_GetTick() - start) < 1000);
+    if (!(r[0] & 0x80000000)) { ty = 0; break; }
+    if (r[0] & 0x40000000) ty |= CT_BLOCK;  /* CCS */
+
+    if (!send_cmd(CMD2, 0, RESP_R2, r)) { ty = 0; break; }   /* CID */
+    if (!send_cmd(CMD3, 0, RESP_R6, r)) { ty = 0; break; }   /* RCA */
+    Rca = r[0] & 0xFFFF0000;
+
+    if (!send_cmd(CMD9, Rca, RESP_R2, r)) { ty = 0; break; } /* CSD */
+    for (n = 0; n < 16; n++) Csd[n] = (BYTE)(r[n / 4] >> (24 - 8 * (n % 4)));
+
+    if (!send_cmd(CMD7, Rca, RESP_R1, NULL) || !wait_ready(SD_BUSY_TIMEOUT)) { ty = 0; break; } /* Transfer state */
+
+    if (!send_cmd(ACMD6, 2, RESP_R1, NULL)) { ty = 0; break; }  /* 4-bit bus */
+    MODIFY_REG(SDMMC1->CLKCR, SDMMC_CLKCR_WIDBUS, SDMMC_CLKCR_WIDBUS_0);
+
+    if (!(ty & CT_BLOCK) && !send_cmd(CMD16, 512, RESP_R1, NULL)) { ty = 0; break; }
+  } while (0);
+
+  CardType = ty;
+
+  if (ty) {     /* OK */
+    set_clock(SD_DS_CLK);
+    if (HAL_RCC_GetSysClockFreq() > SD_DS_CLK && (ty & CT_SD2)) {
+      /* Switch to the high speed mode. Function group 1 reports 1 when it is taken. */
+      if (xfer_data(CMD6, 0x80FFFFF1, DmaBuf, 1, 6, 1)) {
+        if (dcache_on()) SCB_InvalidateDCache_by_Addr((uint32_t*)DmaBuf, 64);
+        if ((DmaBuf[16] & 0x0F) == 1) set_clock(SD_HS_CLK);
+      }
+    }
+    Stat &= ~STA_NOINIT;  /* Clear STA_NOINIT flag */
+  } else {      /* Failed */
+    Stat = STA_NOINIT | (Stat & STA_NODISK);
+    USER_SDMMC_deinit();
+  }
+
+  return Stat;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get disk status                                                       */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS USER_SDMMC_status (
+  BYTE drv    /* Physical drive number (0) */
+)
+{
+  if (drv) return STA_NOINIT;   /* Supports only drive 0 */
+
+  return Stat;  /* Return disk status */
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+
+DRESULT USER_SDMMC_read (
+  BYTE drv,   /* Physical drive number (0) */
+  BYTE *buff,   /* Pointer to the data buffer to store read data */
+  DWORD sector, /* Start sector number (LBA) */
+  UINT count    /* Number of sectors to read (1..128) */
+)
+{
+  DWORD addr;
+  int ok;
+
+  if (drv || !count) return RES_PARERR;   /* Check parameter */
+  if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check if drive is ready */
+
+  addr = (CardType & CT_BLOCK) ? sector : sector * 512;  /* LBA to BA conversion (byte addressing cards) */
+
+  if (dcache_on() && ((DWORD)buff & 31)) {
+    /* Invalidating an unaligned buffer would also drop the neighbour's data. One sector at a time. */
+    for (; count; count--, buff += 512, addr += (CardType & CT_BLOCK) ? 1 : 512) {
+      SCB_InvalidateDCache_by_Addr((uint32_t*)DmaBuf, 512);
+      if (!xfer_data(CMD17, addr, DmaBuf, 1, 9, 1)) break;
+      SCB_InvalidateDCache_by_Addr((uint32_t*)DmaBuf, 512);
+      memcpy(buff, DmaBuf, 512);
+    }
+  } else {
+    if (dcache_on()) SCB_InvalidateDCache_by_Addr((uint32_t*)buff, count * 512);
+    ok = xfer_data((count == 1) ? CMD17 : CMD18, addr, buff, count, 9, 1);
+    /* Drop the lines fetched speculatively while the DMA was running */
+    if (dcache_on()) SCB_InvalidateDCache_by_Addr((uint32_t*)buff, count * 512);
+    if (ok) count = 0;
+  }
+
+  return count ? RES_ERROR : RES_OK;  /* Return result */
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+
+#if _USE_WRITE
+DRESULT USER_SDMMC_write (
+  BYTE drv,     /* Physical drive number (0) */
+  const BYTE *buff, /* Pointer to the data to write */
+  DWORD sector,   /* Start sector number (LBA) */
+  UINT count      /* Number of sectors to write (1..128) */
+)
+{
+  DWORD addr;
+
+  if (drv || !count) return RES_PARERR;   /* Check parameter */
+  if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check drive status */
+  if (Stat & STA_PROTECT) return RES_WRPRT; /* Check write protect */
+
+  addr = (CardType & CT_BLOCK) ? sector : sector * 512;  /* LBA ==> BA conversion (byte addressing cards) */
+
+  if (dcache_on() && ((DWORD)buff & 31)) {
+    /* Cleaning an unaligned buffer is harmless, but the DMA needs the lines as well. One sector at a time. */
+    for (; count; count--, buff += 512, addr += (CardType & CT_BLOCK) ? 1 : 512) {
+      memcpy(DmaBuf, buff, 512);
+      SCB_CleanDCache_by_Addr((uint32_t*)DmaBuf, 512);
+      if (!xfer_data(CMD24, addr, DmaBuf, 1, 9, 0)) break;
+    }
+  } else {
+    if (dcache_on()) SCB_CleanDCache_by_Addr((uint32_t*)buff, count * 512);
+    if (xfer_data((count == 1) ? CMD24 : CMD25, addr, (BYTE*)buff, count, 9, 0)) count = 0;
+  }
+
+  return count ? RES_ERROR : RES_OK;  /* Return result */
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous drive controls other than data read/write               */
+/*-----------------------------------------------------------------------*/
+
+#if _USE_IOCTL
+DRESULT USER_SDMMC_ioctl (
+  BYTE drv,   /* Physical drive number (0) */
+  BYTE cmd,   /* Control command code */
+  void *buff    /* Pointer to the control data */
+)
+{
+  DRESULT res;
+  BYTE n;
+  DWORD csize;
+
+
+  if (drv) return RES_PARERR;         /* Check parameter */
+  if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check if drive is ready */
+
+  res = RES_ERROR;
+
+  switch (cmd) {
+  case CTRL_SYNC :    /* Wait for end of internal write process of the drive */
+    if (wait_ready(SD_BUSY_TIMEOUT)) res = RES_OK;
+    break;
+
+  case GET_SECTOR_COUNT : /* Get drive capacity in unit of sector (DWORD) */
+    if ((Csd[0] >> 6) == 1) { /* SDC ver 2.00 */
+      csize = Csd[9] + ((WORD)Csd[8] << 8) + ((DWORD)(Csd[7] & 63) << 16) + 1;
+      *(DWORD*)buff = csize << 10;
+    } else {          /* SDC ver 1.XX */
+      n = (Csd[5] & 15) + ((Csd[10] & 128) >> 7) + ((Csd[9] & 3) << 1) + 2;
+      csize = (Csd[8] >> 6) + ((WORD)Csd[7] << 2) + ((WORD)(Csd[6] & 3) << 10) + 1;
+      *(DWORD*)buff = csize << (n - 9);
+    }
+    res = RES_OK;
+    break;
+
+  case GET_BLOCK_SIZE : /* Get erase block size in unit of sector (DWORD) */
+    if (CardType & CT_SD2) {  /* SDC ver 2.00: AU size from the SD status */
+      if (dcache_on()) SCB_InvalidateDCache_by_Addr((uint32_t*)DmaBuf, 64);
+      if (xfer_data(ACMD13, 0, DmaBuf, 1, 6, 1)) {
+        if (dcache_on()) SCB_InvalidateDCache_by_Addr((uint32_t*)DmaBuf, 64);
+        *(DWORD*)buff = 16UL << (DmaBuf[10] >> 4);
+        res = RES_OK;
+      }
+    } else {          /* SDC ver 1.XX */
+      *(DWORD*)buff = (((Csd[10] & 63) << 1) + ((WORD)(Csd[11] & 128) >> 7) + 1) << ((Csd[13] >> 6) - 1);
+      res = RES_OK;
+    }
+    break;
+
+  default:
+    res = RES_PARERR;
+  }
+
+  return res;
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Power down the bus (before jumping to the application)               */
+/*-----------------------------------------------------------------------*/
+
+void USER_SDMMC_deinit (void)
+{
+  if (!(RCC->APB2ENR & RCC_APB2ENR_SDMMC1EN)) return;
+
+  stop_data();
+  SDMMC1->CLKCR = 0;
+  SDMMC1->POWER = 0;
+  __HAL_RCC_SDMMC1_CLK_DISABLE();
+  Stat |= STA_NOINIT;
+}
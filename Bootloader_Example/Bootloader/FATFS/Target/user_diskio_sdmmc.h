@@ -0,0 +1,31 @@
+/**
+ ******************************************************************************
+  * @file    user_diskio_sdmmc.h
+  * @brief   This file contains the common defines and functions prototypes for
+  *          the user_diskio_sdmmc driver implementation
+  ******************************************************************************
+  */
+
+#ifndef _USER_DISKIO_SDMMC_H
+#define _USER_DISKIO_SDMMC_H
+
+#include "integer.h" //from FatFs middleware library
+#include "diskio.h" //from FatFs middleware library
+#include "ff_gen_drv.h" //from FatFs middleware library
+
+//same interface as user_diskio_spi.h. user_diskio.c picks one of them (see SD_USE_SDMMC in main.h)
+
+extern DSTATUS USER_SDMMC_initialize (BYTE pdrv);
+extern DSTATUS USER_SDMMC_status (BYTE pdrv);
+extern DRESULT USER_SDMMC_read (BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
+#if _USE_WRITE == 1
+  extern DRESULT USER_SDMMC_write (BYTE pdrv, const BYTE *buff, DWORD sector, UINT count);
+#endif /* _USE_WRITE == 1 */
+#if _USE_IOCTL == 1
+  extern DRESULT USER_SDMMC_ioctl (BYTE pdrv, BYTE cmd, void *buff);
+#endif /* _USE_IOCTL == 1 */
+
+//powers down the SDMMC and releases the DMA stream
+extern void USER_SDMMC_deinit (void);
+
+#endif
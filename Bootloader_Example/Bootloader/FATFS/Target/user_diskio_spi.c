@@ -26,6 +26,7 @@
 
 #include "stm32f7xx_hal.h" /* Provide the low-level HAL functions */
 #include "user_diskio_spi.h"
+#include <string.h>
 
 //Make sure you set #define SD_SPI_HANDLE as some hspix in main.h
 //Make sure you set #define SD_CS_GPIO_Port as some GPIO port in main.h
@@ -34,13 +35,38 @@ extern SPI_HandleTypeDef SD_SPI_HANDLE;
 
 /* Function prototypes */
 
-//(Note that the _256 is used as a mask to clear the prescalar bits as it provides binary 111 in the correct position)
-#define FCLK_SLOW() { MODIFY_REG(SD_SPI_HANDLE.Instance->CR1, SPI_BAUDRATEPRESCALER_256, SPI_BAUDRATEPRESCALER_128); }  /* Set SCLK = slow, approx 280 KBits/s*/
-#define FCLK_FAST() { MODIFY_REG(SD_SPI_HANDLE.Instance->CR1, SPI_BAUDRATEPRESCALER_256, SPI_BAUDRATEPRESCALER_8); }  /* Set SCLK = fast, approx 4.5 MBits/s */
+//SCLK is derived from the SPI kernel clock (PCLK) : 400kHz while the card is identified, then
+//the card's TRAN_SPEED from the CSD (never above the 25MHz of the SPI mode)
+#define SCLK_INIT     400000      /* Identification mode clock [Hz] */
+#define SCLK_MAX      25000000    /* Maximum clock of the SPI mode [Hz] */
+#define SCLK_DEFAULT  4000000     /* Used when the CSD can not be read [Hz] */
+
+//Card detect switch (optional). Define SD_CD_Pin and SD_CD_GPIO_Port in main.h and configure the pin
+//as an input in CubeMX. Without it, the card is probed with a CMD0 with a short timeout.
+#ifndef SD_CD_ACTIVE
+#define SD_CD_ACTIVE  GPIO_PIN_RESET  /* Level of the pin when a card is inserted */
+#endif
+#define SD_PROBE_TIMEOUT  5       /* Card ready timeout of the CMD0 probe [ms] */
 
 #define CS_HIGH() {HAL_GPIO_WritePin(SD_CS_GPIO_Port, SD_CS_Pin, GPIO_PIN_SET);}
 #define CS_LOW()  {HAL_GPIO_WritePin(SD_CS_GPIO_Port, SD_CS_Pin, GPIO_PIN_RESET);}
 
+//Sector transfers use the DMA. SPI1_RX : DMA2 Stream 2 Channel 3, SPI1_TX : DMA2 Stream 5 Channel 3
+//(DMA1 Stream 3 is used by the logger)
+#define SPI_DMA_TIMEOUT   100     /* Completion timeout of one DMA transfer [ms] */
+#define SPI_DMA_MIN_LEN   16      /* Shorter transfers are not worth the DMA setup */
+#define SPI_DMA_BUF_SIZE  512     /* Bounce buffer size (one sector) */
+
+//Single sector reads (FAT, directory and partial file sectors) go through a small LRU sector cache.
+//A miss reads SPI_RA_SECTORS ahead. The read-ahead sectors go in as the least recently used ones, so
+//they don't push the FAT sectors out unless they are used. Multiple sector reads bypass the cache.
+//Writes are written through to the cache.
+#define SPI_CACHE_LINES   8       /* Cached sectors */
+#define SPI_RA_SECTORS    4       /* Sectors read on a cache miss (including the requested one) */
+
+DMA_HandleTypeDef hdma_spi1_rx;
+DMA_HandleTypeDef hdma_spi1_tx;
+
 /*--------------------------------------------------------------------------
 
    Module Private Functions
@@ -83,6 +109,41 @@ DSTATUS Stat = STA_NOINIT;  /* Physical drive status */
 static
 BYTE CardType;      /* Card type flags */
 
+static
+BYTE DmaReady;      /* 1:DMA streams are initialized */
+
+/* 0xFF clocked out while receiving. Kept in the SRAM: the DMA would stall on the flash while it is programmed. */
+static
+BYTE DummyTx[SPI_DMA_BUF_SIZE] = { [0 ... SPI_DMA_BUF_SIZE - 1] = 0xFF };
+
+/* Used instead of the caller's buffer when the D-Cache is ON and the buffer is not line aligned */
+static
+BYTE DmaBuf[SPI_DMA_BUF_SIZE] __attribute__((aligned(32)));
+
+static
+UINT SelectTimeout = 500; /* Card ready timeout of spiselect() [ms] */
+
+static
+BYTE CacheBuf[SPI_CACHE_LINES][512] __attribute__((aligned(32)));
+
+static
+DWORD CacheSector[SPI_CACHE_LINES]; /* LBA of the cached sector */
+
+static
+DWORD CacheStamp[SPI_CACHE_LINES];  /* Last use (0:Empty line, 1:Read ahead and not used yet) */
+
+static
+DWORD CacheClock = 1;       /* Use counter */
+
+//A multiple block read (CMD18) is left open after the read and the card stays selected. A read
+//that starts where the last one ended continues it without a new command. Any other command
+//stops it first.
+static
+BYTE StreamOpen;      /* 1:CMD18 is in progress */
+
+static
+DWORD StreamSector;   /* LBA of the next block in the stream */
+
 uint32_t spiTimerTickStart;
 uint32_t spiTimerTickDelay;
 
@@ -99,42 +160,219 @@ uint8_t SPI_Timer_Status() {
 /* SPI controls (Platform dependent)                                     */
 /*-----------------------------------------------------------------------*/
 
-/* Exchange a byte */
+/* Set SCLK to the fastest rate not above the given frequency */
+static
+DWORD set_sclk (  /* Return value: actual SCLK [Hz] */
+  DWORD hz    /* Maximum SCLK [Hz] */
+)
+{
+  SPI_TypeDef *spi = SD_SPI_HANDLE.Instance;
+  DWORD pclk, br = 0;
+
+  /* SPI2/3 are on APB1, the others on APB2 */
+  pclk = (spi == SPI2 || spi == SPI3) ? HAL_RCC_GetPCLK1Freq() : HAL_RCC_GetPCLK2Freq();
+  while (br < 7 && (pclk >> (br + 1)) > hz) br++;   /* SCLK = PCLK / 2^(BR+1) */
+
+  CLEAR_BIT(spi->CR1, SPI_CR1_SPE);   /* BR must not change while enabled */
+  MODIFY_REG(spi->CR1, SPI_CR1_BR, br << SPI_CR1_BR_Pos);
+  SET_BIT(spi->CR1, SPI_CR1_SPE);
+
+  return pclk >> (br + 1);
+}
+
+
+/* Get the maximum transfer rate from the CSD */
+static
+DWORD csd_tran_speed (  /* Return value: TRAN_SPEED [Hz], 0:Invalid */
+  const BYTE *csd   /* CSD register */
+)
+{
+  static const BYTE tv[16] = { 0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80 };  /* Time value x10 */
+  static const DWORD ru[4] = { 10000, 100000, 1000000, 10000000 };  /* Rate unit / 10 */
+  BYTE ts = csd[3];
+
+  if ((ts & 7) > 3) return 0;       /* Rate units above 100Mbit/s are reserved */
+  return tv[(ts >> 3) & 15] * ru[ts & 7];
+}
+
+
+/* Exchange a byte (register level, the SPI is kept enabled) */
 static
 BYTE xchg_spi (
   BYTE dat  /* Data to send */
 )
 {
-  BYTE rxDat;
-    HAL_SPI_TransmitReceive(&SD_SPI_HANDLE, &dat, &rxDat, 1, 50);
-    return rxDat;
+  SPI_TypeDef *spi = SD_SPI_HANDLE.Instance;
+
+  while (!(spi->SR & SPI_SR_TXE)) ;
+  *(__IO uint8_t*)&spi->DR = dat;   /* 8 bit access, one frame */
+  while (!(spi->SR & SPI_SR_RXNE)) ;
+  return *(__IO uint8_t*)&spi->DR;
+}
+
+
+/* Exchange multiple bytes keeping the 32 bit FIFO busy */
+static
+void xchg_spi_fifo (
+  const BYTE *tx, /* Data to send (NULL: 0xFF) */
+  BYTE *rx,     /* Received data (NULL: discard) */
+  UINT n      /* Number of bytes */
+)
+{
+  SPI_TypeDef *spi = SD_SPI_HANDLE.Instance;
+  UINT ti = 0, ri = 0;
+  BYTE d;
+
+  while (ri < n) {
+    /* Not more than 4 frames in flight so the RX FIFO never overruns */
+    if (ti < n && (ti - ri) < 4 && (spi->SR & SPI_SR_TXE)) {
+      *(__IO uint8_t*)&spi->DR = tx ? tx[ti] : 0xFF;
+      ti++;
+    }
+    if (spi->SR & SPI_SR_RXNE) {
+      d = *(__IO uint8_t*)&spi->DR;
+      if (rx) rx[ri] = d;
+      ri++;
+    }
+  }
+}
+
+
+/* Is the D-Cache turned ON? */
+static
+int dcache_on (void)
+{
+  return (SCB->CCR & SCB_CCR_DC_Msk) ? 1 : 0;
+}
+
+
+/* Initialize the SPI DMA streams (called once) */
+static
+void init_spi_dma (void)
+{
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  hdma_spi1_rx.Instance                 = DMA2_Stream2;
+  hdma_spi1_rx.Init.Channel             = DMA_CHANNEL_3;
+  hdma_spi1_rx.Init.Direction           = DMA_PERIPH_TO_MEMORY;
+  hdma_spi1_rx.Init.PeriphInc           = DMA_PINC_DISABLE;
+  hdma_spi1_rx.Init.MemInc              = DMA_MINC_ENABLE;
+  hdma_spi1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma_spi1_rx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+  hdma_spi1_rx.Init.Mode                = DMA_NORMAL;
+  hdma_spi1_rx.Init.Priority            = DMA_PRIORITY_HIGH;  /* RX must not overrun */
+  hdma_spi1_rx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+  if (HAL_DMA_Init(&hdma_spi1_rx) != HAL_OK) return;
+
+  hdma_spi1_tx.Instance                 = DMA2_Stream5;
+  hdma_spi1_tx.Init.Channel             = DMA_CHANNEL_3;
+  hdma_spi1_tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+  hdma_spi1_tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+  hdma_spi1_tx.Init.MemInc              = DMA_MINC_ENABLE;
+  hdma_spi1_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma_spi1_tx.Init.MemDataAlignment    = DMA_MDATAALIGN_BYTE;
+  hdma_spi1_tx.Init.Mode                = DMA_NORMAL;
+  hdma_spi1_tx.Init.Priority            = DMA_PRIORITY_MEDIUM;
+  hdma_spi1_tx.Init.FIFOMode            = DMA_FIFOMODE_DISABLE;
+  if (HAL_DMA_Init(&hdma_spi1_tx) != HAL_OK) {
+    HAL_DMA_DeInit(&hdma_spi1_rx);
+    return;
+  }
+
+  __HAL_LINKDMA(&SD_SPI_HANDLE, hdmarx, hdma_spi1_rx);
+  __HAL_LINKDMA(&SD_SPI_HANDLE, hdmatx, hdma_spi1_tx);
+
+  HAL_NVIC_SetPriority(DMA2_Stream2_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream2_IRQn);
+  HAL_NVIC_SetPriority(DMA2_Stream5_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream5_IRQn);
+
+  /* DummyTx is never written again. Make sure the DMA sees it. */
+  if (dcache_on()) SCB_CleanDCache_by_Addr((uint32_t*)DummyTx, sizeof(DummyTx));
+
+  DmaReady = 1;
+}
+
+
+/* Wait for the end of the DMA transfer */
+static
+int wait_spi_dma (void) /* 1:OK, 0:Error or Timeout */
+{
+  uint32_t start = HAL_GetTick();
+
+  while (HAL_SPI_GetState(&SD_SPI_HANDLE) != HAL_SPI_STATE_READY) {
+    if ((HAL_GetTick() - start) >= SPI_DMA_TIMEOUT) {
+      HAL_SPI_Abort(&SD_SPI_HANDLE);  /* Stop both the streams and bring the SPI back */
+      __HAL_SPI_ENABLE(&SD_SPI_HANDLE); /* xchg_spi() expects the SPI enabled */
+      return 0;
+    }
+  }
+  return (SD_SPI_HANDLE.ErrorCode == HAL_SPI_ERROR_NONE) ? 1 : 0;
 }
 
 
 /* Receive multiple byte */
 static
-void rcvr_spi_multi (
+int rcvr_spi_multi ( /* 1:OK, 0:Error */
   BYTE *buff,   /* Pointer to data buffer */
   UINT btr    /* Number of bytes to receive (even number) */
 )
 {
-  for(UINT i=0; i<btr; i++) {
-    *(buff+i) = xchg_spi(0xFF);
+  BYTE *dst = buff;
+  int   ok;
+
+  if (!DmaReady || btr < SPI_DMA_MIN_LEN || btr > SPI_DMA_BUF_SIZE) {
+    xchg_spi_fifo(NULL, buff, btr);
+    return 1;
+  }
+
+  if (dcache_on()) {
+    /* Invalidating an unaligned buffer would also drop the neighbour's data */
+    if (((uint32_t)buff & 31) || (btr & 31)) dst = DmaBuf;
+    SCB_InvalidateDCache_by_Addr((uint32_t*)dst, btr);
+  }
+
+  if (HAL_SPI_TransmitReceive_DMA(&SD_SPI_HANDLE, (uint8_t*)DummyTx, dst, btr) != HAL_OK) return 0;
+  ok = wait_spi_dma();
+
+  if (dcache_on()) {
+    /* Drop the lines fetched speculatively while the DMA was running */
+    SCB_InvalidateDCache_by_Addr((uint32_t*)dst, btr);
   }
+  if (ok && dst != buff) memcpy(buff, dst, btr);
+
+  return ok;
 }
 
 
 #if _USE_WRITE
 /* Send multiple byte */
 static
-void xmit_spi_multi (
+int xmit_spi_multi ( /* 1:OK, 0:Error */
   const BYTE *buff, /* Pointer to the data */
   UINT btx      /* Number of bytes to send (even number) */
 )
 {
-  for(UINT i=0; i<btx; i++) {
-    xchg_spi(*(buff+i));
+  const BYTE *src = buff;
+
+  if (!DmaReady || btx < SPI_DMA_MIN_LEN || btx > SPI_DMA_BUF_SIZE) {
+    xchg_spi_fifo(buff, NULL, btx);
+    return 1;
+  }
+
+  if (dcache_on()) {
+    /* Flash (const data) is not written back, copy it to the aligned buffer like the unaligned RAM */
+    if (((uint32_t)buff & 31) || (btx & 31)) {
+      memcpy(DmaBuf, buff, btx);
+      src = DmaBuf;
+    }
+    SCB_CleanDCache_by_Addr((uint32_t*)src, btx);
   }
+
+  /* The RX FIFO is drained by the HAL at the end of the transfer */
+  if (HAL_SPI_Transmit_DMA(&SD_SPI_HANDLE, (uint8_t*)src, btx) != HAL_OK) return 0;
+
+  return wait_spi_dma();
 }
 #endif
 
@@ -189,7 +427,7 @@ int spiselect (void)  /* 1:OK, 0:Timeout */
 {
   CS_LOW();   /* Set CS# low */
   xchg_spi(0xFF); /* Dummy clock (force DO enabled) */
-  if (wait_ready(500)) return 1;  /* Wait for card ready */
+  if (wait_ready(SelectTimeout)) return 1;  /* Wait for card ready */
 
   despiselect();
   return 0; /* Timeout */
@@ -217,7 +455,7 @@ int rcvr_datablock (  /* 1:OK, 0:Error */
   } while ((token == 0xFF) && SPI_Timer_Status());
   if(token != 0xFE) return 0;   /* Function fails if invalid DataStart token or timeout */
 
-  rcvr_spi_multi(buff, btr);    /* Store trailing data to the buffer */
+  if (!rcvr_spi_multi(buff, btr)) return 0;  /* Store trailing data to the buffer */
   xchg_spi(0xFF); xchg_spi(0xFF);     /* Discard CRC */
 
   return 1;           /* Function succeeded */
@@ -243,7 +481,7 @@ int xmit_datablock (  /* 1:OK, 0:Failed */
 
   xchg_spi(token);          /* Send token */
   if (token != 0xFD) {        /* Send data if token is other than StopTran */
-    xmit_spi_multi(buff, 512);    /* Data */
+    if (!xmit_spi_multi(buff, 512)) return 0; /* Data */
     xchg_spi(0xFF); xchg_spi(0xFF); /* Dummy CRC */
 
     resp = xchg_spi(0xFF);        /* Receive data resp */
@@ -264,7 +502,7 @@ BYTE send_cmd (   /* Return value: R1 resp (bit7==1:Failed to send) */
   DWORD arg   /* Argument */
 )
 {
-  BYTE n, res;
+  BYTE n, res, buf[6];
 
 
   if (cmd & 0x80) { /* Send a CMD55 prior to ACMD<n> */
@@ -280,15 +518,16 @@ BYTE send_cmd (   /* Return value: R1 resp (bit7==1:Failed to send) */
   }
 
   /* Send command packet */
-  xchg_spi(0x40 | cmd);       /* Start + command index */
-  xchg_spi((BYTE)(arg >> 24));    /* Argument[31..24] */
-  xchg_spi((BYTE)(arg >> 16));    /* Argument[23..16] */
-  xchg_spi((BYTE)(arg >> 8));     /* Argument[15..8] */
-  xchg_spi((BYTE)arg);        /* Argument[7..0] */
+  buf[0] = 0x40 | cmd;        /* Start + command index */
+  buf[1] = (BYTE)(arg >> 24);     /* Argument[31..24] */
+  buf[2] = (BYTE)(arg >> 16);     /* Argument[23..16] */
+  buf[3] = (BYTE)(arg >> 8);      /* Argument[15..8] */
+  buf[4] = (BYTE)arg;         /* Argument[7..0] */
   n = 0x01;             /* Dummy CRC + Stop */
   if (cmd == CMD0) n = 0x95;      /* Valid CRC for CMD0(0) */
   if (cmd == CMD8) n = 0x87;      /* Valid CRC for CMD8(0x1AA) */
-  xchg_spi(n);
+  buf[5] = n;
+  xchg_spi_fifo(buf, NULL, 6);
 
   /* Receive command resp */
   if (cmd == CMD12) xchg_spi(0xFF); /* Diacard following one byte when CMD12 */
@@ -301,6 +540,160 @@ BYTE send_cmd (   /* Return value: R1 resp (bit7==1:Failed to send) */
 }
 
 
+/*-----------------------------------------------------------------------*/
+/* Is there a card in the socket?                                        */
+/*-----------------------------------------------------------------------*/
+
+static
+int probe_card (void)   /* 1:Card found, 0:No card */
+{
+  BYTE n, res = 0xFF;
+
+  /* Without a card, DO is not driven: either it never gets ready or there is no R1 */
+  SelectTimeout = SD_PROBE_TIMEOUT;
+  for (n = 2; n && res != 1; n--) res = send_cmd(CMD0, 0);  /* Put the card SPI/Idle state */
+  SelectTimeout = 500;
+
+  return (res == 1) ? 1 : 0;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Multiple block read stream                                            */
+/*-----------------------------------------------------------------------*/
+
+static
+void stream_close (void)
+{
+  if (!StreamOpen) return;
+
+  send_cmd(CMD12, 0);   /* STOP_TRANSMISSION */
+  despiselect();
+  StreamOpen = 0;
+}
+
+
+static
+UINT stream_read (  /* Return value: number of sectors read */
+  BYTE *buff,     /* Data buffer */
+  DWORD sector,   /* Start sector number (LBA) */
+  UINT count      /* Number of sectors to read */
+)
+{
+  UINT n;
+
+
+  if (StreamOpen && StreamSector != sector) stream_close();
+
+  if (!StreamOpen) {
+    if (send_cmd(CMD18, (CardType & CT_BLOCK) ? sector : sector * 512) != 0) { /* READ_MULTIPLE_BLOCK */
+      despiselect();
+      return 0;
+    }
+    StreamOpen = 1;
+  }
+
+  for (n = 0; n < count; n++) {
+    if (!rcvr_datablock(buff, 512)) {
+      stream_close();     /* The card is in an unknown state. Start again next time. */
+      break;
+    }
+    buff += 512;
+  }
+  StreamSector = sector + n;
+
+  return n;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Sector cache                                                          */
+/*-----------------------------------------------------------------------*/
+
+static
+int cache_find (  /* Return value: line, -1:Not cached */
+  DWORD sector
+)
+{
+  int i;
+
+  for (i = 0; i < SPI_CACHE_LINES; i++) {
+    if (CacheStamp[i] && CacheSector[i] == sector) return i;
+  }
+  return -1;
+}
+
+
+static
+int cache_victim (  /* Return value: empty or least recently used line */
+  DWORD first,    /* Lines of this read (first..last-1) are not evicted */
+  DWORD last
+)
+{
+  int i, v = -1;
+
+  for (i = 0; i < SPI_CACHE_LINES; i++) {
+    if (CacheStamp[i] && CacheSector[i] >= first && CacheSector[i] < last) continue;
+    if (v < 0 || CacheStamp[i] < CacheStamp[v]) v = i;
+  }
+  return v;
+}
+
+
+static
+DRESULT cache_read (
+  BYTE *buff,     /* Data buffer */
+  DWORD sector    /* Sector number (LBA) */
+)
+{
+  int i, v;
+  DWORD ra;
+
+
+  i = cache_find(sector);
+  if (i < 0) {
+    /* Read ahead until a sector that is already cached. The stream makes it one command. */
+    for (ra = 0; ra < SPI_RA_SECTORS; ra++) {
+      if (ra && cache_find(sector + ra) >= 0) break;
+      v = cache_victim(sector, sector + ra);
+      CacheStamp[v] = 0;
+      if (stream_read(CacheBuf[v], sector + ra, 1) != 1) break;
+      CacheSector[v] = sector + ra;
+      CacheStamp[v] = 1;
+      if (!ra) i = v;
+    }
+    if (i < 0) return RES_ERROR;
+  }
+
+  CacheStamp[i] = ++CacheClock;
+  memcpy(buff, CacheBuf[i], 512);
+
+  return RES_OK;
+}
+
+
+static
+void cache_update (
+  const BYTE *buff, /* Written data (NULL:Drop the lines) */
+  DWORD sector,   /* Start sector number (LBA) */
+  UINT count      /* Number of sectors */
+)
+{
+  int i;
+
+  for (i = 0; i < SPI_CACHE_LINES; i++) {
+    if (!CacheStamp[i] || CacheSector[i] < sector || CacheSector[i] >= sector + count) continue;
+    if (buff) {
+      memcpy(CacheBuf[i], buff + (CacheSector[i] - sector) * 512, 512);
+    } else {
+      CacheStamp[i] = 0;
+    }
+  }
+}
+
+
+
 /*--------------------------------------------------------------------------
 
    Public FatFs Functions (wrapped in user_diskio.c)
@@ -322,18 +715,31 @@ inline DSTATUS USER_SPI_initialize (
   BYTE drv    /* Physical drive number (0) */
 )
 {
-  BYTE n, cmd, ty, ocr[4];
+  BYTE n, cmd, ty, ocr[4], csd[16];
+  DWORD sclk = 0;
 
   if (drv != 0) return STA_NOINIT;    /* Supports only drive 0 */
+
+#ifdef SD_CD_Pin
+  if (HAL_GPIO_ReadPin(SD_CD_GPIO_Port, SD_CD_Pin) != SD_CD_ACTIVE) { /* Is card existing in the soket? */
+    Stat = STA_NOINIT | STA_NODISK;
+    return Stat;
+  }
+#endif
+
   //assume SPI already init init_spi(); /* Initialize SPI */
+  if (!DmaReady) init_spi_dma();    /* Sector transfers go through the DMA */
 
-  if (Stat & STA_NODISK) return Stat; /* Is card existing in the soket? */
+  stream_close();           /* The card may have been changed */
+  memset(CacheStamp, 0, sizeof(CacheStamp));
 
-  FCLK_SLOW();
+  set_sclk(SCLK_INIT);        /* Also enables the SPI for xchg_spi() */
   for (n = 10; n; n--) xchg_spi(0xFF);  /* Send 80 dummy clocks */
 
   ty = 0;
-  if (send_cmd(CMD0, 0) == 1) {     /* Put the card SPI/Idle state */
+  Stat |= STA_NODISK;
+  if (probe_card()) {         /* Card in the SPI/Idle state */
+    Stat &= ~STA_NODISK;
     SPI_Timer_On(1000);         /* Initialization timeout = 1 sec */
     if (send_cmd(CMD8, 0x1AA) == 1) { /* SDv2? */
       for (n = 0; n < 4; n++) ocr[n] = xchg_spi(0xFF);  /* Get 32 bit return value of R7 resp */
@@ -356,13 +762,17 @@ inline DSTATUS USER_SPI_initialize (
     }
   }
   CardType = ty;  /* Card type */
+  if (ty && send_cmd(CMD9, 0) == 0 && rcvr_datablock(csd, 16)) {  /* Get the max rate from the CSD */
+    sclk = csd_tran_speed(csd);
+  }
   despiselect();
 
   if (ty) {     /* OK */
-    FCLK_FAST();      /* Set fast clock */
+    if (!sclk) sclk = SCLK_DEFAULT;
+    set_sclk((sclk < SCLK_MAX) ? sclk : SCLK_MAX);  /* Set fast clock */
     Stat &= ~STA_NOINIT;  /* Clear STA_NOINIT flag */
   } else {      /* Failed */
-    Stat = STA_NOINIT;
+    Stat = STA_NOINIT | (Stat & STA_NODISK);
   }
 
   return Stat;
@@ -399,26 +809,10 @@ inline DRESULT USER_SPI_read (
   if (drv || !count) return RES_PARERR;   /* Check parameter */
   if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check if drive is ready */
 
-  if (!(CardType & CT_BLOCK)) sector *= 512;  /* LBA ot BA conversion (byte addressing cards) */
+  if (count == 1) return cache_read(buff, sector);  /* Single sector read */
 
-  if (count == 1) { /* Single sector read */
-    if ((send_cmd(CMD17, sector) == 0)  /* READ_SINGLE_BLOCK */
-      && rcvr_datablock(buff, 512)) {
-      count = 0;
-    }
-  }
-  else {        /* Multiple sector read */
-    if (send_cmd(CMD18, sector) == 0) { /* READ_MULTIPLE_BLOCK */
-      do {
-        if (!rcvr_datablock(buff, 512)) break;
-        buff += 512;
-      } while (--count);
-      send_cmd(CMD12, 0);       /* STOP_TRANSMISSION */
-    }
-  }
-  despiselect();
-
-  return count ? RES_ERROR : RES_OK;  /* Return result */
+  /* Multiple sector read. The stream is left open for the next one. */
+  return (stream_read(buff, sector, count) == count) ? RES_OK : RES_ERROR;
 }
 
 
@@ -435,10 +829,17 @@ inline DRESULT USER_SPI_write (
   UINT count      /* Number of sectors to write (1..128) */
 )
 {
+  const BYTE *wbuff = buff;
+  DWORD wsector = sector;
+  UINT wcount = count;
+
+
   if (drv || !count) return RES_PARERR;   /* Check parameter */
   if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check drive status */
   if (Stat & STA_PROTECT) return RES_WRPRT; /* Check write protect */
 
+  stream_close();
+
   if (!(CardType & CT_BLOCK)) sector *= 512;  /* LBA ==> BA conversion (byte addressing cards) */
 
   if (count == 1) { /* Single sector write */
@@ -459,6 +860,8 @@ inline DRESULT USER_SPI_write (
   }
   despiselect();
 
+  cache_update(count ? NULL : wbuff, wsector, wcount);  /* Sectors are unknown if the write failed */
+
   return count ? RES_ERROR : RES_OK;  /* Return result */
 }
 #endif
@@ -483,6 +886,7 @@ inline DRESULT USER_SPI_ioctl (
   if (drv) return RES_PARERR;         /* Check parameter */
   if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check if drive is ready */
 
+  stream_close();
   res = RES_ERROR;
 
   switch (cmd) {
@@ -531,6 +935,7 @@ inline DRESULT USER_SPI_ioctl (
     if (USER_SPI_ioctl(drv, MMC_GET_CSD, csd)) break; /* Get CSD */
     if (!(csd[0] >> 6) && !(csd[10] & 0x40)) break; /* Check if sector erase can be applied to the card */
     dp = buff; st = dp[0]; ed = dp[1];        /* Load sector block */
+    cache_update(NULL, st, ed - st + 1);
     if (!(CardType & CT_BLOCK)) {
       st *= 512; ed *= 512;
     }
@@ -548,3 +953,24 @@ inline DRESULT USER_SPI_ioctl (
   return res;
 }
 #endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Release the SPI DMA streams (before jumping to the application)       */
+/*-----------------------------------------------------------------------*/
+
+void USER_SPI_deinit (void)
+{
+  stream_close();     /* Release the card */
+
+  if (!DmaReady) return;
+
+  HAL_NVIC_DisableIRQ(DMA2_Stream2_IRQn);
+  HAL_NVIC_DisableIRQ(DMA2_Stream5_IRQn);
+  HAL_DMA_DeInit(&hdma_spi1_rx);
+  HAL_DMA_DeInit(&hdma_spi1_tx);
+  SD_SPI_HANDLE.hdmarx = NULL;
+  SD_SPI_HANDLE.hdmatx = NULL;
+  DmaReady = 0;
+}
@@ -35,4 +35,7 @@ extern DRESULT USER_SPI_read (BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
   extern DRESULT USER_SPI_ioctl (BYTE pdrv, BYTE cmd, void *buff);
 #endif /* _USE_IOCTL == 1 */
 
+//stops the open read stream and releases the SPI DMA streams used for the sector transfers
+extern void USER_SPI_deinit (void);
+
 #endif
@@ -0,0 +1,415 @@
+
+/**************************************************
+
+file: etx_log_decoder.c
+purpose: Decode the tokenised logs of the bootloader (see etx_log.h)
+
+compile with the command: gcc etx_log_decoder.c ..\PcTool\RS232\rs232.c -I..\PcTool\RS232 -Wall -Wextra -o2 -o etx_log_decoder
+
+**************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "rs232.h"
+
+#define ETX_LOG_TOKEN_SOF       0xA5    // Start of record
+#define ETX_LOG_TOKEN_MAX_ARGS  ( 8 )   // Maximum arguments per record
+#define ETX_LOG_MAX_LINE        ( 1024 )
+
+/*
+ * Record decoder state
+ */
+typedef enum
+{
+  ETX_DEC_STATE_SOF     = 0,
+  ETX_DEC_STATE_ID_LO   = 1,
+  ETX_DEC_STATE_ID_HI   = 2,
+  ETX_DEC_STATE_NARGS   = 3,
+  ETX_DEC_STATE_VARINT  = 4,
+}ETX_DEC_STATE_;
+
+typedef struct
+{
+  ETX_DEC_STATE_ state;
+  uint32_t       id;
+  uint8_t        level;
+  uint8_t        nargs;
+  uint8_t        nvals;                                 // varints received
+  uint32_t       vals[ ETX_LOG_TOKEN_MAX_ARGS + 1 ];    // tick + arguments
+  uint32_t       shift;
+  uint32_t       resync;                                // skipped bytes
+}ETX_DEC_;
+
+static char     *fmt_table;
+static uint32_t  fmt_table_size;
+
+static const char level_char[] = { '-', 'E', 'W', 'I', 'D' };
+
+/* Load the format string table (<project>.logfmt) */
+static int load_fmt_table( const char *path )
+{
+  FILE *fp = fopen( path, "rb" );
+  int   ex = -1;
+
+  do
+  {
+    if( fp == NULL )
+    {
+      printf("Can not open %s\n", path);
+      break;
+    }
+
+    fseek( fp, 0L, SEEK_END );
+    fmt_table_size = ftell( fp );
+    fseek( fp, 0L, SEEK_SET );
+
+    // one extra byte to make sure the last string is terminated
+    fmt_table = calloc( 1, fmt_table_size + 1 );
+    if( fmt_table == NULL )
+    {
+      break;
+    }
+
+    if( fread( fmt_table, 1, fmt_table_size, fp ) != fmt_table_size )
+    {
+      printf("Format table read Error\n");
+      break;
+    }
+    ex = 0;
+  }while( false );
+
+  if( fp )
+  {
+    fclose( fp );
+  }
+  return ex;
+}
+
+/* Is the ID pointing to the start of a format string? */
+static bool is_valid_id( uint32_t id )
+{
+  if( id >= fmt_table_size )
+  {
+    return false;
+  }
+  return ( ( id == 0u ) || ( fmt_table[id - 1] == '\0' ) );
+}
+
+/* Rebuild the text using the format string and the raw arguments */
+static void format_record( char *out, size_t out_size, const char *fmt,
+                           const uint32_t *args, uint8_t nargs )
+{
+  size_t  len = 0u;
+  uint8_t arg = 0u;
+
+  while( ( *fmt != '\0' ) && ( len + 1u < out_size ) )
+  {
+    if( *fmt != '%' )
+    {
+      out[len++] = *fmt++;
+      continue;
+    }
+
+    // collect the conversion spec
+    char spec[32];
+    int  spec_len = 0;
+    spec[spec_len++] = *fmt++;
+
+    while( ( *fmt != '\0' ) && ( strchr( "-+ #0123456789.", *fmt ) != NULL ) &&
+           ( spec_len < 24 ) )
+    {
+      spec[spec_len++] = *fmt++;
+    }
+
+    // the target is 32bit. Drop the length modifiers.
+    while( ( *fmt != '\0' ) && ( strchr( "hlLqjzt", *fmt ) != NULL ) )
+    {
+      fmt++;
+    }
+
+    char conv = *fmt;
+    if( conv == '\0' )
+    {
+      break;
+    }
+    fmt++;
+
+    if( conv == '%' )
+    {
+      out[len++] = '%';
+      continue;
+    }
+
+    uint32_t value = ( arg < nargs ) ? args[arg] : 0u;
+    bool     valid = ( arg < nargs );
+    arg++;
+
+    int n;
+    spec[spec_len++] = conv;
+    spec[spec_len]   = '\0';
+
+    if( !valid )
+    {
+      n = snprintf( &out[len], out_size - len, "<?>" );
+    }
+    else if( ( conv == 'd' ) || ( conv == 'i' ) )
+    {
+      n = snprintf( &out[len], out_size - len, spec, (int)(int32_t)value );
+    }
+    else if( ( conv == 'u' ) || ( conv == 'x' ) || ( conv == 'X' ) || ( conv == 'o' ) )
+    {
+      n = snprintf( &out[len], out_size - len, spec, (unsigned int)value );
+    }
+    else if( conv == 'c' )
+    {
+      n = snprintf( &out[len], out_size - len, spec, (int)(char)value );
+    }
+    else if( conv == 'p' )
+    {
+      n = snprintf( &out[len], out_size - len, "0x%08X", (unsigned int)value );
+    }
+    else
+    {
+      // strings and floats are not supported in the tokenised logs
+      n = snprintf( &out[len], out_size - len, "<%c:0x%08X>", conv, (unsigned int)value );
+    }
+
+    if( n < 0 )
+    {
+      break;
+    }
+    len += (size_t)n;
+    if( len >= out_size )
+    {
+      len = out_size - 1u;
+    }
+  }
+
+  // every record is printed in its own line
+  while( ( len > 0u ) && ( ( out[len - 1u] == '\n' ) || ( out[len - 1u] == '\r' ) ) )
+  {
+    len--;
+  }
+  out[len] = '\0';
+}
+
+/* Print the decoded record */
+static void print_record( ETX_DEC_ *dec )
+{
+  char line[ETX_LOG_MAX_LINE];
+
+  if( dec->resync != 0u )
+  {
+    printf("<skipped %u bytes>\n", dec->resync);
+    dec->resync = 0u;
+  }
+
+  format_record( line, sizeof(line), &fmt_table[dec->id], &dec->vals[1], dec->nargs );
+
+  printf("[%10u ms] %c: %s\n",
+         dec->vals[0],
+         ( dec->level < sizeof(level_char) ) ? level_char[dec->level] : '?',
+         line );
+  fflush( stdout );
+}
+
+/* Feed one byte to the decoder */
+static void decode_byte( ETX_DEC_ *dec, uint8_t byte )
+{
+  switch( dec->state )
+  {
+    case ETX_DEC_STATE_SOF:
+    {
+      if( byte == ETX_LOG_TOKEN_SOF )
+      {
+        dec->state = ETX_DEC_STATE_ID_LO;
+      }
+      else
+      {
+        dec->resync++;
+      }
+    }
+    break;
+
+    case ETX_DEC_STATE_ID_LO:
+    {
+      dec->id    = byte;
+      dec->state = ETX_DEC_STATE_ID_HI;
+    }
+    break;
+
+    case ETX_DEC_STATE_ID_HI:
+    {
+      dec->id |= ( (uint32_t)byte << 8 );
+      if( is_valid_id( dec->id ) )
+      {
+        dec->state = ETX_DEC_STATE_NARGS;
+      }
+      else
+      {
+        //Not a record. Look for the next SOF.
+        dec->resync += 3u;
+        dec->state   = ETX_DEC_STATE_SOF;
+      }
+    }
+    break;
+
+    case ETX_DEC_STATE_NARGS:
+    {
+      dec->level = byte >> 4;
+      dec->nargs = byte & 0x0F;
+      dec->nvals = 0u;
+      dec->shift = 0u;
+      dec->vals[0] = 0u;
+      if( dec->nargs > ETX_LOG_TOKEN_MAX_ARGS )
+      {
+        dec->resync += 4u;
+        dec->state   = ETX_DEC_STATE_SOF;
+      }
+      else
+      {
+        dec->state = ETX_DEC_STATE_VARINT;
+      }
+    }
+    break;
+
+    case ETX_DEC_STATE_VARINT:
+    {
+      if( dec->shift < 32u )
+      {
+        dec->vals[dec->nvals] |= ( (uint32_t)( byte & 0x7F ) << dec->shift );
+      }
+      dec->shift += 7u;
+
+      if( ( byte & 0x80 ) == 0u )
+      {
+        dec->nvals++;
+        dec->shift = 0u;
+        if( dec->nvals > dec->nargs )
+        {
+          //received tick + all the arguments
+          print_record( dec );
+          dec->state = ETX_DEC_STATE_SOF;
+        }
+        else
+        {
+          dec->vals[dec->nvals] = 0u;
+        }
+      }
+    }
+    break;
+
+    default:
+    {
+      dec->state = ETX_DEC_STATE_SOF;
+    }
+    break;
+  }
+}
+
+static bool is_number( const char *str )
+{
+  if( *str == '\0' )
+  {
+    return false;
+  }
+  while( *str != '\0' )
+  {
+    if( !isdigit( (unsigned char)*str++ ) )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  int      ex  = 0;
+  ETX_DEC_ dec = { 0 };
+  uint8_t  buf[256];
+
+  do
+  {
+    if( argc <= 2 )
+    {
+      printf("Please feed the format table and the COM PORT number (or a captured log file)....!!!\n");
+      printf("Example: .\\etx_log_decoder.exe ..\\..\\Bootloader\\Release\\Bootloader.logfmt 9\n");
+      ex = -1;
+      break;
+    }
+
+    if( load_fmt_table( argv[1] ) < 0 )
+    {
+      ex = -1;
+      break;
+    }
+
+    if( is_number( argv[2] ) )
+    {
+      int comport = atoi(argv[2]) - 1;
+      char mode[]={'8','N','1',0};
+
+      printf("Opening COM%d...\n", comport+1 );
+      if( RS232_OpenComport(comport, 115200, mode, 0) )
+      {
+        printf("Can not open comport\n");
+        ex = -1;
+        break;
+      }
+
+      while( true )
+      {
+        int len = RS232_PollComport( comport, buf, sizeof(buf) );
+        if( len <= 0 )
+        {
+#ifdef _WIN32
+          Sleep(10);
+#else
+          usleep(10000);
+#endif
+          continue;
+        }
+        for( int i = 0; i < len; i++ )
+        {
+          decode_byte( &dec, buf[i] );
+        }
+      }
+    }
+    else
+    {
+      FILE *fp = fopen( argv[2], "rb" );
+      size_t len;
+
+      if( fp == NULL )
+      {
+        printf("Can not open %s\n", argv[2]);
+        ex = -1;
+        break;
+      }
+
+      while( ( len = fread( buf, 1, sizeof(buf), fp ) ) > 0u )
+      {
+        for( size_t i = 0; i < len; i++ )
+        {
+          decode_byte( &dec, buf[i] );
+        }
+      }
+      fclose( fp );
+    }
+  }while( false );
+
+  free( fmt_table );
+
+  return(ex);
+}
@@ -34,7 +34,8 @@
 
 #if defined(__linux__) || defined(__FreeBSD__)   /* Linux & FreeBSD */
 
-#define RS232_PORTNR  38
+#define RS232_PORTNR  294     /* comports[] + /dev/ttyUSB0 - 255 for the USB serial racks */
+#define RS232_TABLENR  38
 
 
 int Cport[RS232_PORTNR],
@@ -43,7 +44,7 @@ int Cport[RS232_PORTNR],
 struct termios new_port_settings,
        old_port_settings[RS232_PORTNR];
 
-const char *comports[RS232_PORTNR]={"/dev/ttyS0","/dev/ttyS1","/dev/ttyS2","/dev/ttyS3","/dev/ttyS4","/dev/ttyS5",
+const char *comports[RS232_TABLENR]={"/dev/ttyS0","/dev/ttyS1","/dev/ttyS2","/dev/ttyS3","/dev/ttyS4","/dev/ttyS5",
                                     "/dev/ttyS6","/dev/ttyS7","/dev/ttyS8","/dev/ttyS9","/dev/ttyS10","/dev/ttyS11",
                                     "/dev/ttyS12","/dev/ttyS13","/dev/ttyS14","/dev/ttyS15","/dev/ttyUSB0",
                                     "/dev/ttyUSB1","/dev/ttyUSB2","/dev/ttyUSB3","/dev/ttyUSB4","/dev/ttyUSB5",
@@ -52,11 +53,24 @@ const char *comports[RS232_PORTNR]={"/dev/ttyS0","/dev/ttyS1","/dev/ttyS2","/dev
                                     "/dev/cuau0","/dev/cuau1","/dev/cuau2","/dev/cuau3",
                                     "/dev/cuaU0","/dev/cuaU1","/dev/cuaU2","/dev/cuaU3"};
 
+static const char *RS232_PortName(int comport_number, char *buf, int size)  /* the ports after comports[] are /dev/ttyUSB<n - 38> */
+{
+  if(comport_number < RS232_TABLENR)
+  {
+    return comports[comport_number];
+  }
+
+  snprintf(buf, size, "/dev/ttyUSB%d", comport_number - RS232_TABLENR);
+  return buf;
+}
+
 int RS232_OpenComport(int comport_number, int baudrate, const char *mode, int flowctrl)
 {
   int baudr,
       status;
 
+  char name[32];
+
   if((comport_number>=RS232_PORTNR)||(comport_number<0))
   {
     printf("illegal comport number\n");
@@ -194,7 +208,7 @@ http://pubs.opengroup.org/onlinepubs/7908799/xsh/termios.h.html
 http://man7.org/linux/man-pages/man3/termios.3.html
 */
 
-  Cport[comport_number] = open(comports[comport_number], O_RDWR | O_NOCTTY | O_NDELAY);
+  Cport[comport_number] = open(RS232_PortName(comport_number, name, sizeof(name)), O_RDWR | O_NOCTTY | O_NDELAY);
   if(Cport[comport_number]==-1)
   {
     perror("unable to open comport ");
@@ -495,6 +509,47 @@ void RS232_flushRXTX(int comport_number)
 }
 
 
+void RS232_drainTX(int comport_number)  /* waits until all the written data is transmitted */
+{
+  tcdrain(Cport[comport_number]);
+}
+
+
+int RS232_GetFd(int comport_number)  /* file descriptor of the port (for poll/epoll) */
+{
+  return Cport[comport_number];
+}
+
+
+int RS232_setFlowCtrl(int comport_number, int flowctrl)  /* turns the RTS/CTS flow control on/off */
+{
+  struct termios port_settings;
+
+  if(tcgetattr(Cport[comport_number], &port_settings) == -1)
+  {
+    perror("unable to read portsettings ");
+    return(1);
+  }
+
+  if(flowctrl)
+  {
+    port_settings.c_cflag |= CRTSCTS;
+  }
+  else
+  {
+    port_settings.c_cflag &= ~CRTSCTS;
+  }
+
+  if(tcsetattr(Cport[comport_number], TCSADRAIN, &port_settings) == -1)
+  {
+    perror("unable to adjust portsettings ");
+    return(1);
+  }
+
+  return(0);
+}
+
+
 #else  /* windows */
 
 #define RS232_PORTNR  32
@@ -511,6 +566,14 @@ const char *comports[RS232_PORTNR]={"\\\\.\\COM1",  "\\\\.\\COM2",  "\\\\.\\COM3
                                     "\\\\.\\COM25", "\\\\.\\COM26", "\\\\.\\COM27", "\\\\.\\COM28",
                                     "\\\\.\\COM29", "\\\\.\\COM30", "\\\\.\\COM31", "\\\\.\\COM32"};
 
+static const char *RS232_PortName(int comport_number, char *buf, int size)
+{
+  (void)buf;
+  (void)size;
+
+  return comports[comport_number];
+}
+
 char mode_str[128];
 
 
@@ -832,6 +895,46 @@ void RS232_flushRXTX(int comport_number)
 }
 
 
+void RS232_drainTX(int comport_number)  /* waits until all the written data is transmitted */
+{
+  FlushFileBuffers(Cport[comport_number]);
+}
+
+
+int RS232_GetFd(int comport_number)  /* file descriptor of the port (for poll/epoll) */
+{
+  (void)comport_number;
+
+  return -1;  /* not available, use the HANDLE */
+}
+
+
+int RS232_setFlowCtrl(int comport_number, int flowctrl)  /* turns the RTS/CTS flow control on/off */
+{
+  DCB port_settings;
+
+  memset(&port_settings, 0, sizeof(port_settings));
+  port_settings.DCBlength = sizeof(port_settings);
+
+  if(!GetCommState(Cport[comport_number], &port_settings))
+  {
+    printf("unable to read comport cfg settings\n");
+    return(1);
+  }
+
+  port_settings.fOutxCtsFlow = flowctrl ? TRUE : FALSE;
+  port_settings.fRtsControl  = flowctrl ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
+
+  if(!SetCommState(Cport[comport_number], &port_settings))
+  {
+    printf("unable to set comport cfg settings\n");
+    return(1);
+  }
+
+  return(0);
+}
+
+
 #endif
 
 
@@ -846,7 +949,8 @@ int RS232_GetPortnr(const char *devname)
 {
   int i;
 
-  char str[32];
+  char str[32],
+       name[32];
 
 #if defined(__linux__) || defined(__FreeBSD__)   /* Linux & FreeBSD */
   strcpy(str, "/dev/");
@@ -858,7 +962,7 @@ int RS232_GetPortnr(const char *devname)
 
   for(i=0; i<RS232_PORTNR; i++)
   {
-    if(!strcmp(comports[i], str))
+    if(!strcmp(RS232_PortName(i, name, sizeof(name)), str))
     {
       return i;
     }
@@ -74,6 +74,9 @@ void RS232_disableRTS(int);
 void RS232_flushRX(int);
 void RS232_flushTX(int);
 void RS232_flushRXTX(int);
+void RS232_drainTX(int);
+int RS232_setFlowCtrl(int, int);
+int RS232_GetFd(int);
 int RS232_GetPortnr(const char *);
 
 #ifdef __cplusplus
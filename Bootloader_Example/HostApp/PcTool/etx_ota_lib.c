@@ -0,0 +1,1183 @@
+
+/**************************************************
+
+file: etx_ota_lib.c
+purpose: Host side of the ETX OTA protocol. Used by the etx_ota_app and can be
+         linked to the other tools. All the state is in the session, so many
+         sessions can run at the same time.
+
+compile with the command: gcc -c etx_ota_lib.c -IRS232 -Wall -Wextra -o2
+
+**************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "rs232.h"
+#include "etx_ota_lib.h"
+
+/* RS232_OpenComport() and RS232_CloseComport() share the port settings */
+static pthread_mutex_t rs232_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const uint32_t crc_table[0x100] = {
+  0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9, 0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005, 0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61, 0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD, 
+  0x4C11DB70, 0x48D0C6C7, 0x4593E01E, 0x4152FDA9, 0x5F15ADAC, 0x5BD4B01B, 0x569796C2, 0x52568B75, 0x6A1936C8, 0x6ED82B7F, 0x639B0DA6, 0x675A1011, 0x791D4014, 0x7DDC5DA3, 0x709F7B7A, 0x745E66CD, 
+  0x9823B6E0, 0x9CE2AB57, 0x91A18D8E, 0x95609039, 0x8B27C03C, 0x8FE6DD8B, 0x82A5FB52, 0x8664E6E5, 0xBE2B5B58, 0xBAEA46EF, 0xB7A96036, 0xB3687D81, 0xAD2F2D84, 0xA9EE3033, 0xA4AD16EA, 0xA06C0B5D, 
+  0xD4326D90, 0xD0F37027, 0xDDB056FE, 0xD9714B49, 0xC7361B4C, 0xC3F706FB, 0xCEB42022, 0xCA753D95, 0xF23A8028, 0xF6FB9D9F, 0xFBB8BB46, 0xFF79A6F1, 0xE13EF6F4, 0xE5FFEB43, 0xE8BCCD9A, 0xEC7DD02D, 
+  0x34867077, 0x30476DC0, 0x3D044B19, 0x39C556AE, 0x278206AB, 0x23431B1C, 0x2E003DC5, 0x2AC12072, 0x128E9DCF, 0x164F8078, 0x1B0CA6A1, 0x1FCDBB16, 0x018AEB13, 0x054BF6A4, 0x0808D07D, 0x0CC9CDCA, 
+  0x7897AB07, 0x7C56B6B0, 0x71159069, 0x75D48DDE, 0x6B93DDDB, 0x6F52C06C, 0x6211E6B5, 0x66D0FB02, 0x5E9F46BF, 0x5A5E5B08, 0x571D7DD1, 0x53DC6066, 0x4D9B3063, 0x495A2DD4, 0x44190B0D, 0x40D816BA, 
+  0xACA5C697, 0xA864DB20, 0xA527FDF9, 0xA1E6E04E, 0xBFA1B04B, 0xBB60ADFC, 0xB6238B25, 0xB2E29692, 0x8AAD2B2F, 0x8E6C3698, 0x832F1041, 0x87EE0DF6, 0x99A95DF3, 0x9D684044, 0x902B669D, 0x94EA7B2A, 
+  0xE0B41DE7, 0xE4750050, 0xE9362689, 0xEDF73B3E, 0xF3B06B3B, 0xF771768C, 0xFA325055, 0xFEF34DE2, 0xC6BCF05F, 0xC27DEDE8, 0xCF3ECB31, 0xCBFFD686, 0xD5B88683, 0xD1799B34, 0xDC3ABDED, 0xD8FBA05A, 
+  0x690CE0EE, 0x6DCDFD59, 0x608EDB80, 0x644FC637, 0x7A089632, 0x7EC98B85, 0x738AAD5C, 0x774BB0EB, 0x4F040D56, 0x4BC510E1, 0x46863638, 0x42472B8F, 0x5C007B8A, 0x58C1663D, 0x558240E4, 0x51435D53, 
+  0x251D3B9E, 0x21DC2629, 0x2C9F00F0, 0x285E1D47, 0x36194D42, 0x32D850F5, 0x3F9B762C, 0x3B5A6B9B, 0x0315D626, 0x07D4CB91, 0x0A97ED48, 0x0E56F0FF, 0x1011A0FA, 0x14D0BD4D, 0x19939B94, 0x1D528623, 
+  0xF12F560E, 0xF5EE4BB9, 0xF8AD6D60, 0xFC6C70D7, 0xE22B20D2, 0xE6EA3D65, 0xEBA91BBC, 0xEF68060B, 0xD727BBB6, 0xD3E6A601, 0xDEA580D8, 0xDA649D6F, 0xC423CD6A, 0xC0E2D0DD, 0xCDA1F604, 0xC960EBB3, 
+  0xBD3E8D7E, 0xB9FF90C9, 0xB4BCB610, 0xB07DABA7, 0xAE3AFBA2, 0xAAFBE615, 0xA7B8C0CC, 0xA379DD7B, 0x9B3660C6, 0x9FF77D71, 0x92B45BA8, 0x9675461F, 0x8832161A, 0x8CF30BAD, 0x81B02D74, 0x857130C3, 
+  0x5D8A9099, 0x594B8D2E, 0x5408ABF7, 0x50C9B640, 0x4E8EE645, 0x4A4FFBF2, 0x470CDD2B, 0x43CDC09C, 0x7B827D21, 0x7F436096, 0x7200464F, 0x76C15BF8, 0x68860BFD, 0x6C47164A, 0x61043093, 0x65C52D24, 
+  0x119B4BE9, 0x155A565E, 0x18197087, 0x1CD86D30, 0x029F3D35, 0x065E2082, 0x0B1D065B, 0x0FDC1BEC, 0x3793A651, 0x3352BBE6, 0x3E119D3F, 0x3AD08088, 0x2497D08D, 0x2056CD3A, 0x2D15EBE3, 0x29D4F654, 
+  0xC5A92679, 0xC1683BCE, 0xCC2B1D17, 0xC8EA00A0, 0xD6AD50A5, 0xD26C4D12, 0xDF2F6BCB, 0xDBEE767C, 0xE3A1CBC1, 0xE760D676, 0xEA23F0AF, 0xEEE2ED18, 0xF0A5BD1D, 0xF464A0AA, 0xF9278673, 0xFDE69BC4, 
+  0x89B8FD09, 0x8D79E0BE, 0x803AC667, 0x84FBDBD0, 0x9ABC8BD5, 0x9E7D9662, 0x933EB0BB, 0x97FFAD0C, 0xAFB010B1, 0xAB710D06, 0xA6322BDF, 0xA2F33668, 0xBCB4666D, 0xB8757BDA, 0xB5365D03, 0xB1F740B4, 
+};
+
+uint32_t etx_ota_crc32(uint8_t * pData, uint32_t DataLength)
+{
+    uint32_t Checksum = 0xFFFFFFFF;
+    for(unsigned int i=0; i < DataLength; i++)
+    {
+        uint8_t top = (uint8_t)(Checksum >> 24);
+        top ^= pData[i];
+        Checksum = (Checksum << 8) ^ crc_table[top];
+    }
+    return Checksum;
+}
+
+static const uint32_t sha256_k[64] = {
+  0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+  0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+  0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+  0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+  0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+  0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+  0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+  0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+#define ROTR(x, n) ( ( (x) >> (n) ) | ( (x) << ( 32 - (n) ) ) )
+
+static void sha256_block(uint32_t *state, const uint8_t *block)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h;
+
+    for(int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)block[i*4] << 24) | ((uint32_t)block[i*4+1] << 16) |
+               ((uint32_t)block[i*4+2] << 8) | (uint32_t)block[i*4+3];
+    }
+    for(int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for(int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/* Calculate the SHA-256 of the image */
+void etx_ota_sha256(uint8_t *pData, uint32_t DataLength, uint8_t *digest)
+{
+    uint32_t state[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                          0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+    uint8_t  block[64];
+    uint32_t i = 0;
+    uint64_t bit_len = (uint64_t)DataLength * 8u;
+
+    for( ; (DataLength - i) >= 64; i += 64)
+    {
+        sha256_block(state, &pData[i]);
+    }
+
+    //Last block with the padding
+    uint32_t rem = DataLength - i;
+    memset(block, 0, sizeof(block));
+    memcpy(block, &pData[i], rem);
+    block[rem] = 0x80;
+    if( rem >= 56 )
+    {
+        sha256_block(state, block);
+        memset(block, 0, sizeof(block));
+    }
+    for(int j = 0; j < 8; j++)
+    {
+        block[63 - j] = (uint8_t)(bit_len >> (j * 8));
+    }
+    sha256_block(state, block);
+
+    for(int j = 0; j < 8; j++)
+    {
+        digest[j*4]     = (uint8_t)(state[j] >> 24);
+        digest[j*4 + 1] = (uint8_t)(state[j] >> 16);
+        digest[j*4 + 2] = (uint8_t)(state[j] >> 8);
+        digest[j*4 + 3] = (uint8_t)(state[j]);
+    }
+}
+
+/* Find the image descriptor and fill the version and build ID */
+void etx_ota_image_info(uint8_t *image, uint32_t size, meta_info *info)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    info->fw_version = 0;
+    info->build_id   = 0;
+
+    for(uint32_t i = 0; (i + sizeof(ETX_APP_DESC_)) <= size; i += 4)
+    {
+        ETX_APP_DESC_ *desc = (ETX_APP_DESC_ *)&image[i];
+        if( desc->magic != ETX_APP_DESC_MAGIC )
+        {
+            continue;
+        }
+
+        info->fw_version = desc->fw_version;
+
+        //Build ID is the build time ("Oct 18 2026 12:34:56") in seconds
+        char      mon[4] = { 0 };
+        char      build_time[sizeof(desc->build_time) + 1] = { 0 };
+        struct tm tm     = { 0 };
+
+        memcpy(build_time, desc->build_time, sizeof(desc->build_time));
+        if( sscanf(build_time, "%3s %d %d %d:%d:%d", mon, &tm.tm_mday, &tm.tm_year,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 6 )
+        {
+            const char *m = strstr(months, mon);
+            tm.tm_mon   = m ? (int)((m - months) / 3) : 0;
+            tm.tm_year -= 1900;
+            tm.tm_isdst = -1;
+            info->build_id = (uint32_t)mktime(&tm);
+        }
+        break;
+    }
+}
+
+void etx_ota_delay_us(uint32_t us)
+{
+#ifdef _WIN32
+    //Sleep(ms);
+    __int64 time1 = 0, time2 = 0, freq = 0;
+
+    QueryPerformanceCounter((LARGE_INTEGER *) &time1);
+    QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
+
+    do {
+        QueryPerformanceCounter((LARGE_INTEGER *) &time2);
+    } while(((time2-time1) * 1000000) < ((__int64)us * freq));   //Counter ticks to us
+#else
+    usleep(us);
+#endif
+}
+
+/* Return the current time in ms */
+uint32_t etx_ota_get_ms(void)
+{
+#ifdef _WIN32
+  return GetTickCount();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000u + ts.tv_nsec / 1000000u);
+#endif
+}
+
+/* Map the image file to the memory (read only). The pages are read on demand
+ * and shared with the other sessions that map the same file. */
+int etx_ota_image_map(const char *file_name, uint8_t **data, uint32_t *size)
+{
+#ifdef _WIN32
+  HANDLE        file;
+  HANDLE        map;
+  LARGE_INTEGER file_size;
+
+  *data = NULL;
+  *size = 0;
+
+  file = CreateFileA( file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL, NULL );
+  if( file == INVALID_HANDLE_VALUE )
+  {
+    return -1;
+  }
+
+  if( ( !GetFileSizeEx( file, &file_size ) ) || ( file_size.QuadPart == 0 ) ||
+      ( file_size.QuadPart > UINT32_MAX ) )
+  {
+    CloseHandle( file );
+    return -1;
+  }
+
+  map = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+  if( map != NULL )
+  {
+    *data = (uint8_t *)MapViewOfFile( map, FILE_MAP_READ, 0, 0, 0 );
+    CloseHandle( map );               //View keeps the mapping
+  }
+  CloseHandle( file );
+  *size = (uint32_t)file_size.QuadPart;
+#else
+  struct stat st;
+  int         fd = open( file_name, O_RDONLY );
+
+  *data = NULL;
+  *size = 0;
+
+  if( fd < 0 )
+  {
+    return -1;
+  }
+
+  if( ( fstat( fd, &st ) != 0 ) || ( st.st_size == 0 ) || ( (uint64_t)st.st_size > UINT32_MAX ) )
+  {
+    close( fd );
+    return -1;
+  }
+
+  void *addr = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );                        //Mapping keeps the file
+  if( addr != MAP_FAILED )
+  {
+    //Image is read from the start to the end
+    madvise( addr, st.st_size, MADV_SEQUENTIAL );
+    *data = (uint8_t *)addr;
+  }
+  *size = (uint32_t)st.st_size;
+#endif
+
+  return ( *data != NULL ) ? 0 : -1;
+}
+
+/* Unmap the image file */
+void etx_ota_image_unmap(uint8_t *data, uint32_t size)
+{
+  if( data == NULL )
+  {
+    return;
+  }
+#ifdef _WIN32
+  (void)size;
+  UnmapViewOfFile( data );
+#else
+  munmap( data, size );
+#endif
+}
+
+/* printf with the session's tag. One call, so the lines of the sessions don't mix. */
+void etx_printf( ETX_OTA_SESSION_ *s, const char *fmt, ... )
+{
+  char    line[256];
+  int     len;
+  va_list args;
+
+  len = snprintf( line, sizeof(line), "%s", s->tag );
+  va_start( args, fmt );
+  vsnprintf( &line[len], sizeof(line) - len, fmt, args );
+  va_end( args );
+
+  fputs( line, stdout );
+}
+
+/* Send a part of a frame. Without the gap, the whole part is handed to the
+ * driver at once. With the gap, every byte is drained to the line before the
+ * gap, so the gap is real and not swallowed by the driver's buffer. */
+static int send_bytes( ETX_OTA_SESSION_ *s, uint8_t *buf, uint32_t len, uint32_t gap_chars )
+{
+  uint32_t sent  = 0;
+  uint32_t start = etx_ota_get_ms();
+
+  while( sent < len )
+  {
+    int n = RS232_SendBuf( s->comport, &buf[sent], gap_chars ? 1 : (int)( len - sent ) );
+    if( n < 0 )
+    {
+      return -1;
+    }
+
+    if( n == 0 )
+    {
+      //Driver's buffer is full. Let the line take some.
+      if( ( etx_ota_get_ms() - start ) > ETX_OTA_TX_TIMEOUT )
+      {
+        return -1;
+      }
+      etx_ota_delay_us( s->char_time_us );
+      continue;
+    }
+
+    sent += n;
+    start = etx_ota_get_ms();
+
+    if( gap_chars )
+    {
+      RS232_drainTX( s->comport );
+      etx_ota_delay_us( gap_chars * s->char_time_us );
+    }
+  }
+
+  return 0;
+}
+
+/* Send a frame. Returns once the frame is on the line, so the response
+ * timeout doesn't include it. */
+static int send_frame( ETX_OTA_SESSION_ *s, uint8_t *buf, uint32_t len, uint32_t gap_chars )
+{
+  if( send_bytes( s, buf, len, gap_chars ) < 0 )
+  {
+    return -1;
+  }
+
+  RS232_drainTX( s->comport );
+  return 0;
+}
+
+/* Receive len bytes. Returns the received length. */
+static int receive_bytes( int comport, uint8_t *buf, int len, uint32_t timeout_ms )
+{
+  int      received = 0;
+  uint32_t start    = etx_ota_get_ms();
+
+  while( received < len )
+  {
+    int n = RS232_PollComport( comport, &buf[received], len - received );
+    if( n > 0 )
+    {
+      received += n;
+      continue;
+    }
+
+    if( ( etx_ota_get_ms() - start ) > timeout_ms )
+    {
+      break;
+    }
+    etx_ota_delay_us(1000);
+  }
+
+  return received;
+}
+
+/* Receive one packet into s->buf. Returns the packet type or -1 if error */
+static int receive_packet( ETX_OTA_SESSION_ *s, uint32_t timeout_ms )
+{
+  int type = -1;
+
+  memset(s->buf, 0, ETX_OTA_PACKET_MAX_SIZE);
+
+  do
+  {
+    //SOF, Packet type and Len
+    if( receive_bytes( s->comport, s->buf, 4, timeout_ms ) != 4 )
+    {
+      etx_printf( s, "No Response\n");
+      break;
+    }
+
+    uint16_t data_len = s->buf[2] | ( s->buf[3] << 8 );
+    if( ( s->buf[0] != ETX_OTA_SOF ) || ( ( data_len + 9u ) > ETX_OTA_PACKET_MAX_SIZE ) )
+    {
+      etx_printf( s, "Invalid Packet\n");
+      break;
+    }
+
+    //Data, CRC and EOF
+    if( receive_bytes( s->comport, &s->buf[4], data_len + 5, timeout_ms ) != ( data_len + 5 ) )
+    {
+      etx_printf( s, "Incomplete Packet\n");
+      break;
+    }
+
+    uint32_t crc;
+    memcpy( &crc, &s->buf[4 + data_len], sizeof(crc) );
+    if( ( crc != etx_ota_crc32( &s->buf[4], data_len ) ) || ( s->buf[8 + data_len] != ETX_OTA_EOF ) )
+    {
+      etx_printf( s, "Packet CRC Err\n");
+      break;
+    }
+
+    type = s->buf[1];
+  }while( false );
+
+  return type;
+}
+
+/* read the response. Returns the status or -1 if no valid response */
+static int get_resp_status( ETX_OTA_SESSION_ *s )
+{
+  int status = -1;
+
+  memset(s->buf, 0, ETX_OTA_PACKET_MAX_SIZE);
+
+  int len = receive_bytes( s->comport, s->buf, sizeof(ETX_OTA_RESP_), ETX_OTA_RESP_TIMEOUT );
+
+  if( len == sizeof(ETX_OTA_RESP_) )
+  {
+    ETX_OTA_RESP_ *resp = (ETX_OTA_RESP_*) s->buf;
+    if( resp->packet_type == ETX_OTA_PACKET_TYPE_RESPONSE )
+    {
+      if( resp->crc == etx_ota_crc32(&resp->status, 1) )
+      {
+        status = resp->status;
+      }
+    }
+  }
+
+  return status;
+}
+
+/* read the response */
+static bool is_ack_resp_received( ETX_OTA_SESSION_ *s )
+{
+  //ACK received?
+  return ( get_resp_status( s ) == ETX_OTA_ACK );
+}
+
+/* Build the OTA START command */
+static int send_ota_start(ETX_OTA_SESSION_ *s)
+{
+  uint16_t len;
+  ETX_OTA_COMMAND_ *ota_start = (ETX_OTA_COMMAND_*)s->buf;
+  int ex = 0;
+
+  memset(s->buf, 0, ETX_OTA_PACKET_MAX_SIZE);
+
+  ota_start->sof          = ETX_OTA_SOF;
+  ota_start->packet_type  = ETX_OTA_PACKET_TYPE_CMD;
+  ota_start->data_len     = 1;
+  ota_start->cmd          = ETX_OTA_CMD_START;
+  ota_start->crc          = etx_ota_crc32( &ota_start->cmd, 1);
+  ota_start->eof          = ETX_OTA_EOF;
+
+  len = sizeof(ETX_OTA_COMMAND_);
+
+  //send OTA START
+  if( send_frame( s, s->buf, len, s->cmd_gap_chars ) < 0 )
+  {
+    etx_printf( s, "OTA START : Send Err\n");
+    ex = -1;
+  }
+
+  if( ex >= 0 )
+  {
+    if( !is_ack_resp_received( s ) )
+    {
+      //Received NACK
+      etx_printf( s, "OTA START : NACK\n");
+      ex = -1;
+    }
+  }
+  etx_printf( s, "OTA START [ex = %d]\n", ex);
+  return ex;
+}
+
+/* Send the GET_INFO command and read the device info */
+int etx_ota_get_info(ETX_OTA_SESSION_ *s, ETX_OTA_INFO_ *info)
+{
+  uint16_t len;
+  ETX_OTA_COMMAND_ *ota_info = (ETX_OTA_COMMAND_*)s->buf;
+  int ex = 0;
+
+  memset(s->buf, 0, ETX_OTA_PACKET_MAX_SIZE);
+
+  ota_info->sof          = ETX_OTA_SOF;
+  ota_info->packet_type  = ETX_OTA_PACKET_TYPE_CMD;
+  ota_info->data_len     = 1;
+  ota_info->cmd          = ETX_OTA_CMD_GET_INFO;
+  ota_info->crc          = etx_ota_crc32( &ota_info->cmd, 1);
+  ota_info->eof          = ETX_OTA_EOF;
+
+  len = sizeof(ETX_OTA_COMMAND_);
+
+  //send GET_INFO
+  if( send_frame( s, s->buf, len, s->cmd_gap_chars ) < 0 )
+  {
+    etx_printf( s, "OTA GET_INFO : Send Err\n");
+    ex = -1;
+  }
+
+  do
+  {
+    if( ex < 0 )
+    {
+      break;
+    }
+
+    int type = receive_packet( s, ETX_OTA_INFO_TIMEOUT );
+    if( type != ETX_OTA_PACKET_TYPE_INFO )
+    {
+      //Older bootloaders NACK the unknown commands
+      etx_printf( s, "OTA GET_INFO : Not supported\n");
+      ex = -1;
+      break;
+    }
+
+    uint16_t data_len = s->buf[2] | ( s->buf[3] << 8 );
+
+    //Newer devices may send more. Older devices may send less.
+    memset( info, 0, sizeof(ETX_OTA_INFO_) );
+    memcpy( info, &s->buf[4], ( data_len < sizeof(ETX_OTA_INFO_) ) ? data_len : sizeof(ETX_OTA_INFO_) );
+  }while( false );
+
+  etx_printf( s, "OTA GET_INFO [ex = %d]\n", ex);
+  return ex;
+}
+
+/* Send a command without waiting for the response */
+int etx_ota_send_cmd(ETX_OTA_SESSION_ *s, uint8_t cmd)
+{
+  ETX_OTA_COMMAND_ ota_cmd =
+  {
+    .sof         = ETX_OTA_SOF,
+    .packet_type = ETX_OTA_PACKET_TYPE_CMD,
+    .data_len    = 1,
+    .cmd         = cmd,
+    .eof         = ETX_OTA_EOF,
+  };
+  uint8_t *data = (uint8_t *)&ota_cmd;
+
+  ota_cmd.crc = etx_ota_crc32( &ota_cmd.cmd, 1 );
+
+  return send_frame( s, data, sizeof(ota_cmd), s->cmd_gap_chars );
+}
+
+/* Send the READ_BACK command */
+static int send_ota_read_back(ETX_OTA_SESSION_ *s, uint8_t region, uint32_t length, uint16_t block_size, uint8_t mode)
+{
+  ETX_OTA_READ_CMD_ read_cmd =
+  {
+    .sof         = ETX_OTA_SOF,
+    .packet_type = ETX_OTA_PACKET_TYPE_CMD,
+    .data_len    = sizeof(ETX_OTA_READ_CMD_) - 9,
+    .cmd         = ETX_OTA_CMD_READ_BACK,
+    .region      = region,
+    .offset      = 0,
+    .length      = length,
+    .block_size  = block_size,
+    .mode        = mode,
+    .eof         = ETX_OTA_EOF,
+  };
+  uint8_t *data = (uint8_t *)&read_cmd;
+
+  read_cmd.crc = etx_ota_crc32( &read_cmd.cmd, read_cmd.data_len );
+
+  if( send_frame( s, data, sizeof(read_cmd), s->cmd_gap_chars ) < 0 )
+  {
+    etx_printf( s, "OTA READ_BACK : Send Err\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* Read back the region and write it to the file */
+int etx_ota_read_back(ETX_OTA_SESSION_ *s, uint8_t region, const char *file_name)
+{
+  int      ex    = 0;
+  uint32_t total = 0;
+  FILE     *fp   = fopen(file_name, "wb");
+
+  do
+  {
+    if( fp == NULL )
+    {
+      etx_printf( s, "Can not open %s\n", file_name);
+      ex = -1;
+      break;
+    }
+
+    //Read the whole image
+    ex = send_ota_read_back( s, region, 0, ETX_OTA_DATA_MAX_SIZE, ETX_OTA_READ_MODE_DATA );
+    if( ex < 0 )
+    {
+      break;
+    }
+
+    while( true )
+    {
+      int type = receive_packet( s, ETX_OTA_RESP_TIMEOUT );
+      if( type == ETX_OTA_PACKET_TYPE_DATA )
+      {
+        uint16_t data_len = s->buf[2] | ( s->buf[3] << 8 );
+        if( fwrite( &s->buf[4], 1, data_len, fp ) != data_len )
+        {
+          etx_printf( s, "File write Error\n");
+          ex = -1;
+          break;
+        }
+        total += data_len;
+        etx_printf( s, "\rRead %u bytes", total);
+        fflush(stdout);
+      }
+      else if( ( type == ETX_OTA_PACKET_TYPE_RESPONSE ) && ( s->buf[4] == ETX_OTA_ACK ) )
+      {
+        //All done
+        etx_printf( s, "\nRead back done. %u bytes written to %s\n", total, file_name);
+        break;
+      }
+      else
+      {
+        etx_printf( s, "\nOTA READ_BACK : Err\n");
+        ex = -1;
+        break;
+      }
+    }
+  }while( false );
+
+  if( fp )
+  {
+    fclose(fp);
+  }
+  return ex;
+}
+
+/* Compare the local image with the region using the block CRCs */
+int etx_ota_verify(ETX_OTA_SESSION_ *s, uint8_t region, const char *file_name)
+{
+  int      ex         = 0;
+  uint32_t block      = 0;
+  uint32_t mismatches = 0;
+  uint32_t app_size   = 0;
+  uint8_t  *app_bin   = NULL;
+
+  do
+  {
+    if( etx_ota_image_map( file_name, &app_bin, &app_size ) < 0 )
+    {
+      etx_printf( s, "Can not read %s\n", file_name);
+      ex = -1;
+      break;
+    }
+
+    //Only the CRCs are transferred
+    ex = send_ota_read_back( s, region, app_size, ETX_OTA_VERIFY_BLOCK_SIZE, ETX_OTA_READ_MODE_CRC );
+    if( ex < 0 )
+    {
+      break;
+    }
+
+    while( true )
+    {
+      int type = receive_packet( s, ETX_OTA_RESP_TIMEOUT );
+      if( type == ETX_OTA_PACKET_TYPE_DATA )
+      {
+        uint16_t data_len = s->buf[2] | ( s->buf[3] << 8 );
+        for( uint16_t i = 0; ( i + 4 ) <= data_len; i += 4, block++ )
+        {
+          uint32_t offset = block * ETX_OTA_VERIFY_BLOCK_SIZE;
+          uint32_t len    = app_size - offset;
+          uint32_t dev_crc;
+
+          if( offset >= app_size )
+          {
+            break;
+          }
+          if( len > ETX_OTA_VERIFY_BLOCK_SIZE )
+          {
+            len = ETX_OTA_VERIFY_BLOCK_SIZE;
+          }
+
+          memcpy( &dev_crc, &s->buf[4 + i], sizeof(dev_crc) );
+          if( dev_crc != etx_ota_crc32( &app_bin[offset], len ) )
+          {
+            etx_printf( s, "Block %u (0x%08X - 0x%08X) mismatch\n", block, offset, offset + len - 1);
+            mismatches++;
+          }
+        }
+      }
+      else if( ( type == ETX_OTA_PACKET_TYPE_RESPONSE ) && ( s->buf[4] == ETX_OTA_ACK ) )
+      {
+        break;
+      }
+      else
+      {
+        etx_printf( s, "OTA READ_BACK : Err\n");
+        ex = -1;
+        break;
+      }
+    }
+
+    if( ex < 0 )
+    {
+      break;
+    }
+
+    if( ( mismatches != 0 ) || ( block * ETX_OTA_VERIFY_BLOCK_SIZE < app_size ) )
+    {
+      etx_printf( s, "Verify : FAILED (%u blocks mismatch)\n", mismatches);
+      ex = -1;
+      break;
+    }
+    etx_printf( s, "Verify : OK (%u blocks)\n", block);
+  }while( false );
+
+  etx_ota_image_unmap( app_bin, app_size );
+  return ex;
+}
+
+/* Build and Send the OTA END command */
+static int send_ota_end(ETX_OTA_SESSION_ *s)
+{
+  uint16_t len;
+  ETX_OTA_COMMAND_ *ota_end = (ETX_OTA_COMMAND_*)s->buf;
+  int ex = 0;
+
+  memset(s->buf, 0, ETX_OTA_PACKET_MAX_SIZE);
+
+  ota_end->sof          = ETX_OTA_SOF;
+  ota_end->packet_type  = ETX_OTA_PACKET_TYPE_CMD;
+  ota_end->data_len     = 1;
+  ota_end->cmd          = ETX_OTA_CMD_END;
+  ota_end->crc          = etx_ota_crc32( &ota_end->cmd, 1);
+  ota_end->eof          = ETX_OTA_EOF;
+
+  len = sizeof(ETX_OTA_COMMAND_);
+
+  //send OTA END
+  if( send_frame( s, s->buf, len, s->cmd_gap_chars ) < 0 )
+  {
+    etx_printf( s, "OTA END : Send Err\n");
+    ex = -1;
+  }
+
+  if( ex >= 0 )
+  {
+    if( !is_ack_resp_received( s ) )
+    {
+      //Received NACK
+      etx_printf( s, "OTA END : NACK\n");
+      ex = -1;
+    }
+  }
+  etx_printf( s, "OTA END [ex = %d]\n", ex);
+  return ex;
+}
+
+/* Build and send the OTA Header.
+ * Returns 1 if the device already has this image */
+static int send_ota_header(ETX_OTA_SESSION_ *s, meta_info *ota_info)
+{
+  uint16_t len;
+  ETX_OTA_HEADER_ *ota_header = (ETX_OTA_HEADER_*)s->buf;
+  int ex = 0;
+
+  memset(s->buf, 0, ETX_OTA_PACKET_MAX_SIZE);
+
+  ota_header->sof          = ETX_OTA_SOF;
+  ota_header->packet_type  = ETX_OTA_PACKET_TYPE_HEADER;
+  ota_header->data_len     = sizeof(meta_info);
+  ota_header->crc          = etx_ota_crc32( (uint8_t*)ota_info, sizeof(meta_info));
+  ota_header->eof          = ETX_OTA_EOF;
+
+  memcpy(&ota_header->meta_data, ota_info, sizeof(meta_info) );
+
+  len = sizeof(ETX_OTA_HEADER_);
+
+  //send OTA Header
+  if( send_frame( s, s->buf, len, s->cmd_gap_chars ) < 0 )
+  {
+    etx_printf( s, "OTA HEADER : Send Err\n");
+    ex = -1;
+  }
+
+  if( ex >= 0 )
+  {
+    int status = get_resp_status( s );
+    if( status == ETX_OTA_ALREADY )
+    {
+      //Device has this image. It has activated that, no need to send.
+      ex = 1;
+    }
+    else if( status != ETX_OTA_ACK )
+    {
+      //Received NACK
+      etx_printf( s, "OTA HEADER : NACK\n");
+      ex = -1;
+    }
+  }
+  etx_printf( s, "OTA HEADER [ex = %d]\n", ex);
+  return ex;
+}
+
+/* Build and send the OTA Data. The data is sent from the image itself, only
+ * the head (SOF, type, length) and the tail (CRC, EOF) are built. */
+static int send_ota_data(ETX_OTA_SESSION_ *s, uint8_t *data, uint16_t data_len)
+{
+  ETX_OTA_DATA_ *ota_data = (ETX_OTA_DATA_*)s->buf;
+  uint8_t       *tail     = &s->buf[4];
+  uint32_t      crc       = etx_ota_crc32( data, data_len);
+  int ex = 0;
+
+  ota_data->sof          = ETX_OTA_SOF;
+  ota_data->packet_type  = ETX_OTA_PACKET_TYPE_DATA;
+  ota_data->data_len     = data_len;
+
+  memcpy(tail, (uint8_t*)&crc, sizeof(crc) );
+  tail[sizeof(crc)] = ETX_OTA_EOF;
+
+  //etx_printf( s, "Sending %d Data\n", data_len + ETX_OTA_DATA_OVERHEAD);
+
+  //send OTA Data
+  if( ( send_bytes( s, s->buf, 4, s->data_gap_chars ) < 0 ) ||
+      ( send_bytes( s, data, data_len, s->data_gap_chars ) < 0 ) ||
+      ( send_frame( s, tail, sizeof(crc) + 1, s->data_gap_chars ) < 0 ) )
+  {
+    etx_printf( s, "OTA DATA : Send Err\n");
+    ex = -1;
+  }
+
+  if( ex >= 0 )
+  {
+    if( !is_ack_resp_received( s ) )
+    {
+      //Received NACK
+      etx_printf( s, "OTA DATA : NACK\n");
+      ex = -1;
+    }
+  }
+  //etx_printf( s, "OTA DATA [ex = %d]\n", ex);
+  return ex;
+}
+
+/* Set the session to the legacy transfer mode. Nothing is sent. */
+void etx_ota_init( ETX_OTA_SESSION_ *s, int comport, int bdrate )
+{
+  s->comport         = comport;
+  s->is_info         = false;
+  s->cmd_gap_chars   = ETX_OTA_CMD_GAP_CHARS;
+  s->data_gap_chars  = ETX_OTA_DATA_GAP_CHARS;
+  s->char_time_us    = 1000000u * 10u / bdrate;
+  s->data_chunk_size = ETX_OTA_DATA_MAX_SIZE;
+  s->start_ms        = etx_ota_get_ms();
+  s->is_started      = true;
+}
+
+/* Select the fastest transfer mode from the device info (s->dev_info) */
+void etx_ota_set_mode( ETX_OTA_SESSION_ *s, int bdrate )
+{
+  if( s->is_info )
+  {
+    if( s->dev_info.features & ETX_OTA_FEATURE_STREAM )
+    {
+      //Device receives the whole frame in one go. No need to wait.
+      s->cmd_gap_chars  = 0;
+      s->data_gap_chars = 0;
+    }
+
+    if( s->dev_info.features & ETX_OTA_FEATURE_FLOW_CTRL )
+    {
+      //Device holds us with RTS while it is busy. No gaps at all.
+      if( RS232_setFlowCtrl( s->comport, 1 ) == 0 )
+      {
+        s->cmd_gap_chars  = 0;
+        s->data_gap_chars = 0;
+        s->is_flow_ctrl   = true;
+      }
+    }
+
+    if( ( s->dev_info.baudrate != 0 ) && ( s->dev_info.baudrate != (uint32_t)bdrate ) )
+    {
+      etx_printf( s, "Device runs at %u baud. Expect errors.\n", s->dev_info.baudrate);
+    }
+
+    if( ( s->dev_info.max_data_size != 0 ) && ( s->dev_info.max_data_size < s->data_chunk_size ) )
+    {
+      s->data_chunk_size = s->dev_info.max_data_size;
+    }
+  }
+  else
+  {
+    etx_printf( s, "Device info is not available. Using the legacy mode.\n");
+  }
+  etx_printf( s, "Transfer mode : %s%s, %d bytes per frame\n",
+              s->data_gap_chars ? "Legacy" : "Stream", s->is_flow_ctrl ? " (RTS/CTS)" : "",
+              s->data_chunk_size);
+}
+
+/* Fill the OTA header of the mapped image */
+void etx_ota_get_meta( ETX_OTA_SESSION_ *s, bool is_bootloader, meta_info *ota_info )
+{
+  memset( ota_info, 0, sizeof(meta_info) );
+  ota_info->package_size = s->image_size;
+  ota_info->package_crc  = etx_ota_crc32( s->image, s->image_size);
+  etx_ota_sha256( s->image, s->image_size, ota_info->digest );
+  etx_ota_image_info( s->image, s->image_size, ota_info );
+  ota_info->image_type   = is_bootloader ? ETX_OTA_IMAGE_BOOTLOADER : ETX_OTA_IMAGE_APP;
+
+  if( ota_info->fw_version != 0u )
+  {
+    etx_printf( s, "Image Version = %d.%d.%d, Build ID = %u\n", (ota_info->fw_version >> 16) & 0xFF,
+                (ota_info->fw_version >> 8) & 0xFF, ota_info->fw_version & 0xFF, ota_info->build_id);
+  }
+}
+
+/* Open the port in the legacy transfer mode. Nothing is sent.
+ * The session must be zeroed before the first open. */
+int etx_ota_open_port( ETX_OTA_SESSION_ *s, int comport, int bdrate )
+{
+  char mode[]={'8','N','1',0}; /* *-bits, No parity, 1 stop bit */
+  int  ex;
+
+  etx_ota_init( s, comport, bdrate );
+
+  etx_printf( s, "Opening COM%d...\n", comport+1 );
+
+  pthread_mutex_lock( &rs232_lock );
+  ex = RS232_OpenComport(comport, bdrate, mode, 0);
+  pthread_mutex_unlock( &rs232_lock );
+  if( ex )
+  {
+    etx_printf( s, "Can not open comport\n");
+    s->comport = -1;
+    return -1;
+  }
+
+  //Drop the stale data (if any) from the previous session
+  RS232_flushRX( comport );
+
+  return 0;
+}
+
+/* Open the port and select the fastest transfer mode the device supports.
+ * The session must be zeroed before the first open. */
+int etx_ota_open( ETX_OTA_SESSION_ *s, int comport, int bdrate )
+{
+  if( etx_ota_open_port( s, comport, bdrate ) < 0 )
+  {
+    return -1;
+  }
+
+  //Find what the device supports and select the fastest transfer mode
+  if( etx_ota_get_info( s, &s->dev_info ) == 0 )
+  {
+    s->is_info = true;
+  }
+  etx_ota_set_mode( s, bdrate );
+
+  return 0;
+}
+
+/* Close the port and unmap the image. Waits for the async update (if any). */
+void etx_ota_close( ETX_OTA_SESSION_ *s )
+{
+  etx_ota_wait( s );
+
+  if( s->comport >= 0 )
+  {
+    pthread_mutex_lock( &rs232_lock );
+    RS232_CloseComport( s->comport );
+    pthread_mutex_unlock( &rs232_lock );
+    s->comport = -1;
+  }
+
+  etx_ota_image_unmap( s->image, s->image_size );
+  s->image = NULL;
+}
+
+/* Send the image to the device */
+int etx_ota_update( ETX_OTA_SESSION_ *s, const char *bin_name, bool is_bootloader )
+{
+  int  ex = 0;
+
+  s->sent = 0;
+  atomic_store_explicit( &s->is_done, false, memory_order_relaxed );
+
+  do
+  {
+    if( ( is_bootloader ) && ( !( s->dev_info.features & ETX_OTA_FEATURE_BL_UPDATE ) ) )
+    {
+      //Older bootloaders would take it as an application
+      etx_printf( s, "Device doesn't support the bootloader update\n");
+      ex = -1;
+      break;
+    }
+
+    etx_printf( s, "Opening Binary file : %s\n", bin_name);
+
+    uint32_t image_size;
+    if( etx_ota_image_map( bin_name, &s->image, &image_size ) < 0 )
+    {
+      etx_printf( s, "Can not read %s\n", bin_name);
+      ex = -1;
+      break;
+    }
+    s->image_size = image_size;
+
+    etx_printf( s, "File size = %u\n", s->image_size);
+
+    //send OTA Start command
+    ex = send_ota_start(s);
+    if( ex < 0 )
+    {
+      etx_printf( s, "send_ota_start Err\n");
+      break;
+    }
+
+    //Send OTA Header
+    meta_info ota_info;
+    etx_ota_get_meta( s, is_bootloader, &ota_info );
+
+    ex = send_ota_header( s, &ota_info );
+    if( ex < 0 )
+    {
+      etx_printf( s, "send_ota_header Err\n");
+      break;
+    }
+    else if( ex > 0 )
+    {
+      if( is_bootloader )
+      {
+        etx_printf( s, "Device is already running this bootloader.\n");
+      }
+      else
+      {
+        etx_printf( s, "Device already has this image. Activated it without the download.\n");
+      }
+      s->sent = s->image_size;
+      ex = 0;
+      break;
+    }
+
+    uint16_t size = 0;
+
+    for( uint32_t i = 0; i < s->image_size; )
+    {
+      if( ( s->image_size - i ) >= s->data_chunk_size )
+      {
+        size = s->data_chunk_size;
+      }
+      else
+      {
+        size = s->image_size - i;
+      }
+
+      ex = send_ota_data( s, &s->image[i], size );
+      if( ex < 0 )
+      {
+        etx_printf( s, "send_ota_data Err [i=%d]\n", i);
+        break;
+      }
+
+      i += size;
+      s->sent = i;
+
+      if( s->progress_cb )
+      {
+        s->progress_cb( s->cb_arg, s->sent, s->image_size );
+      }
+    }
+
+    if( ex < 0 )
+    {
+      break;
+    }
+
+    //send OTA END command
+    ex = send_ota_end(s);
+    if( ex < 0 )
+    {
+      etx_printf( s, "send_ota_end Err\n");
+      break;
+    }
+
+  } while (false);
+
+  etx_ota_set_done( s, ex );
+
+  return ex;
+}
+
+/* Thread of the async update */
+static void *etx_ota_update_thread( void *arg )
+{
+  ETX_OTA_SESSION_ *s = (ETX_OTA_SESSION_ *)arg;
+
+  etx_ota_update( s, s->bin_name, s->is_bootloader );
+
+  return NULL;
+}
+
+/* Start the update in the background. bin_name must stay valid until the
+ * update is done. progress_cb (optional) is called from the update's thread. */
+int etx_ota_update_start( ETX_OTA_SESSION_ *s, const char *bin_name, bool is_bootloader,
+                          ETX_OTA_PROGRESS_CB_ progress_cb, void *cb_arg )
+{
+  if( s->is_async )
+  {
+    //One update at a time
+    return -1;
+  }
+
+  s->bin_name      = bin_name;
+  s->is_bootloader = is_bootloader;
+  s->progress_cb   = progress_cb;
+  s->cb_arg        = cb_arg;
+  s->sent          = 0;
+  atomic_store_explicit( &s->is_done, false, memory_order_relaxed );
+
+  if( pthread_create( &s->thread, NULL, etx_ota_update_thread, s ) != 0 )
+  {
+    etx_printf( s, "Can not start the update\n");
+    return -1;
+  }
+
+  s->is_async = true;
+  return 0;
+}
+
+/* Publish the result of the update. ex and end_ms are written before the
+ * flag, so a thread that sees the flag also sees them. */
+void etx_ota_set_done( ETX_OTA_SESSION_ *s, int ex )
+{
+  s->ex     = ex;
+  s->end_ms = etx_ota_get_ms();
+  atomic_store_explicit( &s->is_done, true, memory_order_release );
+}
+
+/* Returns true once the update is done. s->ex and s->end_ms can be read
+ * after that. */
+bool etx_ota_is_done( ETX_OTA_SESSION_ *s )
+{
+  return atomic_load_explicit( &s->is_done, memory_order_acquire );
+}
+
+/* Wait for the async update. Returns the result of the update. */
+int etx_ota_wait( ETX_OTA_SESSION_ *s )
+{
+  if( s->is_async )
+  {
+    pthread_join( s->thread, NULL );
+    s->is_async = false;
+  }
+
+  return s->ex;
+}
@@ -0,0 +1,87 @@
+/*
+ * etx_ota_lib.h
+ *
+ *  Created on: 18-Oct-2026
+ *      Author: EmbeTronicX
+ */
+
+#ifndef INC_ETX_OTA_LIB_H_
+#define INC_ETX_OTA_LIB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "etx_ota_update_main.h"
+
+/*
+ * Progress of the update. Called after each data frame.
+ */
+typedef void (*ETX_OTA_PROGRESS_CB_)( void *arg, uint32_t sent, uint32_t total );
+
+/*
+ * Host session. One per device, so that many devices can be updated at the
+ * same time. Nothing is shared between the sessions.
+ * Zero it before the first etx_ota_open().
+ */
+typedef struct
+{
+  int                  comport;                     // RS232 port number (COM number - 1)
+  char                 tag[24];                     // Printed before the messages ("[COM8] ")
+  bool                 is_info;                     // Device info was read
+  ETX_OTA_INFO_        dev_info;                    // Device info (zero if not available)
+  uint32_t             cmd_gap_chars;               // Idle characters between the bytes of the commands
+  uint32_t             data_gap_chars;              // Idle characters between the bytes of the data frames
+  uint32_t             char_time_us;                // Time of one character on the link (8N1)
+  uint16_t             data_chunk_size;             // Data size in one frame
+  bool                 is_flow_ctrl;                // RTS/CTS flow control is on
+  uint8_t              buf[ETX_OTA_PACKET_MAX_SIZE];// Frame buffer
+  uint8_t              *image;                      // Image to send (mapped file)
+  ETX_OTA_PROGRESS_CB_ progress_cb;                 // Progress callback (optional)
+  void                 *cb_arg;                     // Argument of the progress callback
+  /* Async update */
+  const char           *bin_name;
+  bool                 is_bootloader;
+  bool                 is_async;                    // Update thread is running (or not joined yet)
+  pthread_t            thread;
+  /* Progress. Can be read by the other threads while the update runs. */
+  _Atomic uint32_t     image_size;
+  _Atomic uint32_t     sent;                        // Image bytes sent
+  _Atomic uint32_t     start_ms;
+  atomic_bool          is_started;                  // start_ms is set
+  atomic_bool          is_done;                     // ex and end_ms are set (see etx_ota_is_done())
+  uint32_t             end_ms;
+  int                  ex;                          // Result (0 - OK)
+}ETX_OTA_SESSION_;
+
+/* Utilities */
+uint32_t etx_ota_crc32(uint8_t * pData, uint32_t DataLength);
+void     etx_ota_sha256(uint8_t *pData, uint32_t DataLength, uint8_t *digest);
+void     etx_ota_image_info(uint8_t *image, uint32_t size, meta_info *info);
+void     etx_ota_delay_us(uint32_t us);
+uint32_t etx_ota_get_ms(void);
+int      etx_ota_image_map(const char *file_name, uint8_t **data, uint32_t *size);
+void     etx_ota_image_unmap(uint8_t *data, uint32_t size);
+
+/* Session */
+void etx_printf( ETX_OTA_SESSION_ *s, const char *fmt, ... );
+void etx_ota_init( ETX_OTA_SESSION_ *s, int comport, int bdrate );
+void etx_ota_set_mode( ETX_OTA_SESSION_ *s, int bdrate );
+void etx_ota_get_meta( ETX_OTA_SESSION_ *s, bool is_bootloader, meta_info *ota_info );
+int  etx_ota_open_port( ETX_OTA_SESSION_ *s, int comport, int bdrate );
+int  etx_ota_open( ETX_OTA_SESSION_ *s, int comport, int bdrate );
+void etx_ota_close( ETX_OTA_SESSION_ *s );
+int  etx_ota_get_info(ETX_OTA_SESSION_ *s, ETX_OTA_INFO_ *info);
+int  etx_ota_send_cmd(ETX_OTA_SESSION_ *s, uint8_t cmd);
+int  etx_ota_read_back(ETX_OTA_SESSION_ *s, uint8_t region, const char *file_name);
+int  etx_ota_verify(ETX_OTA_SESSION_ *s, uint8_t region, const char *file_name);
+int  etx_ota_update( ETX_OTA_SESSION_ *s, const char *bin_name, bool is_bootloader );
+
+/* Async update */
+int  etx_ota_update_start( ETX_OTA_SESSION_ *s, const char *bin_name, bool is_bootloader,
+                           ETX_OTA_PROGRESS_CB_ progress_cb, void *cb_arg );
+void etx_ota_set_done( ETX_OTA_SESSION_ *s, int ex );
+bool etx_ota_is_done( ETX_OTA_SESSION_ *s );
+int  etx_ota_wait( ETX_OTA_SESSION_ *s );
+
+#endif /* INC_ETX_OTA_LIB_H_ */
@@ -0,0 +1,741 @@
+
+/**************************************************
+
+file: etx_ota_loop.c
+purpose: Update many devices from one thread. Each session is a state machine
+         driven by the epoll events of its port and a timer wheel for the
+         ACK timeouts. Linux only.
+
+compile with the command: gcc -c etx_ota_loop.c -IRS232 -Wall -Wextra -o2
+
+**************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "etx_ota_loop.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include "rs232.h"
+
+/*
+ * Event loop. Every session has one timer at most, so the wheel is a list of
+ * the sessions in each slot.
+ */
+typedef struct
+{
+  int                 epfd;
+  int                 bdrate;
+  int                 nb_active;                      // Sessions not done yet
+  int                 nb_timers;                      // Sessions in the wheel
+  uint32_t            tick;                           // Last processed ms
+  ETX_OTA_EV_SESSION_ *wheel[ETX_OTA_WHEEL_SIZE];
+}ETX_OTA_LOOP_;
+
+static void ev_tx( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev );
+
+/* Start the session's timer. Replaces the running one. */
+static void ev_timer_start( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev, uint32_t ms )
+{
+  ETX_OTA_EV_SESSION_ **slot;
+
+  if( ev->is_timer )
+  {
+    //Unlink from the old slot
+    if( ev->prev )
+    {
+      ev->prev->next = ev->next;
+    }
+    else
+    {
+      loop->wheel[ev->expire_ms % ETX_OTA_WHEEL_SIZE] = ev->next;
+    }
+    if( ev->next )
+    {
+      ev->next->prev = ev->prev;
+    }
+    loop->nb_timers--;
+  }
+
+  ev->expire_ms = etx_ota_get_ms() + ( ms ? ms : 1u );
+  ev->is_timer  = true;
+
+  slot     = &loop->wheel[ev->expire_ms % ETX_OTA_WHEEL_SIZE];
+  ev->prev = NULL;
+  ev->next = *slot;
+  if( *slot )
+  {
+    (*slot)->prev = ev;
+  }
+  *slot = ev;
+  loop->nb_timers++;
+}
+
+/* Stop the session's timer */
+static void ev_timer_stop( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  if( !ev->is_timer )
+  {
+    return;
+  }
+
+  if( ev->prev )
+  {
+    ev->prev->next = ev->next;
+  }
+  else
+  {
+    loop->wheel[ev->expire_ms % ETX_OTA_WHEEL_SIZE] = ev->next;
+  }
+  if( ev->next )
+  {
+    ev->next->prev = ev->prev;
+  }
+
+  ev->next     = NULL;
+  ev->prev     = NULL;
+  ev->is_timer = false;
+  loop->nb_timers--;
+}
+
+/* Time to the next timer (ms). -1 if there is no timer. */
+static int ev_timer_next( ETX_OTA_LOOP_ *loop )
+{
+  uint32_t now = etx_ota_get_ms();
+
+  if( loop->nb_timers == 0 )
+  {
+    return -1;
+  }
+
+  //First non-empty slot. The timer there may be in a later round. That only
+  //costs a wakeup.
+  for( uint32_t i = 1; i <= ETX_OTA_WHEEL_SIZE; i++ )
+  {
+    if( loop->wheel[( loop->tick + i ) % ETX_OTA_WHEEL_SIZE] )
+    {
+      int32_t wait = (int32_t)( loop->tick + i - now );
+      return ( wait > 0 ) ? wait : 0;
+    }
+  }
+
+  return ETX_OTA_WHEEL_SIZE;
+}
+
+/* Wait (or not) for the room in the driver's buffer */
+static void ev_wait_tx( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev, bool is_wait )
+{
+  struct epoll_event event;
+
+  if( ev->is_tx_wait == is_wait )
+  {
+    return;
+  }
+
+  event.events   = EPOLLIN | ( is_wait ? EPOLLOUT : 0 );
+  event.data.ptr = ev;
+  epoll_ctl( loop->epfd, EPOLL_CTL_MOD, ev->fd, &event );
+  ev->is_tx_wait = is_wait;
+}
+
+/* Session is done. Close the port and unmap the image. */
+static void ev_finish( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev, int ex )
+{
+  ETX_OTA_SESSION_ *s = &ev->s;
+
+  ev_timer_stop( loop, ev );
+
+  if( ev->fd >= 0 )
+  {
+    epoll_ctl( loop->epfd, EPOLL_CTL_DEL, ev->fd, NULL );
+    ev->fd = -1;
+  }
+  etx_ota_close( s );
+
+  etx_printf( s, "%s\n", ex ? "OTA ERROR" : "OTA DONE");
+
+  ev->state = ETX_OTA_EV_DONE;
+  etx_ota_set_done( s, ex );
+  loop->nb_active--;
+}
+
+/* Send the frame in ev->tx. The response timer starts once it is sent. */
+static void ev_send( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev, uint8_t state, uint32_t gap_chars )
+{
+  ev->state     = state;
+  ev->gap_chars = gap_chars;
+  ev->tx_idx    = 0;
+  ev->tx_off    = 0;
+  ev->is_tx     = true;
+  ev->rx_len    = 0;
+
+  ev_tx( loop, ev );
+}
+
+/* Build and send a command */
+static void ev_send_cmd( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev, uint8_t cmd, uint8_t state )
+{
+  ETX_OTA_COMMAND_ *ota_cmd = (ETX_OTA_COMMAND_*)ev->s.buf;
+
+  ota_cmd->sof          = ETX_OTA_SOF;
+  ota_cmd->packet_type  = ETX_OTA_PACKET_TYPE_CMD;
+  ota_cmd->data_len     = 1;
+  ota_cmd->cmd          = cmd;
+  ota_cmd->crc          = etx_ota_crc32( &ota_cmd->cmd, 1);
+  ota_cmd->eof          = ETX_OTA_EOF;
+
+  ev->tx[0].buf = ev->s.buf;
+  ev->tx[0].len = sizeof(ETX_OTA_COMMAND_);
+  ev->tx_cnt    = 1;
+
+  ev_send( loop, ev, state, ev->s.cmd_gap_chars );
+}
+
+/* Build and send the OTA Header */
+static void ev_send_header( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  ETX_OTA_HEADER_ *ota_header = (ETX_OTA_HEADER_*)ev->s.buf;
+
+  ota_header->sof          = ETX_OTA_SOF;
+  ota_header->packet_type  = ETX_OTA_PACKET_TYPE_HEADER;
+  ota_header->data_len     = sizeof(meta_info);
+  ota_header->crc          = etx_ota_crc32( (uint8_t*)&ev->ota_info, sizeof(meta_info));
+  ota_header->eof          = ETX_OTA_EOF;
+
+  memcpy(&ota_header->meta_data, &ev->ota_info, sizeof(meta_info) );
+
+  ev->tx[0].buf = ev->s.buf;
+  ev->tx[0].len = sizeof(ETX_OTA_HEADER_);
+  ev->tx_cnt    = 1;
+
+  ev_send( loop, ev, ETX_OTA_EV_HEADER, ev->s.cmd_gap_chars );
+}
+
+/* Build and send the next data frame. The data is sent from the image. */
+static void ev_send_data( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  ETX_OTA_SESSION_ *s        = &ev->s;
+  ETX_OTA_DATA_    *ota_data = (ETX_OTA_DATA_*)s->buf;
+  uint8_t          *tail     = &s->buf[4];
+  uint32_t         crc;
+
+  ev->size = ( ( s->image_size - ev->offset ) >= s->data_chunk_size ) ? s->data_chunk_size
+                                                                     : s->image_size - ev->offset;
+  crc = etx_ota_crc32( &s->image[ev->offset], ev->size );
+
+  ota_data->sof          = ETX_OTA_SOF;
+  ota_data->packet_type  = ETX_OTA_PACKET_TYPE_DATA;
+  ota_data->data_len     = ev->size;
+
+  memcpy(tail, (uint8_t*)&crc, sizeof(crc) );
+  tail[sizeof(crc)] = ETX_OTA_EOF;
+
+  ev->tx[0].buf = s->buf;
+  ev->tx[0].len = 4;
+  ev->tx[1].buf = &s->image[ev->offset];
+  ev->tx[1].len = ev->size;
+  ev->tx[2].buf = tail;
+  ev->tx[2].len = sizeof(crc) + 1;
+  ev->tx_cnt    = 3;
+
+  ev_send( loop, ev, ETX_OTA_EV_DATA, s->data_gap_chars );
+}
+
+/* Send what the driver takes. Legacy devices get one byte per gap. */
+static void ev_tx( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  bool is_progress = false;
+
+  while( ev->tx_idx < ev->tx_cnt )
+  {
+    ETX_OTA_EV_PART_ *part = &ev->tx[ev->tx_idx];
+    ssize_t          n;
+
+    if( ev->gap_chars )
+    {
+      n = write( ev->fd, &part->buf[ev->tx_off], 1 );
+    }
+    else
+    {
+      struct iovec iov[3];
+      int          cnt = 0;
+
+      for( uint8_t i = ev->tx_idx; i < ev->tx_cnt; i++, cnt++ )
+      {
+        iov[cnt].iov_base = ev->tx[i].buf + ( ( i == ev->tx_idx ) ? ev->tx_off : 0u );
+        iov[cnt].iov_len  = ev->tx[i].len - ( ( i == ev->tx_idx ) ? ev->tx_off : 0u );
+      }
+      n = writev( ev->fd, iov, cnt );
+    }
+
+    if( n < 0 )
+    {
+      if( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+      {
+        etx_printf( &ev->s, "Send Err\n");
+        ev_finish( loop, ev, -1 );
+        return;
+      }
+
+      //Driver's buffer is full. Wait for the room, but not forever.
+      ev_wait_tx( loop, ev, true );
+      if( ( is_progress ) || ( !ev->is_timer ) )
+      {
+        ev_timer_start( loop, ev, ETX_OTA_TX_TIMEOUT );
+      }
+      return;
+    }
+
+    is_progress = true;
+
+    //Skip the parts that are sent
+    uint32_t left = (uint32_t)n;
+    while( ( left > 0 ) || ( ( ev->tx_idx < ev->tx_cnt ) &&
+                             ( ev->tx_off == ev->tx[ev->tx_idx].len ) ) )
+    {
+      uint32_t room = ev->tx[ev->tx_idx].len - ev->tx_off;
+      if( left < room )
+      {
+        ev->tx_off += left;
+        break;
+      }
+      left      -= room;
+      ev->tx_off = 0;
+      ev->tx_idx++;
+    }
+
+    if( ( ev->gap_chars ) && ( ev->tx_idx < ev->tx_cnt ) )
+    {
+      //Next byte after the gap
+      ev_wait_tx( loop, ev, false );
+      ev_timer_start( loop, ev, ( ( 1u + ev->gap_chars ) * ev->s.char_time_us + 999u ) / 1000u );
+      return;
+    }
+  }
+
+  //Frame is with the driver. Wait for the response.
+  ev->is_tx = false;
+  ev_wait_tx( loop, ev, false );
+  ev_timer_start( loop, ev, ( ev->state == ETX_OTA_EV_INFO ) ? ETX_OTA_INFO_TIMEOUT
+                                                             : ETX_OTA_RESP_TIMEOUT );
+}
+
+/* Device info is known (or not). Send the OTA START. */
+static void ev_start_update( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  ETX_OTA_SESSION_ *s = &ev->s;
+
+  etx_ota_set_mode( s, loop->bdrate );
+
+  if( ( s->is_bootloader ) && ( !( s->dev_info.features & ETX_OTA_FEATURE_BL_UPDATE ) ) )
+  {
+    //Older bootloaders would take it as an application
+    etx_printf( s, "Device doesn't support the bootloader update\n");
+    ev_finish( loop, ev, -1 );
+    return;
+  }
+
+  ev_send_cmd( loop, ev, ETX_OTA_CMD_START, ETX_OTA_EV_START );
+}
+
+/* Handle a complete packet in ev->rx */
+static void ev_on_packet( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  static const char *names[] = { "GET_INFO", "START", "HEADER", "DATA", "END" };
+  ETX_OTA_SESSION_  *s       = &ev->s;
+  uint8_t           type     = ev->rx[1];
+  uint16_t          data_len = ev->rx[2] | ( ev->rx[3] << 8 );
+  int               status   = ( type == ETX_OTA_PACKET_TYPE_RESPONSE ) ? ev->rx[4] : -1;
+
+  if( ( ev->is_tx ) || ( ev->state >= ETX_OTA_EV_DONE ) )
+  {
+    //Not asked for
+    return;
+  }
+
+  ev_timer_stop( loop, ev );
+
+  switch( ev->state )
+  {
+    case ETX_OTA_EV_INFO:
+    {
+      if( type == ETX_OTA_PACKET_TYPE_INFO )
+      {
+        //Newer devices may send more. Older devices may send less.
+        memset( &s->dev_info, 0, sizeof(ETX_OTA_INFO_) );
+        memcpy( &s->dev_info, &ev->rx[4],
+                ( data_len < sizeof(ETX_OTA_INFO_) ) ? data_len : sizeof(ETX_OTA_INFO_) );
+        s->is_info = true;
+      }
+      //Older bootloaders NACK the unknown commands
+      ev_start_update( loop, ev );
+    }
+    return;
+
+    case ETX_OTA_EV_START:
+    {
+      if( status != ETX_OTA_ACK )
+      {
+        break;
+      }
+      ev_send_header( loop, ev );
+    }
+    return;
+
+    case ETX_OTA_EV_HEADER:
+    {
+      if( status == ETX_OTA_ALREADY )
+      {
+        //Device has this image. It has activated that, no need to send.
+        etx_printf( s, "Device already has this image. Activated it without the download.\n");
+        s->sent = s->image_size;
+        ev_finish( loop, ev, 0 );
+        return;
+      }
+      if( status != ETX_OTA_ACK )
+      {
+        break;
+      }
+      ev->offset = 0;
+      ev_send_data( loop, ev );
+    }
+    return;
+
+    case ETX_OTA_EV_DATA:
+    {
+      if( status != ETX_OTA_ACK )
+      {
+        break;
+      }
+
+      ev->offset += ev->size;
+      s->sent     = ev->offset;
+      if( s->progress_cb )
+      {
+        s->progress_cb( s->cb_arg, s->sent, s->image_size );
+      }
+
+      if( ev->offset < s->image_size )
+      {
+        ev_send_data( loop, ev );
+      }
+      else
+      {
+        ev_send_cmd( loop, ev, ETX_OTA_CMD_END, ETX_OTA_EV_END );
+      }
+    }
+    return;
+
+    case ETX_OTA_EV_END:
+    {
+      if( status != ETX_OTA_ACK )
+      {
+        break;
+      }
+      ev_finish( loop, ev, 0 );
+    }
+    return;
+
+    default:
+    break;
+  }
+
+  //Received NACK
+  etx_printf( s, "OTA %s : NACK\n", names[ev->state]);
+  ev_finish( loop, ev, -1 );
+}
+
+/* Read what the port has. Packets are collected in ev->rx. */
+static void ev_rx( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  while( ev->state < ETX_OTA_EV_DONE )
+  {
+    //SOF, Packet type and Len first. Then Data, CRC and EOF.
+    uint16_t data_len = ev->rx[2] | ( ev->rx[3] << 8 );
+    uint32_t need     = ( ev->rx_len < 4 ) ? 4u : ( data_len + 9u );
+
+    int n = RS232_PollComport( ev->s.comport, &ev->rx[ev->rx_len], need - ev->rx_len );
+    if( n <= 0 )
+    {
+      return;
+    }
+    ev->rx_len += n;
+
+    if( ev->rx_len == 4 )
+    {
+      data_len = ev->rx[2] | ( ev->rx[3] << 8 );
+      if( ( ev->rx[0] != ETX_OTA_SOF ) || ( ( data_len + 9u ) > ETX_OTA_PACKET_MAX_SIZE ) )
+      {
+        etx_printf( &ev->s, "Invalid Packet\n");
+        ev_finish( loop, ev, -1 );
+        return;
+      }
+    }
+
+    if( ( ev->rx_len < 4 ) || ( ev->rx_len < ( data_len + 9u ) ) )
+    {
+      continue;
+    }
+
+    uint32_t crc;
+    memcpy( &crc, &ev->rx[4 + data_len], sizeof(crc) );
+    if( ( crc != etx_ota_crc32( &ev->rx[4], data_len ) ) || ( ev->rx[8 + data_len] != ETX_OTA_EOF ) )
+    {
+      etx_printf( &ev->s, "Packet CRC Err\n");
+      ev_finish( loop, ev, -1 );
+      return;
+    }
+
+    ev->rx_len = 0;
+    ev_on_packet( loop, ev );
+  }
+}
+
+/* Timer of the session expired */
+static void ev_on_timer( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  if( ev->is_tx )
+  {
+    if( ( ev->gap_chars ) && ( !ev->is_tx_wait ) )
+    {
+      //Gap is over
+      ev_tx( loop, ev );
+      return;
+    }
+
+    etx_printf( &ev->s, "Send Err\n");
+    ev_finish( loop, ev, -1 );
+    return;
+  }
+
+  if( ev->state == ETX_OTA_EV_INFO )
+  {
+    etx_printf( &ev->s, "OTA GET_INFO : Not supported\n");
+    ev->rx_len = 0;
+    ev_start_update( loop, ev );
+    return;
+  }
+
+  etx_printf( &ev->s, "No Response\n");
+  ev_finish( loop, ev, -1 );
+}
+
+/* Run the timers up to now */
+static void ev_run_timers( ETX_OTA_LOOP_ *loop )
+{
+  uint32_t now = etx_ota_get_ms();
+
+  if( (int32_t)( now - loop->tick ) > ETX_OTA_WHEEL_SIZE )
+  {
+    //One round visits all the slots
+    loop->tick = now - ETX_OTA_WHEEL_SIZE;
+  }
+
+  while( (int32_t)( now - loop->tick ) > 0 )
+  {
+    loop->tick++;
+
+    ETX_OTA_EV_SESSION_ *ev = loop->wheel[loop->tick % ETX_OTA_WHEEL_SIZE];
+    while( ev )
+    {
+      ETX_OTA_EV_SESSION_ *next = ev->next;
+
+      if( (int32_t)( ev->expire_ms - now ) <= 0 )
+      {
+        ev_timer_stop( loop, ev );
+        ev_on_timer( loop, ev );
+      }
+      ev = next;
+    }
+  }
+}
+
+/* Open the port and ask for the device info */
+static void ev_open( ETX_OTA_LOOP_ *loop, ETX_OTA_EV_SESSION_ *ev )
+{
+  ETX_OTA_SESSION_   *s = &ev->s;
+  struct epoll_event event;
+
+  ev->fd = -1;
+  loop->nb_active++;
+
+  if( etx_ota_open_port( s, s->comport, loop->bdrate ) < 0 )
+  {
+    ev_finish( loop, ev, -1 );
+    return;
+  }
+
+  if( s->image == NULL )
+  {
+    etx_printf( s, "Can not read %s\n", s->bin_name);
+    ev_finish( loop, ev, -1 );
+    return;
+  }
+
+  ev->fd         = RS232_GetFd( s->comport );
+  event.events   = EPOLLIN;
+  event.data.ptr = ev;
+  if( epoll_ctl( loop->epfd, EPOLL_CTL_ADD, ev->fd, &event ) != 0 )
+  {
+    etx_printf( s, "Can not watch the port\n");
+    ev->fd = -1;
+    ev_finish( loop, ev, -1 );
+    return;
+  }
+
+  ev_send_cmd( loop, ev, ETX_OTA_CMD_GET_INFO, ETX_OTA_EV_INFO );
+}
+
+/* Map the images and fill the OTA headers. The CRC and the digest are
+ * calculated once for each file and shared with the other sessions that send
+ * it. This is done before any port is opened, so it doesn't hold up the I/O
+ * and the timers. A session whose image can't be read keeps s.image NULL. */
+static void ev_load_images( ETX_OTA_EV_SESSION_ *evs, int nb_sessions )
+{
+  for( int i = 0; i < nb_sessions; i++ )
+  {
+    ETX_OTA_SESSION_ *s = &evs[i].s;
+    uint32_t         image_size;
+    int              j;
+
+    if( etx_ota_image_map( s->bin_name, &s->image, &image_size ) < 0 )
+    {
+      continue;
+    }
+    s->image_size = image_size;
+
+    for( j = 0; j < i; j++ )
+    {
+      if( ( evs[j].s.image != NULL ) && ( !strcmp( evs[j].s.bin_name, s->bin_name ) ) )
+      {
+        break;
+      }
+    }
+
+    if( j < i )
+    {
+      evs[i].ota_info            = evs[j].ota_info;
+      evs[i].ota_info.image_type = s->is_bootloader ? ETX_OTA_IMAGE_BOOTLOADER : ETX_OTA_IMAGE_APP;
+    }
+    else
+    {
+      etx_ota_get_meta( s, s->is_bootloader, &evs[i].ota_info );
+    }
+  }
+}
+
+/* Update all the sessions. Returns once all of them are done. */
+int etx_ota_loop_run( ETX_OTA_EV_SESSION_ *evs, int nb_sessions, int bdrate,
+                      ETX_OTA_REPORT_CB_ report_cb, void *cb_arg )
+{
+  struct epoll_event events[ETX_OTA_LOOP_EVENTS];
+  ETX_OTA_LOOP_      *loop = calloc( 1, sizeof(ETX_OTA_LOOP_) );
+  uint32_t           report_ms;
+
+  if( loop == NULL )
+  {
+    printf("Out of memory\n");
+    return -1;
+  }
+
+  loop->epfd   = epoll_create1( 0 );
+  loop->bdrate = bdrate;
+  if( loop->epfd < 0 )
+  {
+    printf("Can not create the event loop\n");
+    free( loop );
+    return -1;
+  }
+
+  ev_load_images( evs, nb_sessions );
+  loop->tick   = etx_ota_get_ms();
+
+  for( int i = 0; i < nb_sessions; i++ )
+  {
+    ev_open( loop, &evs[i] );
+  }
+
+  report_ms = etx_ota_get_ms() + ETX_OTA_PROGRESS_MS;
+
+  while( loop->nb_active > 0 )
+  {
+    int timeout = ev_timer_next( loop );
+    int wait    = (int32_t)( report_ms - etx_ota_get_ms() );
+
+    if( wait < 0 )
+    {
+      wait = 0;
+    }
+    if( ( timeout < 0 ) || ( timeout > wait ) )
+    {
+      timeout = wait;
+    }
+
+    int nb = epoll_wait( loop->epfd, events, ETX_OTA_LOOP_EVENTS, timeout );
+    for( int i = 0; i < nb; i++ )
+    {
+      ETX_OTA_EV_SESSION_ *ev = (ETX_OTA_EV_SESSION_ *)events[i].data.ptr;
+
+      if( ev->state >= ETX_OTA_EV_DONE )
+      {
+        continue;                     //Done by an earlier event
+      }
+      if( events[i].events & ( EPOLLERR | EPOLLHUP ) )
+      {
+        etx_printf( &ev->s, "Port Err\n");
+        ev_finish( loop, ev, -1 );    //Device is gone (USB adapter unplugged)
+        continue;
+      }
+      if( ( events[i].events & EPOLLOUT ) && ( ev->is_tx ) )
+      {
+        ev_tx( loop, ev );
+      }
+      if( ( events[i].events & EPOLLIN ) && ( ev->state < ETX_OTA_EV_DONE ) )
+      {
+        ev_rx( loop, ev );
+      }
+    }
+
+    ev_run_timers( loop );
+
+    if( ( report_cb ) && ( (int32_t)( etx_ota_get_ms() - report_ms ) >= 0 ) )
+    {
+      report_cb( cb_arg );
+      report_ms += ETX_OTA_PROGRESS_MS;
+    }
+  }
+
+  if( report_cb )
+  {
+    report_cb( cb_arg );
+  }
+
+  close( loop->epfd );
+  free( loop );
+  return 0;
+}
+
+#else  /* windows */
+
+/* Update all the sessions. Not available without epoll. */
+int etx_ota_loop_run( ETX_OTA_EV_SESSION_ *evs, int nb_sessions, int bdrate,
+                      ETX_OTA_REPORT_CB_ report_cb, void *cb_arg )
+{
+  (void)evs;
+  (void)nb_sessions;
+  (void)bdrate;
+  (void)report_cb;
+  (void)cb_arg;
+
+  printf("The event loop needs Linux. Use -M instead.\n");
+  return -1;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * etx_ota_loop.h
+ *
+ *  Created on: 18-Oct-2026
+ *      Author: EmbeTronicX
+ */
+
+#ifndef INC_ETX_OTA_LOOP_H_
+#define INC_ETX_OTA_LOOP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "etx_ota_lib.h"
+
+#define ETX_OTA_WHEEL_SIZE    ( 1024 )    //Timer wheel slots (1 ms each)
+#define ETX_OTA_LOOP_EVENTS   ( 64 )      //Max events handled in one epoll_wait()
+
+/*
+ * State of a session in the event loop
+ */
+typedef enum
+{
+  ETX_OTA_EV_INFO   = 0,    // Waiting for the device info
+  ETX_OTA_EV_START  = 1,    // Waiting for the ACK of the OTA START
+  ETX_OTA_EV_HEADER = 2,    // Waiting for the ACK of the OTA Header
+  ETX_OTA_EV_DATA   = 3,    // Waiting for the ACK of the data frame
+  ETX_OTA_EV_END    = 4,    // Waiting for the ACK of the OTA END
+  ETX_OTA_EV_DONE   = 5,    // Port is closed. Result is in s.ex.
+}ETX_OTA_EV_STATE_;
+
+/*
+ * Part of the frame being sent. The data part points into the image.
+ */
+typedef struct
+{
+  uint8_t  *buf;
+  uint32_t len;
+}ETX_OTA_EV_PART_;
+
+/*
+ * Session of the event loop. Zero it, then fill s.comport, s.bin_name,
+ * s.is_bootloader, s.tag and s.progress_cb (optional).
+ */
+typedef struct ETX_OTA_EV_SESSION
+{
+  ETX_OTA_SESSION_          s;                        // Port, device info, image and progress
+  int                       fd;                       // Port's file descriptor
+  uint8_t                   state;                    // ETX_OTA_EV_STATE_
+  meta_info                 ota_info;                 // OTA Header of the image
+  uint32_t                  offset;                   // Image offset of the data frame in flight
+  uint16_t                  size;                     // Size of the data frame in flight
+  /* Frame being sent */
+  ETX_OTA_EV_PART_          tx[3];                    // Head, data, tail
+  uint8_t                   tx_cnt;
+  uint8_t                   tx_idx;
+  uint32_t                  tx_off;                   // Bytes of tx[tx_idx] sent
+  uint32_t                  gap_chars;                // Idle characters between the bytes
+  bool                      is_tx;                    // Frame is not sent yet
+  bool                      is_tx_wait;               // Waiting for the room in the driver (EPOLLOUT)
+  /* Frame being received */
+  uint8_t                   rx[ETX_OTA_PACKET_MAX_SIZE];
+  uint32_t                  rx_len;
+  /* Timer (ACK timeout, byte gap or send timeout) */
+  bool                      is_timer;
+  uint32_t                  expire_ms;
+  struct ETX_OTA_EV_SESSION *next;                    // Sessions in the same wheel slot
+  struct ETX_OTA_EV_SESSION *prev;
+}ETX_OTA_EV_SESSION_;
+
+/*
+ * Called every ETX_OTA_PROGRESS_MS and once all the sessions are done
+ */
+typedef void (*ETX_OTA_REPORT_CB_)( void *arg );
+
+int etx_ota_loop_run( ETX_OTA_EV_SESSION_ *evs, int nb_sessions, int bdrate,
+                      ETX_OTA_REPORT_CB_ report_cb, void *cb_arg );
+
+#endif /* INC_ETX_OTA_LOOP_H_ */
@@ -2,414 +2,632 @@
 /**************************************************
 
 file: etx_ota_update_main.c
-purpose: 
+purpose: Command line tool of the ETX OTA. The protocol is in etx_ota_lib.c.
 
-compile with the command: gcc etx_ota_update_main.c RS232\rs232.c -IRS232 -Wall -Wextra -o2 -o etx_ota_app
+compile with the command: gcc etx_ota_update_main.c etx_ota_lib.c etx_ota_loop.c RS232\rs232.c -IRS232 -Wall -Wextra -o2 -lpthread -o etx_ota_app
 
 **************************************************/
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
 
-#ifdef _WIN32
-#include <Windows.h>
-#else
-#include <unistd.h>
-#endif
-
-#include "rs232.h"
-#include "etx_ota_update_main.h"
-
-uint8_t DATA_BUF[ETX_OTA_PACKET_MAX_SIZE];
-uint8_t APP_BIN[ETX_OTA_MAX_FW_SIZE];
-
-static const uint32_t crc_table[0x100] = {
-  0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9, 0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005, 0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61, 0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD, 
-  0x4C11DB70, 0x48D0C6C7, 0x4593E01E, 0x4152FDA9, 0x5F15ADAC, 0x5BD4B01B, 0x569796C2, 0x52568B75, 0x6A1936C8, 0x6ED82B7F, 0x639B0DA6, 0x675A1011, 0x791D4014, 0x7DDC5DA3, 0x709F7B7A, 0x745E66CD, 
-  0x9823B6E0, 0x9CE2AB57, 0x91A18D8E, 0x95609039, 0x8B27C03C, 0x8FE6DD8B, 0x82A5FB52, 0x8664E6E5, 0xBE2B5B58, 0xBAEA46EF, 0xB7A96036, 0xB3687D81, 0xAD2F2D84, 0xA9EE3033, 0xA4AD16EA, 0xA06C0B5D, 
-  0xD4326D90, 0xD0F37027, 0xDDB056FE, 0xD9714B49, 0xC7361B4C, 0xC3F706FB, 0xCEB42022, 0xCA753D95, 0xF23A8028, 0xF6FB9D9F, 0xFBB8BB46, 0xFF79A6F1, 0xE13EF6F4, 0xE5FFEB43, 0xE8BCCD9A, 0xEC7DD02D, 
-  0x34867077, 0x30476DC0, 0x3D044B19, 0x39C556AE, 0x278206AB, 0x23431B1C, 0x2E003DC5, 0x2AC12072, 0x128E9DCF, 0x164F8078, 0x1B0CA6A1, 0x1FCDBB16, 0x018AEB13, 0x054BF6A4, 0x0808D07D, 0x0CC9CDCA, 
-  0x7897AB07, 0x7C56B6B0, 0x71159069, 0x75D48DDE, 0x6B93DDDB, 0x6F52C06C, 0x6211E6B5, 0x66D0FB02, 0x5E9F46BF, 0x5A5E5B08, 0x571D7DD1, 0x53DC6066, 0x4D9B3063, 0x495A2DD4, 0x44190B0D, 0x40D816BA, 
-  0xACA5C697, 0xA864DB20, 0xA527FDF9, 0xA1E6E04E, 0xBFA1B04B, 0xBB60ADFC, 0xB6238B25, 0xB2E29692, 0x8AAD2B2F, 0x8E6C3698, 0x832F1041, 0x87EE0DF6, 0x99A95DF3, 0x9D684044, 0x902B669D, 0x94EA7B2A, 
-  0xE0B41DE7, 0xE4750050, 0xE9362689, 0xEDF73B3E, 0xF3B06B3B, 0xF771768C, 0xFA325055, 0xFEF34DE2, 0xC6BCF05F, 0xC27DEDE8, 0xCF3ECB31, 0xCBFFD686, 0xD5B88683, 0xD1799B34, 0xDC3ABDED, 0xD8FBA05A, 
-  0x690CE0EE, 0x6DCDFD59, 0x608EDB80, 0x644FC637, 0x7A089632, 0x7EC98B85, 0x738AAD5C, 0x774BB0EB, 0x4F040D56, 0x4BC510E1, 0x46863638, 0x42472B8F, 0x5C007B8A, 0x58C1663D, 0x558240E4, 0x51435D53, 
-  0x251D3B9E, 0x21DC2629, 0x2C9F00F0, 0x285E1D47, 0x36194D42, 0x32D850F5, 0x3F9B762C, 0x3B5A6B9B, 0x0315D626, 0x07D4CB91, 0x0A97ED48, 0x0E56F0FF, 0x1011A0FA, 0x14D0BD4D, 0x19939B94, 0x1D528623, 
-  0xF12F560E, 0xF5EE4BB9, 0xF8AD6D60, 0xFC6C70D7, 0xE22B20D2, 0xE6EA3D65, 0xEBA91BBC, 0xEF68060B, 0xD727BBB6, 0xD3E6A601, 0xDEA580D8, 0xDA649D6F, 0xC423CD6A, 0xC0E2D0DD, 0xCDA1F604, 0xC960EBB3, 
-  0xBD3E8D7E, 0xB9FF90C9, 0xB4BCB610, 0xB07DABA7, 0xAE3AFBA2, 0xAAFBE615, 0xA7B8C0CC, 0xA379DD7B, 0x9B3660C6, 0x9FF77D71, 0x92B45BA8, 0x9675461F, 0x8832161A, 0x8CF30BAD, 0x81B02D74, 0x857130C3, 
-  0x5D8A9099, 0x594B8D2E, 0x5408ABF7, 0x50C9B640, 0x4E8EE645, 0x4A4FFBF2, 0x470CDD2B, 0x43CDC09C, 0x7B827D21, 0x7F436096, 0x7200464F, 0x76C15BF8, 0x68860BFD, 0x6C47164A, 0x61043093, 0x65C52D24, 
-  0x119B4BE9, 0x155A565E, 0x18197087, 0x1CD86D30, 0x029F3D35, 0x065E2082, 0x0B1D065B, 0x0FDC1BEC, 0x3793A651, 0x3352BBE6, 0x3E119D3F, 0x3AD08088, 0x2497D08D, 0x2056CD3A, 0x2D15EBE3, 0x29D4F654, 
-  0xC5A92679, 0xC1683BCE, 0xCC2B1D17, 0xC8EA00A0, 0xD6AD50A5, 0xD26C4D12, 0xDF2F6BCB, 0xDBEE767C, 0xE3A1CBC1, 0xE760D676, 0xEA23F0AF, 0xEEE2ED18, 0xF0A5BD1D, 0xF464A0AA, 0xF9278673, 0xFDE69BC4, 
-  0x89B8FD09, 0x8D79E0BE, 0x803AC667, 0x84FBDBD0, 0x9ABC8BD5, 0x9E7D9662, 0x933EB0BB, 0x97FFAD0C, 0xAFB010B1, 0xAB710D06, 0xA6322BDF, 0xA2F33668, 0xBCB4666D, 0xB8757BDA, 0xB5365D03, 0xB1F740B4, 
-};
-
-uint32_t CalcCRC(uint8_t * pData, uint32_t DataLength)
+#include "etx_ota_lib.h"
+#include "etx_ota_loop.h"
+
+/*
+ * Worker pool of the multi device mode. Workers take the next session from
+ * the list until all are done.
+ */
+typedef struct
+{
+  ETX_OTA_SESSION_ *sessions;
+  const char       **images;
+  int              nb_sessions;
+  int              next;
+  pthread_mutex_t  lock;
+}ETX_OTA_POOL_;
+
+/*
+ * Devices of the event loop mode, for the progress print
+ */
+typedef struct
+{
+  ETX_OTA_SESSION_ **list;
+  int              nb_sessions;
+  uint32_t         start_ms;
+}ETX_OTA_REPORT_;
+
+/* Print the device info */
+void print_device_info(ETX_OTA_INFO_ *info)
 {
-    uint32_t Checksum = 0xFFFFFFFF;
-    for(unsigned int i=0; i < DataLength; i++)
+  printf("Bootloader Version : %d.%d (Info v%d)\n", info->bl_version[0], info->bl_version[1],
+                                                   info->info_version);
+  printf("Features           : 0x%08X\n", info->features);
+  printf("Max Data Size      : %u\n", info->max_data_size);
+  printf("Baudrate           : %u\n", info->baudrate);
+  printf("Flash Size         : %u KB\n", info->flash_size / 1024);
+  printf("App Address        : 0x%08X\n", info->app_flash_addr);
+  printf("Slot Size          : %u KB\n", info->slot_max_size / 1024);
+
+  for( int i = 0; ( i < info->no_of_slots ) && ( i < ETX_NO_OF_SLOTS ); i++ )
+  {
+    ETX_OTA_SLOT_INFO_ *slot = &info->slots[i];
+    printf("Slot %d             : %s%s%s Size = %u, CRC = 0x%08X, Version = %d.%d.%d, Build = %u\n",
+           i,
+           slot->is_valid  ? "Valid"   : "Invalid",
+           slot->is_active ? " Active" : "",
+           slot->is_trial  ? " Trial"  : "",
+           slot->fw_size, slot->fw_crc,
+           (slot->fw_version >> 16) & 0xFF, (slot->fw_version >> 8) & 0xFF,
+           slot->fw_version & 0xFF, slot->build_id);
+  }
+
+  if( info->info_version >= 2 )
+  {
+    printf("Config Records     : %u free\n", info->cfg_free_records);
+    printf("Erase Count        :");
+    for( int i = 0; ( i < info->no_of_sectors ) && ( i < ETX_NO_OF_SECTORS ); i++ )
     {
-        uint8_t top = (uint8_t)(Checksum >> 24);
-        top ^= pData[i];
-        Checksum = (Checksum << 8) ^ crc_table[top];
+      printf(" [%d]=%u", i, info->erase_count[i]);
     }
-    return Checksum;
+    printf("\n");
+  }
 }
 
-void delay(uint32_t us)
+/* Print the image's line for the SD card manifest (ETX_FW/manifest.txt) */
+int print_manifest_line(const char *type, const char *file_name, const char *sd_path)
 {
-#ifdef _WIN32
-    //Sleep(ms);
-    __int64 time1 = 0, time2 = 0, freq = 0;
-
-    QueryPerformanceCounter((LARGE_INTEGER *) &time1);
-    QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
-
-    do {
-        QueryPerformanceCounter((LARGE_INTEGER *) &time2);
-    } while((time2-time1) < us);
-#else
-    usleep(us);
-#endif
+  int       ex       = 0;
+  uint32_t  app_size = 0;
+  meta_info info;
+  char      path[256];
+  uint8_t   *app_bin = NULL;
+
+  do
+  {
+    if( strcmp(type, "app") && strcmp(type, "bootloader") )
+    {
+      printf("Invalid image type %s\n", type);
+      ex = -1;
+      break;
+    }
+
+    if( etx_ota_image_map( file_name, &app_bin, &app_size ) < 0 )
+    {
+      printf("Can not read %s\n", file_name);
+      ex = -1;
+      break;
+    }
+
+    //Default is the file name in the ETX_FW folder
+    if( sd_path == NULL )
+    {
+      const char *name = file_name;
+      for( const char *c = file_name; *c != '\0'; c++ )
+      {
+        if( ( *c == '/' ) || ( *c == '\\' ) )
+        {
+          name = c + 1;
+        }
+      }
+      snprintf(path, sizeof(path), "ETX_FW/%s", name);
+      sd_path = path;
+    }
+
+    memset( &info, 0, sizeof(info) );
+    info.package_crc = etx_ota_crc32( app_bin, app_size );
+    etx_ota_sha256( app_bin, app_size, info.digest );
+    etx_ota_image_info( app_bin, app_size, &info );
+
+    printf("%s %s %d.%d.%d ", type, sd_path, (info.fw_version >> 16) & 0xFF,
+           (info.fw_version >> 8) & 0xFF, info.fw_version & 0xFF);
+    for( uint32_t i = 0; i < sizeof(info.digest); i++ )
+    {
+      printf("%02x", info.digest[i]);
+    }
+    printf(" 0x%08X\n", info.package_crc);
+  }while( false );
+
+  etx_ota_image_unmap( app_bin, app_size );
+  return ex;
 }
 
-/* read the response */
-bool is_ack_resp_received( int comport )
+/* Print the bootloader's telemetry journal copied from the SD card */
+int print_journal(const char *file_name)
 {
-  bool is_ack  = false;
+  static const char *stages[]   = { "BL update", "SD update", "UART OTA", "App load" };
+  static const char *counters[] = { "Frame errors", "NACKs", "App CRC errors", "Digest errors",
+                                    "Flash errors", "SD errors", "Reverts" };
+  uint8_t  batch[ETX_JOURNAL_SECTOR_SIZE * 16];
+  uint32_t nb_batch = 0;
+  FILE     *fp      = fopen(file_name, "rb");
+
+  if( fp == NULL )
+  {
+    printf("Can not open %s\n", file_name);
+    return -1;
+  }
 
-  memset(DATA_BUF, 0, ETX_OTA_PACKET_MAX_SIZE);
+  //Batches start at sector boundaries
+  while( fread( batch, 1, ETX_JOURNAL_SECTOR_SIZE, fp ) == ETX_JOURNAL_SECTOR_SIZE )
+  {
+    ETX_JOURNAL_HDR_ *hdr = (ETX_JOURNAL_HDR_ *)batch;
 
-  uint16_t len =  RS232_PollComport( comport, DATA_BUF, sizeof(ETX_OTA_RESP_));
+    if( ( hdr->magic != ETX_JOURNAL_MAGIC ) || ( hdr->sectors == 0 ) ||
+        ( hdr->sectors > ( sizeof(batch) / ETX_JOURNAL_SECTOR_SIZE ) ) )
+    {
+      continue;
+    }
 
-  if( len > 0 )
-  {
-    ETX_OTA_RESP_ *resp = (ETX_OTA_RESP_*) DATA_BUF;
-    if( resp->packet_type == ETX_OTA_PACKET_TYPE_RESPONSE )
+    uint32_t rest = ( hdr->sectors - 1 ) * ETX_JOURNAL_SECTOR_SIZE;
+    if( ( fread( &batch[ETX_JOURNAL_SECTOR_SIZE], 1, rest, fp ) != rest ) ||
+        ( ( sizeof(*hdr) + hdr->rec_len ) > ( hdr->sectors * ETX_JOURNAL_SECTOR_SIZE ) ) ||
+        ( etx_ota_crc32( &batch[sizeof(*hdr)], hdr->rec_len ) != hdr->crc ) )
+    {
+      printf("Batch %u : corrupted\n", nb_batch++);
+      continue;
+    }
+
+    printf("Batch %u : BL %d.%d, Reboot cause 0x%08X, %u ms%s\n", nb_batch++,
+           hdr->bl_version[0], hdr->bl_version[1], hdr->reboot_cause, hdr->tick,
+           hdr->dropped ? " (records dropped)" : "");
+
+    for( uint32_t i = sizeof(*hdr); ( i + 2 ) <= ( sizeof(*hdr) + hdr->rec_len ); )
     {
-      if( resp->crc == CalcCRC(&resp->status, 1) )
+      uint8_t type = batch[i];
+      uint8_t len  = batch[i + 1];
+      uint8_t *rec = &batch[i + 2];
+
+      if( ( type == ETX_JOURNAL_REC_STAGE ) && ( len >= sizeof(ETX_JOURNAL_STAGE_REC_) ) )
       {
-        if( resp->status == ETX_OTA_ACK )
+        ETX_JOURNAL_STAGE_REC_ *st = (ETX_JOURNAL_STAGE_REC_ *)rec;
+        printf("  %-10s : %6u ms (at %u ms), result %d\n",
+               ( st->stage < 4 ) ? stages[st->stage] : "?", st->duration, st->start, st->result);
+      }
+      else if( ( type == ETX_JOURNAL_REC_UPDATE ) && ( len >= sizeof(ETX_JOURNAL_UPDATE_REC_) ) )
+      {
+        ETX_JOURNAL_UPDATE_REC_ *up = (ETX_JOURNAL_UPDATE_REC_ *)rec;
+        printf("  Update     : %s %s, %u bytes in %u ms (%u B/s), result %d\n",
+               up->source ? "SD" : "UART", up->image_type ? "bootloader" : "app",
+               up->size, up->duration, up->throughput, up->result);
+      }
+      else if( type == ETX_JOURNAL_REC_COUNTERS )
+      {
+        for( uint32_t c = 0; ( ( c + 1 ) * 2 <= len ) && ( c < 7 ); c++ )
         {
-          //ACK received
-          is_ack = true;
+          uint16_t count = rec[c * 2] | ( rec[c * 2 + 1] << 8 );
+          if( count != 0 )
+          {
+            printf("  %-14s : %u\n", counters[c], count);
+          }
         }
       }
+
+      i += 2 + len;
     }
   }
 
-  return is_ack;
+  fclose(fp);
+  return 0;
 }
 
-/* Build the OTA START command */
-int send_ota_start(int comport)
+/* Get the region number from the name */
+int get_region(const char *name)
 {
-  uint16_t len;
-  ETX_OTA_COMMAND_ *ota_start = (ETX_OTA_COMMAND_*)DATA_BUF;
-  int ex = 0;
+  if( !strcmp(name, "slot0") )
+  {
+    return ETX_OTA_REGION_SLOT0;
+  }
+  if( !strcmp(name, "slot1") )
+  {
+    return ETX_OTA_REGION_SLOT1;
+  }
+  if( !strcmp(name, "app") )
+  {
+    return ETX_OTA_REGION_APP;
+  }
+  return -1;
+}
 
-  memset(DATA_BUF, 0, ETX_OTA_PACKET_MAX_SIZE);
+/* Print the progress of the single device mode */
+void print_progress( void *arg, uint32_t sent, uint32_t total )
+{
+  ETX_OTA_SESSION_ *s = (ETX_OTA_SESSION_ *)arg;
 
-  ota_start->sof          = ETX_OTA_SOF;
-  ota_start->packet_type  = ETX_OTA_PACKET_TYPE_CMD;
-  ota_start->data_len     = 1;
-  ota_start->cmd          = ETX_OTA_CMD_START;
-  ota_start->crc          = CalcCRC( &ota_start->cmd, 1);
-  ota_start->eof          = ETX_OTA_EOF;
+  printf("[%u/%u]\r\n", sent/s->data_chunk_size, total/s->data_chunk_size);
+}
 
-  len = sizeof(ETX_OTA_COMMAND_);
+/* Worker of the multi device mode */
+void *etx_ota_worker( void *arg )
+{
+  ETX_OTA_POOL_ *pool = (ETX_OTA_POOL_ *)arg;
 
-  //send OTA START
-  for(int i = 0; i < len; i++)
+  while( true )
   {
-    delay(1);
-    if( RS232_SendByte(comport, DATA_BUF[i]) )
+    pthread_mutex_lock( &pool->lock );
+    int i = pool->next++;
+    pthread_mutex_unlock( &pool->lock );
+
+    if( i >= pool->nb_sessions )
     {
-      //some data missed.
-      printf("OTA START : Send Err\n");
-      ex = -1;
       break;
     }
-  }
 
-  if( ex >= 0 )
-  {
-    if( !is_ack_resp_received( comport ) )
+    ETX_OTA_SESSION_ *s = &pool->sessions[i];
+
+    int ex = etx_ota_open( s, s->comport, ETX_OTA_BAUDRATE );
+    if( ex == 0 )
     {
-      //Received NACK
-      printf("OTA START : NACK\n");
-      ex = -1;
+      ex = etx_ota_update( s, pool->images[i], false );
     }
+
+    etx_ota_close( s );
+    etx_ota_set_done( s, ex );
   }
-  printf("OTA START [ex = %d]\n", ex);
-  return ex;
+
+  return NULL;
 }
 
-/* Build and Send the OTA END command */
-uint16_t send_ota_end(int comport)
+/* Get the COM port and the image from "<COM number>=<image>".
+ * list : sessions of the earlier targets */
+int get_target( char *target, ETX_OTA_SESSION_ **list, int nb_sessions, int *comport, const char **image )
 {
-  uint16_t len;
-  ETX_OTA_COMMAND_ *ota_end = (ETX_OTA_COMMAND_*)DATA_BUF;
-  int ex = 0;
-
-  memset(DATA_BUF, 0, ETX_OTA_PACKET_MAX_SIZE);
-
-  ota_end->sof          = ETX_OTA_SOF;
-  ota_end->packet_type  = ETX_OTA_PACKET_TYPE_CMD;
-  ota_end->data_len     = 1;
-  ota_end->cmd          = ETX_OTA_CMD_END;
-  ota_end->crc          = CalcCRC( &ota_end->cmd, 1);
-  ota_end->eof          = ETX_OTA_EOF;
+  char *sep = strchr( target, '=' );
 
-  len = sizeof(ETX_OTA_COMMAND_);
+  if( ( sep == NULL ) || ( atoi( target ) <= 0 ) )
+  {
+    printf("Invalid target %s. Use <COM number>=<image>\n", target);
+    return -1;
+  }
 
-  //send OTA END
-  for(int i = 0; i < len; i++)
+  for( int i = 0; i < nb_sessions; i++ )
   {
-    delay(1);
-    if( RS232_SendByte(comport, DATA_BUF[i]) )
+    //RS232 library has one handle per port
+    if( list[i]->comport == ( atoi( target ) - 1 ) )
     {
-      //some data missed.
-      printf("OTA END : Send Err\n");
-      ex = -1;
-      break;
+      printf("COM%d is given twice\n", atoi( target ));
+      return -1;
     }
   }
 
-  if( ex >= 0 )
+  *comport = atoi( target ) - 1;
+  *image   = sep + 1;
+  return 0;
+}
+
+/* Print the progress of each device and the total. Returns the number of
+ * devices that are done. */
+int print_many_progress( ETX_OTA_SESSION_ **list, int nb_sessions, uint32_t start )
+{
+  uint32_t now   = etx_ota_get_ms();
+  uint32_t total = 0;
+  int      done  = 0;
+
+  for( int i = 0; i < nb_sessions; i++ )
   {
-    if( !is_ack_resp_received( comport ) )
+    ETX_OTA_SESSION_ *s       = list[i];
+    bool             is_done  = etx_ota_is_done( s );    //s->ex and s->end_ms are valid after this
+    uint32_t         end      = is_done ? s->end_ms : now;
+    uint32_t         size     = s->image_size;
+    uint32_t         sent     = s->sent;
+
+    total += sent;
+    if( is_done )
     {
-      //Received NACK
-      printf("OTA END : NACK\n");
-      ex = -1;
+      done++;
     }
+    if( !s->is_started )
+    {
+      continue;                   //Not started yet
+    }
+
+    uint32_t         start_ms = s->start_ms;
+
+    printf("%s%3u%% %7u B/s %s\n", s->tag,
+           size ? (uint32_t)( ( (uint64_t)sent * 100u ) / size ) : 0u,
+           ( end != start_ms ) ? (uint32_t)( ( (uint64_t)sent * 1000u ) / ( end - start_ms ) ) : 0u,
+           is_done ? ( s->ex ? "FAILED" : "DONE" ) : "");
   }
-  printf("OTA END [ex = %d]\n", ex);
-  return ex;
+
+  printf("Total  : %d/%d done, %u bytes, %u B/s\n", done, nb_sessions, total,
+         ( now != start ) ? (uint32_t)( ( (uint64_t)total * 1000u ) / ( now - start ) ) : 0u);
+  return done;
 }
 
-/* Build and send the OTA Header */
-int send_ota_header(int comport, meta_info *ota_info)
+/* Progress print of the event loop mode */
+void print_loop_progress( void *arg )
 {
-  uint16_t len;
-  ETX_OTA_HEADER_ *ota_header = (ETX_OTA_HEADER_*)DATA_BUF;
-  int ex = 0;
+  ETX_OTA_REPORT_ *report = (ETX_OTA_REPORT_ *)arg;
 
-  memset(DATA_BUF, 0, ETX_OTA_PACKET_MAX_SIZE);
+  print_many_progress( report->list, report->nb_sessions, report->start_ms );
+}
 
-  ota_header->sof          = ETX_OTA_SOF;
-  ota_header->packet_type  = ETX_OTA_PACKET_TYPE_HEADER;
-  ota_header->data_len     = sizeof(meta_info);
-  ota_header->crc          = CalcCRC( (uint8_t*)ota_info, sizeof(meta_info));
-  ota_header->eof          = ETX_OTA_EOF;
+/* Update many devices at the same time.
+ * targets : "<COM number>=<image>" for each device */
+int update_many_devices( int nb_workers, int nb_targets, char *targets[] )
+{
+  pthread_t     workers[ETX_OTA_MAX_WORKERS];
+  ETX_OTA_POOL_ pool;
+  int           nb_started = 0;
+  int           nb_failed  = 0;
+  int           ex         = 0;
+
+  memset( &pool, 0, sizeof(pool) );
+  pool.sessions    = calloc( nb_targets, sizeof(ETX_OTA_SESSION_) );
+  pool.images      = calloc( nb_targets, sizeof(char *) );
+  ETX_OTA_SESSION_ **list = calloc( nb_targets, sizeof(ETX_OTA_SESSION_ *) );
+  pool.nb_sessions = nb_targets;
+  pthread_mutex_init( &pool.lock, NULL );
 
-  memcpy(&ota_header->meta_data, ota_info, sizeof(meta_info) );
+  do
+  {
+    if( ( pool.sessions == NULL ) || ( pool.images == NULL ) || ( list == NULL ) )
+    {
+      printf("Out of memory\n");
+      ex = -1;
+      break;
+    }
 
-  len = sizeof(ETX_OTA_HEADER_);
+    for( int i = 0; i < nb_targets; i++ )
+    {
+      ex = get_target( targets[i], list, i, &pool.sessions[i].comport, &pool.images[i] );
+      if( ex < 0 )
+      {
+        break;
+      }
+      snprintf( pool.sessions[i].tag, sizeof(pool.sessions[i].tag), "[COM%d] ",
+                pool.sessions[i].comport + 1 );
+      list[i] = &pool.sessions[i];
+    }
 
-  //send OTA Header
-  for(int i = 0; i < len; i++)
-  {
-    delay(1);
-    if( RS232_SendByte(comport, DATA_BUF[i]) )
+    if( ex < 0 )
+    {
+      break;
+    }
+
+    if( ( nb_workers <= 0 ) || ( nb_workers > nb_targets ) )
+    {
+      nb_workers = nb_targets;
+    }
+    if( nb_workers > ETX_OTA_MAX_WORKERS )
+    {
+      nb_workers = ETX_OTA_MAX_WORKERS;
+    }
+
+    uint32_t start = etx_ota_get_ms();
+
+    for( ; nb_started < nb_workers; nb_started++ )
+    {
+      if( pthread_create( &workers[nb_started], NULL, etx_ota_worker, &pool ) != 0 )
+      {
+        printf("Can not start the worker %d\n", nb_started);
+        break;
+      }
+    }
+
+    if( nb_started == 0 )
     {
-      //some data missed.
-      printf("OTA HEADER : Send Err\n");
       ex = -1;
       break;
     }
+
+    //Print the progress until all the devices are done
+    bool is_done = false;
+    while( !is_done )
+    {
+      etx_ota_delay_us( ETX_OTA_PROGRESS_MS * 1000u );
+
+      is_done = ( print_many_progress( list, nb_targets, start ) == nb_targets );
+    }
+  }while( false );
+
+  for( int i = 0; i < nb_started; i++ )
+  {
+    pthread_join( workers[i], NULL );
   }
 
-  if( ex >= 0 )
+  for( int i = 0; ( ex == 0 ) && ( i < nb_targets ); i++ )
   {
-    if( !is_ack_resp_received( comport ) )
+    if( pool.sessions[i].ex != 0 )
     {
-      //Received NACK
-      printf("OTA HEADER : NACK\n");
-      ex = -1;
+      printf("%sOTA ERROR\n", pool.sessions[i].tag);
+      nb_failed++;
     }
   }
-  printf("OTA HEADER [ex = %d]\n", ex);
+  if( nb_failed )
+  {
+    ex = -1;
+  }
+
+  pthread_mutex_destroy( &pool.lock );
+  free( pool.sessions );
+  free( pool.images );
+  free( list );
+
   return ex;
 }
 
-/* Build and send the OTA Data */
-int send_ota_data(int comport, uint8_t *data, uint16_t data_len)
+/* Update many devices from one thread (event loop).
+ * targets : "<COM number>=<image>" for each device */
+int update_many_devices_loop( int nb_targets, char *targets[] )
 {
-  uint16_t len;
-  ETX_OTA_DATA_ *ota_data = (ETX_OTA_DATA_*)DATA_BUF;
-  int ex = 0;
+  ETX_OTA_EV_SESSION_ *evs  = calloc( nb_targets, sizeof(ETX_OTA_EV_SESSION_) );
+  ETX_OTA_SESSION_    **list = calloc( nb_targets, sizeof(ETX_OTA_SESSION_ *) );
+  ETX_OTA_REPORT_     report;
+  int                 nb_failed = 0;
+  int                 ex        = 0;
 
-  memset(DATA_BUF, 0, ETX_OTA_PACKET_MAX_SIZE);
-
-  ota_data->sof          = ETX_OTA_SOF;
-  ota_data->packet_type  = ETX_OTA_PACKET_TYPE_DATA;
-  ota_data->data_len     = data_len;
-
-  len = 4;
+  do
+  {
+    if( ( evs == NULL ) || ( list == NULL ) )
+    {
+      printf("Out of memory\n");
+      ex = -1;
+      break;
+    }
 
-  //Copy the data
-  memcpy(&DATA_BUF[len], data, data_len );
-  len += data_len;
+    for( int i = 0; i < nb_targets; i++ )
+    {
+      ETX_OTA_SESSION_ *s = &evs[i].s;
 
-  //Calculate and Copy the crc
-  uint32_t crc = CalcCRC( data, data_len);
-  memcpy(&DATA_BUF[len], (uint8_t*)&crc, sizeof(crc) );
-  len += sizeof(crc);
+      ex = get_target( targets[i], list, i, &s->comport, &s->bin_name );
+      if( ex < 0 )
+      {
+        break;
+      }
+      snprintf( s->tag, sizeof(s->tag), "[COM%d] ", s->comport + 1 );
+      list[i] = s;
+    }
 
-  //Add the EOF
-  DATA_BUF[len] = ETX_OTA_EOF;
-  len++;
+    if( ex < 0 )
+    {
+      break;
+    }
 
-  //printf("Sending %d Data\n", len);
+    report.list        = list;
+    report.nb_sessions = nb_targets;
+    report.start_ms    = etx_ota_get_ms();
 
-  //send OTA Data
-  for(int i = 0; i < len; i++)
-  {
-    delay(500);
-    if( RS232_SendByte(comport, DATA_BUF[i]) )
+    ex = etx_ota_loop_run( evs, nb_targets, ETX_OTA_BAUDRATE, print_loop_progress, &report );
+    if( ex < 0 )
     {
-      //some data missed.
-      printf("OTA DATA : Send Err\n");
-      ex = -1;
       break;
     }
-  }
 
-  if( ex >= 0 )
-  {
-    if( !is_ack_resp_received( comport ) )
+    for( int i = 0; i < nb_targets; i++ )
+    {
+      if( evs[i].s.ex != 0 )
+      {
+        printf("%sOTA ERROR\n", evs[i].s.tag);
+        nb_failed++;
+      }
+    }
+    if( nb_failed )
     {
-      //Received NACK
-      printf("OTA DATA : NACK\n");
       ex = -1;
     }
-  }
-  //printf("OTA DATA [ex = %d]\n", ex);
+  }while( false );
+
+  free( evs );
+  free( list );
+
   return ex;
 }
 
 int main(int argc, char *argv[])
 {
-  int comport;
-  int bdrate   = 115200;       /* 115200 baud */
-  char mode[]={'8','N','1',0}; /* *-bits, No parity, 1 stop bit */
+  int bdrate   = ETX_OTA_BAUDRATE;
   char bin_name[1024];
   int ex = 0;
-  FILE *Fptr = NULL;
+  bool is_bootloader = false;
+  static ETX_OTA_SESSION_ session;
+
+  session.comport = -1;
 
   do
   {
-    if( argc <= 2 )
+    if( ( argc > 3 ) && ( !strcmp( argv[1], "-m" ) ) )
     {
-      printf("Please feed the COM PORT number and the Application Image....!!!\n");
-      printf("Example: .\\etx_ota_app.exe 8 ..\\..\\Application\\Debug\\Blinky.bin");
-      ex = -1;
+      //No device is needed. Just print the SD card manifest line.
+      ex = print_manifest_line( argv[2], argv[3], ( argc > 4 ) ? argv[4] : NULL );
       break;
     }
 
-    //get the COM port Number
-    comport = atoi(argv[1]) -1;
-    strcpy(bin_name, argv[2]);
-
-    printf("Opening COM%d...\n", comport+1 );
-
-    if( RS232_OpenComport(comport, bdrate, mode, 0) )
+    if( ( argc > 2 ) && ( !strcmp( argv[1], "-j" ) ) )
     {
-      printf("Can not open comport\n");
-      ex = -1;
+      ex = print_journal( argv[2] );
       break;
     }
 
-    //send OTA Start command
-    ex = send_ota_start(comport);
-    if( ex < 0 )
+    if( ( argc > 2 ) && ( !strcmp( argv[1], "-E" ) ) )
     {
-      printf("send_ota_start Err\n");
+      //Many devices from one thread
+      ex = update_many_devices_loop( argc - 2, &argv[2] );
       break;
     }
 
-    printf("Opening Binary file : %s\n", bin_name);
-
-    Fptr = fopen(bin_name,"rb");
-
-    if( Fptr == NULL )
+    if( ( argc > 3 ) && ( !strcmp( argv[1], "-M" ) ) )
     {
-      printf("Can not open %s\n", bin_name);
-      ex = -1;
+      //Many devices at the same time
+      ex = update_many_devices( atoi( argv[2] ), argc - 3, &argv[3] );
       break;
     }
 
-    fseek(Fptr, 0L, SEEK_END);
-    uint32_t app_size = ftell(Fptr);
-    fseek(Fptr, 0L, SEEK_SET);
-
-    printf("File size = %d\n", app_size);
+    if( ( argc > 3 ) && ( !strcmp( argv[2], "-b" ) ) )
+    {
+      //Bootloader image
+      is_bootloader = true;
+    }
 
-    //read the full image
-    if( fread( APP_BIN, 1, app_size, Fptr ) != app_size )
+    if( ( argc <= 2 ) || ( ( argv[2][0] == '-' ) && ( argc <= 4 ) && ( !is_bootloader ) ) )
     {
-      printf("App/FW read Error\n");
+      printf("Please feed the COM PORT number and the Application Image....!!!\n");
+      printf("Example: .\\etx_ota_app.exe 8 ..\\..\\Application\\Debug\\Blinky.bin\n");
+      printf("Bootloader: .\\etx_ota_app.exe 8 -b ..\\..\\Bootloader\\Debug\\Bootloader.bin\n");
+      printf("Read back : .\\etx_ota_app.exe 8 -r <slot0|slot1|app> backup.bin\n");
+      printf("Verify    : .\\etx_ota_app.exe 8 -v <slot0|slot1|app> Blinky.bin\n");
+      printf("Many      : .\\etx_ota_app.exe -M <workers|0> 8=Blinky.bin 9=Blinky.bin ...\n");
+      printf("Many (1 thread, Linux) : ./etx_ota_app -E 17=Blinky.bin 18=Blinky.bin ...\n");
+      printf("SD card   : .\\etx_ota_app.exe -m <app|bootloader> Blinky.bin [ETX_FW/Blinky.bin]\n");
+      printf("Journal   : .\\etx_ota_app.exe -j journal.bin\n");
       ex = -1;
       break;
     }
 
-    //Send OTA Header
-    meta_info ota_info;
-    ota_info.package_size = app_size;
-    ota_info.package_crc  = CalcCRC( APP_BIN, app_size);
+    //get the COM port Number
+    strcpy(bin_name, is_bootloader ? argv[3] : argv[2]);
 
-    ex = send_ota_header( comport, &ota_info );
+    ex = etx_ota_open( &session, atoi(argv[1]) -1, bdrate );
     if( ex < 0 )
     {
-      printf("send_ota_header Err\n");
       break;
     }
 
-    uint16_t size = 0;
+    if( session.is_info )
+    {
+      print_device_info( &session.dev_info );
+    }
 
-    for( uint32_t i = 0; i < app_size; )
+    //Read back or verify
+    if( ( argv[2][0] == '-' ) && ( !is_bootloader ) )
     {
-      if( ( app_size - i ) >= ETX_OTA_DATA_MAX_SIZE )
+      int region = get_region( argv[3] );
+      if( region < 0 )
       {
-        size = ETX_OTA_DATA_MAX_SIZE;
+        printf("Invalid region %s\n", argv[3]);
+        ex = -1;
+        break;
       }
-      else
+
+      if( !strcmp( argv[2], "-r" ) )
       {
-        size = app_size - i;
+        ex = etx_ota_read_back( &session, region, argv[4] );
       }
-
-      printf("[%d/%d]\r\n", i/ETX_OTA_DATA_MAX_SIZE, app_size/ETX_OTA_DATA_MAX_SIZE);
-
-      ex = send_ota_data( comport, &APP_BIN[i], size );
-      if( ex < 0 )
+      else if( !strcmp( argv[2], "-v" ) )
       {
-        printf("send_ota_data Err [i=%d]\n", i);
-        break;
+        ex = etx_ota_verify( &session, region, argv[4] );
+      }
+      else
+      {
+        printf("Invalid option %s\n", argv[2]);
+        ex = -1;
       }
 
-      i += size;
-    }
-
-    if( ex < 0 )
-    {
+      //We are done. Let the device boot the application.
+      etx_ota_send_cmd( &session, ETX_OTA_CMD_ABORT );
       break;
     }
 
-    //send OTA END command
-    ex = send_ota_end(comport);
-    if( ex < 0 )
-    {
-      printf("send_ota_end Err\n");
-      break;
-    }    
+    session.progress_cb = print_progress;
+    session.cb_arg      = &session;
+    ex = etx_ota_update( &session, bin_name, is_bootloader );
 
   } while (false);
 
-  if(Fptr)
-  {
-    fclose(Fptr);
-  }
+  etx_ota_close( &session );
 
   if( ex < 0 )
   {
@@ -417,4 +635,3 @@ int main(int argc, char *argv[])
   }
   return(ex);
 }
-
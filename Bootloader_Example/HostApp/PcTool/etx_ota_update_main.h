@@ -12,13 +12,28 @@
 #define ETX_OTA_EOF  0xBB    // End of Frame
 #define ETX_OTA_ACK  0x00    // ACK
 #define ETX_OTA_NACK 0x01    // NACK
+#define ETX_OTA_ALREADY 0x02 // Image is already present in a slot (no download)
 
 #define ETX_APP_FLASH_ADDR 0x08040000   //Application's Flash Address
+#define ETX_NO_OF_SLOTS    2            //Number of slots
+#define ETX_NO_OF_SECTORS  12           //Number of flash sectors
 
 #define ETX_OTA_DATA_MAX_SIZE ( 1024 )  //Maximum data Size
 #define ETX_OTA_DATA_OVERHEAD (    9 )  //data overhead
 #define ETX_OTA_PACKET_MAX_SIZE ( ETX_OTA_DATA_MAX_SIZE + ETX_OTA_DATA_OVERHEAD )
-#define ETX_OTA_MAX_FW_SIZE ( 1024 * 512 )
+
+#define ETX_OTA_RESP_TIMEOUT  ( 10000 )   //Max time to wait for the response (ms)
+#define ETX_OTA_INFO_TIMEOUT  (  1000 )   //Max time to wait for the device info (ms)
+#define ETX_OTA_TX_TIMEOUT    (  1000 )   //Max time without any progress while sending (ms)
+#define ETX_OTA_BAUDRATE      ( 115200 )  //Link rate
+#define ETX_OTA_CMD_GAP_CHARS  ( 1 )      //Idle characters between the command bytes (legacy devices)
+#define ETX_OTA_DATA_GAP_CHARS ( 6 )      //Idle characters between the data bytes (legacy devices)
+#define ETX_OTA_MAX_WORKERS   ( 64 )     //Max devices updated at the same time
+#define ETX_OTA_PROGRESS_MS   ( 1000 )   //Progress print interval in the multi device mode (ms)
+#define ETX_OTA_VERIFY_BLOCK_SIZE ( 4096 ) //Block size used to verify the image
+
+#define ETX_DIGEST_SIZE           ( 32 )                  //SHA-256 digest size
+#define ETX_APP_DESC_MAGIC        ( 0x44585445 )          //"ETXD"
 
 
 /*
@@ -51,6 +66,7 @@ typedef enum
   ETX_OTA_PACKET_TYPE_DATA      = 1,    // Data
   ETX_OTA_PACKET_TYPE_HEADER    = 2,    // Header
   ETX_OTA_PACKET_TYPE_RESPONSE  = 3,    // Response
+  ETX_OTA_PACKET_TYPE_INFO      = 4,    // Device info (response to GET_INFO)
 }ETX_OTA_PACKET_TYPE_;
 
 /*
@@ -61,8 +77,50 @@ typedef enum
   ETX_OTA_CMD_START = 0,    // OTA Start command
   ETX_OTA_CMD_END   = 1,    // OTA End command
   ETX_OTA_CMD_ABORT = 2,    // OTA Abort command
+  ETX_OTA_CMD_GET_INFO = 3, // Device info/capability query
+  ETX_OTA_CMD_READ_BACK = 4,// Read back the flash (ETX_OTA_READ_CMD_)
 }ETX_OTA_CMD_;
 
+/*
+ * Features supported by the bootloader (ETX_OTA_INFO_.features)
+ */
+#define ETX_OTA_FEATURE_STREAM      ( 1u << 0 )   // Frames can be sent without inter-byte gaps
+#define ETX_OTA_FEATURE_SKIP_SAME   ( 1u << 1 )   // Skips the download if the image is present
+#define ETX_OTA_FEATURE_ROLLBACK    ( 1u << 2 )   // Supports the rollback to previous app
+#define ETX_OTA_FEATURE_TRIAL_BOOT  ( 1u << 3 )   // Trial boot with the watchdog
+#define ETX_OTA_FEATURE_READ_BACK   ( 1u << 4 )   // Supports the read back command
+#define ETX_OTA_FEATURE_BL_UPDATE   ( 1u << 5 )   // Supports the bootloader update
+#define ETX_OTA_FEATURE_WEAR        ( 1u << 6 )   // Reports the flash erase counters
+#define ETX_OTA_FEATURE_FLOW_CTRL   ( 1u << 7 )   // RTS/CTS flow control on the OTA UART
+
+/*
+ * Read back regions
+ */
+typedef enum
+{
+  ETX_OTA_REGION_SLOT0  = 0,    // Slot 0
+  ETX_OTA_REGION_SLOT1  = 1,    // Slot 1
+  ETX_OTA_REGION_APP    = 2,    // Application's flash
+}ETX_OTA_REGION_;
+
+/*
+ * Read back modes
+ */
+typedef enum
+{
+  ETX_OTA_READ_MODE_DATA  = 0,  // Send the data (one data packet per block)
+  ETX_OTA_READ_MODE_CRC   = 1,  // Send only the CRC of each block (verify only)
+}ETX_OTA_READ_MODE_;
+
+/*
+ * Image type (meta_info.image_type)
+ */
+typedef enum
+{
+  ETX_OTA_IMAGE_APP         = 0,    // Application
+  ETX_OTA_IMAGE_BOOTLOADER  = 1,    // Bootloader
+}ETX_OTA_IMAGE_;
+
 /*
  * OTA meta info
  */
@@ -70,10 +128,22 @@ typedef struct
 {
   uint32_t package_size;
   uint32_t package_crc;
-  uint32_t reserved1;
-  uint32_t reserved2;
+  uint32_t fw_version;                // Firmware version (major << 16 | minor << 8 | patch)
+  uint32_t build_id;                  // Build ID (build timestamp)
+  uint8_t  digest[ETX_DIGEST_SIZE];   // SHA-256 of the image
+  uint32_t image_type;                // ETX_OTA_IMAGE_
 }__attribute__((packed)) meta_info;
 
+/*
+ * Application image descriptor (embedded in the application image)
+ */
+typedef struct
+{
+  uint32_t magic;                     // ETX_APP_DESC_MAGIC
+  uint32_t fw_version;                // Firmware version
+  char     build_time[24];            // __DATE__ " " __TIME__
+}__attribute__((packed)) ETX_APP_DESC_;
+
 /*
  * OTA Command format
  *
@@ -93,6 +163,33 @@ typedef struct
   uint8_t   eof;
 }__attribute__((packed)) ETX_OTA_COMMAND_;
 
+/*
+ * OTA Read back command format
+ *
+ * __________________________________________________________________________________
+ * |     | Packet |     |     |        |        |        | Block |      |     |     |
+ * | SOF | Type   | Len | CMD | Region | Offset | Length | Size  | Mode | CRC | EOF |
+ * |_____|________|_____|_____|________|________|________|_______|______|_____|_____|
+ *   1B      1B     2B    1B      1B       4B       4B      2B      1B    4B    1B
+ *
+ * Length 0 reads the whole image of the region. The device replies with the
+ * data packets (data or the block CRCs) followed by ACK (or NACK on error).
+ */
+typedef struct
+{
+  uint8_t   sof;
+  uint8_t   packet_type;
+  uint16_t  data_len;
+  uint8_t   cmd;
+  uint8_t   region;
+  uint32_t  offset;
+  uint32_t  length;
+  uint16_t  block_size;
+  uint8_t   mode;
+  uint32_t  crc;
+  uint8_t   eof;
+}__attribute__((packed)) ETX_OTA_READ_CMD_;
+
 /*
  * OTA Header format
  *
@@ -100,7 +197,7 @@ typedef struct
  * |     | Packet |     | Header |     |     |
  * | SOF | Type   | Len |  Data  | CRC | EOF |
  * |_____|________|_____|________|_____|_____|
- *   1B      1B     2B     16B     4B    1B
+ *   1B      1B     2B     52B     4B    1B
  */
 typedef struct
 {
@@ -129,6 +226,44 @@ typedef struct
   uint8_t     *data;
 }__attribute__((packed)) ETX_OTA_DATA_;
 
+/*
+ * Slot status in the device info
+ */
+typedef struct
+{
+  uint8_t   is_valid;
+  uint8_t   is_active;
+  uint8_t   is_trial;
+  uint8_t   reserved;
+  uint32_t  fw_size;
+  uint32_t  fw_crc;
+  uint32_t  fw_version;
+  uint32_t  build_id;
+}__attribute__((packed)) ETX_OTA_SLOT_INFO_;
+
+/*
+ * Device info (version 1)
+ */
+typedef struct
+{
+  uint8_t             info_version;
+  uint8_t             bl_version[2];
+  uint8_t             no_of_slots;
+  uint32_t            features;
+  uint32_t            max_data_size;
+  uint32_t            baudrate;
+  uint32_t            flash_size;
+  uint32_t            app_flash_addr;
+  uint32_t            slot_max_size;
+  uint32_t            reboot_cause;
+  ETX_OTA_SLOT_INFO_  slots[ETX_NO_OF_SLOTS];
+  /* Info version 2 */
+  uint8_t             no_of_sectors;      // Number of flash sectors
+  uint8_t             reserved[3];
+  uint32_t            cfg_free_records;   // Config writes left before the config sector is erased
+  uint32_t            erase_count[ETX_NO_OF_SECTORS]; // Number of erases of each sector
+}__attribute__((packed)) ETX_OTA_INFO_;
+
 /*
  * OTA Response format
  *
@@ -148,4 +283,45 @@ typedef struct
   uint8_t   eof;
 }__attribute__((packed)) ETX_OTA_RESP_;
 
+/*
+ * Bootloader's telemetry journal in the SD card (ETX_FW/journal.bin).
+ * Must be the same as the bootloader's etx_journal.h.
+ */
+#define ETX_JOURNAL_MAGIC         ( 0x4C4E524A )          //"JRNL"
+#define ETX_JOURNAL_SECTOR_SIZE   ( 512 )
+#define ETX_JOURNAL_REC_STAGE     ( 1 )
+#define ETX_JOURNAL_REC_UPDATE    ( 2 )
+#define ETX_JOURNAL_REC_COUNTERS  ( 3 )
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t sectors;
+  uint16_t rec_len;
+  uint8_t  bl_version[2];
+  uint8_t  dropped;
+  uint8_t  reserved;
+  uint32_t reboot_cause;
+  uint32_t tick;
+  uint32_t crc;
+}__attribute__((packed)) ETX_JOURNAL_HDR_;
+
+typedef struct
+{
+  uint8_t  stage;
+  uint8_t  result;
+  uint32_t start;
+  uint32_t duration;
+}__attribute__((packed)) ETX_JOURNAL_STAGE_REC_;
+
+typedef struct
+{
+  uint8_t  source;
+  uint8_t  image_type;
+  uint8_t  result;
+  uint32_t size;
+  uint32_t duration;
+  uint32_t throughput;
+}__attribute__((packed)) ETX_JOURNAL_UPDATE_REC_;
+
 #endif /* INC_ETX_OTA_UPDATE_MAIN_H_ */